@@ -3,6 +3,7 @@
 
 #include "Vec.h"
 #include "Ray.h"
+#include "RayPacket.h"
 
 // setup camera as the thing which generates rays, moving pixel/image data to renderer code
 class Camera
@@ -16,5 +17,21 @@ class Camera
         // setup camera parameters
         void setResolution(const ivec2 &number_of_pixels) { number_pixels = number_of_pixels; }
         virtual Ray generateRay(const ivec2 &pixel_index) const = 0;
+
+        // fill the packet with the rays of the block_size pixel block starting at first_pixel, row by row.
+        // the caller clips the block to the image, it may hold at most RayPacket::max_size pixels
+        virtual void generateRayPacket(const ivec2 &first_pixel, const ivec2 &block_size, RayPacket &packet) const
+        {
+            assert(block_size[0] * block_size[1] <= RayPacket::max_size);
+            packet.size = 0;
+            for (int j = 0; j < block_size[1]; ++j) {
+                for (int i = 0; i < block_size[0]; ++i) {
+                    ivec2 pixel(first_pixel[0] + i, first_pixel[1] + j);
+                    packet.pixels[packet.size] = pixel;
+                    packet.rays[packet.size++] = generateRay(pixel);
+                }
+            }
+            packet.computeBounds();
+        }
 };
 #endif
\ No newline at end of file
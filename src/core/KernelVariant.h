@@ -0,0 +1,56 @@
+// body of one kernel table, included once by the translation unit of each instruction set level after it
+// defines KERNEL_TARGET (the target attribute, empty for the generic level), KERNEL_LEVEL and KERNEL_TABLE
+// (the name of the table accessor). the entry points have internal linkage and inline their kernel, so no
+// code built for one level can be picked up by the linker for another. no include guard on purpose
+
+#include "core/Kernels.h"
+#include "geometry/SphereKernel.h"
+#include "geometry/TriangleKernel.h"
+#include "photon-core/PhotonKernel.h"
+
+namespace {
+
+template<class Real>
+KERNEL_TARGET int closestSphereEntry(const std::vector<Real> (&center)[3], const std::vector<Real>& radii, int first_slot, int count,
+                                     const Ray& ray, Real discriminant_min, Real slack, Real t_min, Real& t_closest) {
+    return closestSphere(center, radii, first_slot, count, ray, discriminant_min, slack, t_min, t_closest);
+}
+
+template<class Real>
+KERNEL_TARGET int occludingSphereEntry(const std::vector<Real> (&center)[3], const std::vector<Real>& radii, int first_slot, int offset,
+                                       int count, const Ray& ray, Real discriminant_min, Real slack, Real t_min, Real t_max) {
+    return firstOccludingSphere(center, radii, first_slot, offset, count, ray, discriminant_min, slack, t_min, t_max);
+}
+
+template<int Width, class Real>
+KERNEL_TARGET int triangleBlockEntry(const TriangleBlock<Width, Real>& block, const WatertightRay& wr, const vec3& origin,
+                                     Real t_min, Real& t_max, Real& b1, Real& b2) {
+    return intersectTriangleBlock(block, wr, origin, t_min, t_max, b1, b2);
+}
+
+KERNEL_TARGET void photonDistancesEntry(const double* x, const double* y, const double* z, int count, const vec3& point,
+                                        double* distance_squared) {
+    photonDistances(x, y, z, count, point, distance_squared);
+}
+
+KERNEL_TARGET vec3 photonPowerEntry(const PhotonInteraction* interactions, int count, const vec3& normal, double radius_squared,
+                                    bool cone) {
+    return photonPower(interactions, count, normal, radius_squared, cone);
+}
+
+} // namespace
+
+const KernelTable& KERNEL_TABLE() {
+    static const KernelTable table = {
+        KERNEL_LEVEL,
+        closestSphereEntry<double>,
+        closestSphereEntry<float>,
+        occludingSphereEntry<double>,
+        occludingSphereEntry<float>,
+        triangleBlockEntry<4, double>,
+        triangleBlockEntry<8, float>,
+        photonDistancesEntry,
+        photonPowerEntry,
+    };
+    return table;
+}
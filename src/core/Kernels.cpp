@@ -0,0 +1,48 @@
+#include "core/Kernels.h"
+#include <atomic>
+#include <iostream>
+
+#define KERNEL_TARGET
+#define KERNEL_LEVEL SimdLevel::Generic
+#define KERNEL_TABLE genericKernels
+#include "core/KernelVariant.h"
+
+
+static const KernelTable& kernelsFor(SimdLevel level) {
+#ifdef SIMD_DISPATCH
+    switch (level) {
+    case SimdLevel::SSE42:
+        return sse42Kernels();
+    case SimdLevel::AVX2:
+        return avx2Kernels();
+    case SimdLevel::AVX512:
+        return avx512Kernels();
+    default:
+        break;
+    }
+#endif
+    return genericKernels();
+}
+
+
+static std::atomic<const KernelTable*>& activeKernels() {
+    static std::atomic<const KernelTable*> active{&kernelsFor(detectSimdLevel())};
+    return active;
+}
+
+
+const KernelTable& kernels() {
+    return *activeKernels().load(std::memory_order_acquire);
+}
+
+
+bool selectKernels(SimdLevel level) {
+    SimdLevel supported = detectSimdLevel();
+    if (level > supported) {
+        std::cerr << "Cannot run " << simdLevelName(level) << " kernels on this CPU, it supports up to "
+                  << simdLevelName(supported) << std::endl;
+        return false;
+    }
+    activeKernels().store(&kernelsFor(level), std::memory_order_release);
+    return true;
+}
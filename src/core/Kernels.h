@@ -0,0 +1,54 @@
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include <vector>
+#include "core/Vec.h"
+#include "core/Ray.h"
+#include "geometry/TriangleKernel.h"
+#include "photon-core/Photon.h"
+#include "utils/CpuFeatures.h"
+
+// entry points of the hot kernels compiled for one instruction set level. the kernels themselves live next
+// to their callers (SphereKernel.h, TriangleKernel.h, PhotonKernel.h), each level's table inlines them into
+// entry points carrying its target attribute. all levels run the same operations in the same order, so they
+// return bit-identical results and only differ in speed. the wide BVH box tests pick their variant with
+// kernels().level as well, see WideBVH.cpp
+struct KernelTable {
+    SimdLevel level;
+
+    int (*closest_sphere)(const std::vector<double> (&center)[3], const std::vector<double>& radii, int first_slot, int count,
+                          const Ray& ray, double discriminant_min, double slack, double t_min, double& t_closest);
+    int (*closest_sphere_float)(const std::vector<float> (&center)[3], const std::vector<float>& radii, int first_slot, int count,
+                                const Ray& ray, float discriminant_min, float slack, float t_min, float& t_closest);
+    int (*occluding_sphere)(const std::vector<double> (&center)[3], const std::vector<double>& radii, int first_slot, int offset,
+                            int count, const Ray& ray, double discriminant_min, double slack, double t_min, double t_max);
+    int (*occluding_sphere_float)(const std::vector<float> (&center)[3], const std::vector<float>& radii, int first_slot, int offset,
+                                  int count, const Ray& ray, float discriminant_min, float slack, float t_min, float t_max);
+
+    // blocks of 4 doubles (meshes, the double precision primitive store) and of 8 floats (single precision)
+    int (*triangle_block)(const TriangleBlock<4, double>& block, const WatertightRay& wr, const vec3& origin,
+                          double t_min, double& t_max, double& b1, double& b2);
+    int (*triangle_block_float)(const TriangleBlock<8, float>& block, const WatertightRay& wr, const vec3& origin,
+                                float t_min, float& t_max, float& b1, float& b2);
+
+    // photon kd-tree leaf scan and the density estimation sum
+    void (*photon_distances)(const double* x, const double* y, const double* z, int count, const vec3& point, double* distance_squared);
+    vec3 (*photon_power)(const PhotonInteraction* interactions, int count, const vec3& normal, double radius_squared, bool cone);
+};
+
+// the active table: the highest level the CPU supports, unless selectKernels picked another one
+const KernelTable& kernels();
+
+// run every kernel at the given level from now on, for benchmarking one variant against another. a level
+// the CPU lacks is refused with a message and the active table is kept
+bool selectKernels(SimdLevel level);
+
+// tables of the single levels, the ones above Generic only exist where SIMD_DISPATCH is defined
+const KernelTable& genericKernels();
+#ifdef SIMD_DISPATCH
+const KernelTable& sse42Kernels();
+const KernelTable& avx2Kernels();
+const KernelTable& avx512Kernels();
+#endif
+
+#endif
@@ -0,0 +1,8 @@
+#include "utils/CpuFeatures.h"
+
+#ifdef SIMD_DISPATCH
+#define KERNEL_TARGET SIMD_TARGET_AVX2
+#define KERNEL_LEVEL SimdLevel::AVX2
+#define KERNEL_TABLE avx2Kernels
+#include "core/KernelVariant.h"
+#endif
@@ -0,0 +1,8 @@
+#include "utils/CpuFeatures.h"
+
+#ifdef SIMD_DISPATCH
+#define KERNEL_TARGET SIMD_TARGET_SSE42
+#define KERNEL_LEVEL SimdLevel::SSE42
+#define KERNEL_TABLE sse42Kernels
+#include "core/KernelVariant.h"
+#endif
@@ -55,3 +55,23 @@ Ray PerspectiveCamera::generateRay(const ivec2& pixel_index) const
     vec3 directionVec = (pixelPosition - position).normalized();
     return Ray(position, directionVec);
 }
+
+void PerspectiveCamera::generateRayPacket(const ivec2& first_pixel, const ivec2& block_size, RayPacket& packet) const
+{
+    assert(block_size[0] * block_size[1] <= RayPacket::max_size);
+    vec3 step_x = horizontal_vector * pixel_size[0];
+    vec3 step_y = vertical_vector * pixel_size[1];
+    vec3 row_start = worldPosition(first_pixel) - position;
+
+    packet.size = 0;
+    for (int j = 0; j < block_size[1]; ++j) {
+        vec3 direction = row_start;
+        for (int i = 0; i < block_size[0]; ++i) {
+            packet.pixels[packet.size] = ivec2(first_pixel[0] + i, first_pixel[1] + j);
+            packet.rays[packet.size++] = Ray(position, direction); // Ray normalizes the direction
+            direction += step_x;
+        }
+        row_start += step_y;
+    }
+    packet.computeBounds();
+}
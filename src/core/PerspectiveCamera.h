@@ -36,5 +36,7 @@ public:
 
     // get ray for a given pixel
     Ray generateRay(const ivec2& pixel_index) const override;
+    // get rays for a block of pixels, stepping across the film instead of recomputing every pixel position
+    void generateRayPacket(const ivec2& first_pixel, const ivec2& block_size, RayPacket& packet) const override;
 };
 #endif
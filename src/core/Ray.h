@@ -9,13 +9,25 @@ class Ray
 public:
     vec3 origin; // origin of the ray where t=0
     vec3 direction; // direction the ray sweeps out - unit vector
+    // cached once per ray for the slab tests, every box visited during traversal reuses them
+    vec3 inv_direction; // componentwise 1 / direction, +-inf along axes the ray is parallel to
+    int sign[3]; // 1 if the direction is negative along that axis, picks the near/far box corner
 
     Ray()
-        :origin(0,0,0),direction(0,0,1) {}
+        :origin(0,0,0),direction(0,0,1) { precompute(); }
 
     Ray(const vec3& origin_input,const vec3& direction_input)
-        :origin(origin_input),direction(direction_input.normalized()) {}
+        :origin(origin_input),direction(direction_input.normalized()) { precompute(); }
 
     vec3 point(double t) const { return origin + direction * t;}
+
+private:
+    void precompute()
+    {
+        for(int i = 0; i < 3; i++) {
+            inv_direction[i] = 1.0 / direction[i];
+            sign[i] = inv_direction[i] < 0;
+        }
+    }
 };
 #endif
@@ -0,0 +1,90 @@
+#ifndef __RAY_PACKET_H__
+#define __RAY_PACKET_H__
+
+#include <cstdint>
+#include <cmath>
+#include "core/Vec.h"
+#include "core/Ray.h"
+#include "geometry/AABB.h"
+
+// index of the lowest set bit of a non-zero ray mask
+inline int lowestRay(uint64_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(mask);
+#else
+    int index = 0;
+    while (!(mask & 1)) { mask >>= 1; index++; }
+    return index;
+#endif
+}
+
+// the rays from index first onwards
+inline uint64_t raysFrom(int first) { return first >= 64 ? 0 : ~uint64_t(0) << first; }
+
+// a square block of neighbouring primary rays (4x4 or 8x8 pixels) traced together.
+// when every ray points into the same octant the packet also keeps interval bounds of its
+// origins and reciprocal directions, which let traversal cull a box for the whole packet at once.
+struct RayPacket {
+    static constexpr int max_size = 64; // 8x8 pixels, one bit per ray in a uint64_t mask
+
+    int size = 0;
+    Ray rays[max_size];
+    ivec2 pixels[max_size]; // pixel each ray was generated for
+
+    bool coherent = false; // all rays share the direction sign on every axis, required by mayIntersect
+    vec3 origin_min, origin_max;
+    vec3 inv_direction_min, inv_direction_max;
+
+    uint64_t fullMask() const { return size >= 64 ? ~uint64_t(0) : (uint64_t(1) << size) - 1; }
+
+    // fill in the interval bounds, call after the rays are written
+    void computeBounds()
+    {
+        coherent = size > 0;
+        origin_min = origin_max = size > 0 ? rays[0].origin : vec3();
+        inv_direction_min = inv_direction_max = size > 0 ? rays[0].inv_direction : vec3();
+        for (int i = 1; i < size; i++) {
+            for (int a = 0; a < 3; a++) {
+                if (rays[i].sign[a] != rays[0].sign[a]) coherent = false;
+            }
+            origin_min = componentwise_min(origin_min, rays[i].origin);
+            origin_max = componentwise_max(origin_max, rays[i].origin);
+            inv_direction_min = componentwise_min(inv_direction_min, rays[i].inv_direction);
+            inv_direction_max = componentwise_max(inv_direction_max, rays[i].inv_direction);
+        }
+    }
+
+    // interval arithmetic slab test: false only if no ray of the packet can hit the box within [t_min, t_max].
+    // always true for incoherent packets
+    bool mayIntersect(const vec3& box_min, const vec3& box_max, double t_min, double t_max) const
+    {
+        if (!coherent) return true;
+        for (int a = 0; a < 3; a++) {
+            // an axis some ray is parallel to cannot be bounded this way, it just does not cull
+            if (std::isinf(inv_direction_min[a]) || std::isinf(inv_direction_max[a])) continue;
+            bool negative = rays[0].sign[a];
+            double near_plane = negative ? box_max[a] : box_min[a];
+            double far_plane = negative ? box_min[a] : box_max[a];
+
+            // the bounds of a product of two intervals are reached at their corners
+            double near_lo = near_plane - origin_max[a], near_hi = near_plane - origin_min[a];
+            double far_lo = far_plane - origin_max[a], far_hi = far_plane - origin_min[a];
+            double t_near = std::min(std::min(near_lo * inv_direction_min[a], near_lo * inv_direction_max[a]),
+                                     std::min(near_hi * inv_direction_min[a], near_hi * inv_direction_max[a]));
+            double t_far = std::max(std::max(far_lo * inv_direction_min[a], far_lo * inv_direction_max[a]),
+                                    std::max(far_hi * inv_direction_min[a], far_hi * inv_direction_max[a]));
+            t_min = std::max(t_min, t_near);
+            t_max = std::min(t_max, t_far);
+            if (t_max < t_min) return false;
+        }
+        return true;
+    }
+
+    bool mayIntersect(const AABB& box, double t_min, double t_max) const
+    {
+        return mayIntersect(box.min, box.max, t_min, t_max);
+    }
+};
+
+#endif
@@ -3,16 +3,31 @@
 #include <cmath>
 
 
+// SplitMix64 finalizer, maps consecutive counters to well mixed 64-bit words
+static uint64_t mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
 // initialize the random number generator with the seed so its consistent
-Sampler::Sampler(unsigned int seed) 
+Sampler::Sampler(unsigned int seed)
+    : key(mix(seed)), dimension(0)
+{
+}
+
+Sampler::Sampler(unsigned int seed, int pixel, int sample, SampleDomain domain)
+    : key(mix(mix(mix(mix(seed) ^ static_cast<uint32_t>(domain)) ^ static_cast<uint32_t>(pixel)) ^ static_cast<uint32_t>(sample))),
+      dimension(0)
 {
-    randomNumGenerator = std::mt19937(seed);
-    floatDistribution = std::uniform_real_distribution<double>(0.0, 1.0);
 }
 
 double Sampler::getRandomFloat()
 {
-    return floatDistribution(randomNumGenerator); //returns between 0 and 1
+    // the golden ratio increment of SplitMix64 keeps the counters of nearby keys apart
+    uint64_t word = mix(key + ++dimension * 0x9e3779b97f4a7c15ull);
+    return (word >> 11) * (1.0 / 9007199254740992.0); //returns between 0 and 1, 53 random bits
 }
 
 // Makes sure its more likely to be perpendicular cause thats what real light would do, 
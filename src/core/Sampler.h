@@ -1,22 +1,34 @@
 #ifndef __SAMPLER_H__
 #define __SAMPLER_H__
 #include "Vec.h"
-#include <random>
+#include <cstdint>
 
+// families of streams keyed the same way, so photon i of light l never draws the numbers of sample i of pixel l
+enum class SampleDomain : uint32_t {
+    Pixel,
+    Photon
+};
+
+// counter-based random numbers: the i-th number of a stream is a hash of the stream key and i, so a stream
+// is just its key and a counter. each pixel sample gets its own stream keyed by (seed, pixel, sample), and
+// the numbers it draws are the same whichever thread renders it, so images are bit-reproducible for any
+// thread count and no state is shared between threads
 class Sampler {
     public:
+        // stream for work that is not tied to a pixel sample
         Sampler(unsigned int seed = 0);
+        // stream of one sample of one pixel, or with SampleDomain::Photon of one photon (pixel = light index)
+        Sampler(unsigned int seed, int pixel, int sample, SampleDomain domain = SampleDomain::Pixel);
         
-        //random number generator
+        //random number generator, the next dimension of the stream in [0, 1)
         double getRandomFloat();
         
         // for diffuse surfaces
         vec3 getCosineWeightedHemisphereDirection();
 
     private:
-        std::mt19937 randomNumGenerator;
-        // converts number to float between 0 and 1
-        std::uniform_real_distribution<double> floatDistribution;
+        uint64_t key; // hash of the stream's seed, domain, pixel and sample
+        uint64_t dimension; // numbers drawn so far
         
 };
 #endif
@@ -1,9 +1,94 @@
 #include "Scene.h"
+#include "geometry/WideBVH.h"
+#include "geometry/SurfaceInteraction.h"
+#include "utils/ThreadPool.h"
 #include <limits>
+#include <iostream>
+#include <atomic>
+
+// every build gets a new id so a thread never trusts occluders cached against an older bvh
+static std::atomic<unsigned> next_bvh_generation(1);
+
+// per-thread memory of the object that last blocked each light. shadow rays from neighbouring
+// shading points toward the same light tend to be blocked by the same object
+struct OccluderCache {
+    unsigned generation = 0;
+    std::vector<const Object*> last_occluder; // indexed by light
+};
+static thread_local OccluderCache occluder_cache;
+
+void Scene::buildBVH() {
+    if (objects.empty()) return;
+    bvh_generation = next_bvh_generation++;
+    // the kd-tree is built straight from the objects and has no use for a binary BVH
+    if (accelerator_type == AcceleratorType::KdTree) {
+        bvh.reset();
+        buildKdTree();
+        return;
+    }
+    bvh = std::make_unique<BVH>(objects, bvh_settings);
+    std::cout << "BVH built over " << objects.size() << " objects: " << bvh->getNodeCount()
+              << " nodes, " << bvh->getPrimitives().size() << " references, SAH cost " << bvh->getSAHCost() << ", "
+              << bvh->getBuildTime() * 1000.0 << " ms on "
+              << ThreadPool::global().getThreadCount() << " threads" << std::endl;
+    if (bvh->isLazy()) {
+        std::cout << "BVH: " << bvh->getPendingSubtreeCount() << " subtrees left to build on first use" << std::endl;
+    }
+    collapseBVH();
+}
+
+void Scene::updateBVH(const std::vector<std::shared_ptr<Object>>& moved) {
+    // a kd-tree splits space rather than objects, nothing of it survives a move
+    if (!bvh || accelerator_type == AcceleratorType::KdTree) {
+        buildBVH();
+        return;
+    }
+    std::vector<const Object*> moved_objects;
+    for (const auto& object : moved) moved_objects.push_back(object.get());
+    BVHUpdate update = bvh->refit(moved_objects);
+    std::cout << "BVH update: " << update.refitted_nodes.size() << " nodes refitted, " << update.rebuilt_subtrees
+              << " subtrees rebuilt" << (update.full_rebuild ? " (full rebuild)" : "") << ", SAH cost " << bvh->getSAHCost() << std::endl;
+
+    // a wide collapse mirrors the binary boxes slot by slot, but has to be redone once the topology changed
+    if (update.rebuilt_subtrees > 0) {
+        collapseBVH();
+    } else if (auto wide4 = std::dynamic_pointer_cast<WideBVH<4>>(accelerator)) {
+        wide4->refit(*bvh, update.refitted_nodes);
+    } else if (auto wide8 = std::dynamic_pointer_cast<WideBVH<8>>(accelerator)) {
+        wide8->refit(*bvh, update.refitted_nodes);
+    }
+}
+
+void Scene::collapseBVH() {
+    // a wide collapse would need the whole tree, a lazy one is traversed as it is
+    if (bvh->isLazy()) {
+        accelerator = bvh;
+    } else if (bvh_width == 4) {
+        auto wide = std::make_shared<WideBVH<4>>(*bvh, bvh_compressed);
+        std::cout << "Collapsed to BVH4 with " << wide->getNodeCount() << (bvh_compressed ? " compressed" : "") << " nodes, "
+                  << wide->getMemoryUsage() / 1024 << " KB" << std::endl;
+        accelerator = wide;
+    } else if (bvh_width == 8) {
+        auto wide = std::make_shared<WideBVH<8>>(*bvh, bvh_compressed);
+        std::cout << "Collapsed to BVH8 with " << wide->getNodeCount() << (bvh_compressed ? " compressed" : "") << " nodes, "
+                  << wide->getMemoryUsage() / 1024 << " KB" << std::endl;
+        accelerator = wide;
+    } else {
+        accelerator = bvh;
+    }
+}
+
+void Scene::buildKdTree() {
+    auto kdtree = std::make_shared<KdTree>(objects, kdtree_settings);
+    std::cout << "Kd-tree built over " << objects.size() << " objects: " << kdtree->getNodeCount() << " nodes, "
+              << kdtree->getLeafCount() << " leaves, " << kdtree->getReferenceCount() << " references, "
+              << kdtree->getMemoryUsage() / 1024 << " KB, " << kdtree->getBuildTime() * 1000.0 << " ms" << std::endl;
+    accelerator = kdtree;
+}
 
 Hit Scene::closestIntersection(const Ray& ray) const {
-    if (bvh) {
-        return bvh->intersect(ray);
+    if (accelerator) {
+        return accelerator->intersect(ray);
     }
     // fallback to brute-force (if BVH isn't built)
     Hit closest_hit{nullptr, 0, 0};
@@ -18,20 +103,54 @@ Hit Scene::closestIntersection(const Ray& ray) const {
     return closest_hit;
 }
 
+void Scene::intersectPacket(const RayPacket& packet, Hit* hits) const {
+    if (accelerator) {
+        accelerator->intersectPacket(packet, hits);
+        return;
+    }
+    for (int i = 0; i < packet.size; ++i) {
+        hits[i] = closestIntersection(packet.rays[i]);
+    }
+}
+
+bool Scene::occluded(const Ray& ray, double t_max, int light_index) const {
+    if (!accelerator) {
+        for (const auto &obj : objects) {
+            if (obj->occluded(ray, t_max)) return true;
+        }
+        return false;
+    }
+    if (light_index < 0 || light_index >= static_cast<int>(lights.size())) {
+        return accelerator->occluded(ray, t_max);
+    }
+
+    OccluderCache& cache = occluder_cache;
+    if (cache.generation != bvh_generation || cache.last_occluder.size() != lights.size()) {
+        cache.generation = bvh_generation;
+        cache.last_occluder.assign(lights.size(), nullptr);
+    }
+    const Object*& last = cache.last_occluder[light_index];
+    if (last && last->occluded(ray, t_max)) {
+        return true;
+    }
+    const Object* occluder = nullptr;
+    bool blocked = accelerator->occluded(ray, t_max, &occluder);
+    last = occluder;
+    return blocked;
+}
+
 vec3 Scene::castRay(const Ray &ray, int depth) const
 {
-    Hit closest_hit = closestIntersection(ray);
+    SurfaceInteraction interaction(ray, closestIntersection(ray));
     vec3 color(0.0, 0.0, 0.0); // default color is black
 
-    if (!closest_hit.object)
+    if (!interaction.isHit())
     {
         return color; // no hit, return black
     }
 
-    vec3 hit_point = ray.origin + closest_hit.t * ray.direction;
-    vec3 normal = closest_hit.object->getNormal(hit_point); // again, polymorphic behavior, leave part handing to object class
-
-    color = closest_hit.object->material_shader->shade(ray, hit_point, normal, *this); // call the material shader to get the color;
+    // the normal is left to the object class, which knows its parts
+    color = interaction.getMaterial()->shade(ray, interaction.getPosition(), interaction.getShadingNormal(), *this); // call the material shader to get the color;
 
     return color;
 }
@@ -4,9 +4,13 @@
 #include <vector>
 #include <memory>
 #include "core/Ray.h"
+#include "core/RayPacket.h"
 #include "core/Vec.h"
 #include "geometry/Object.h"
 #include "geometry/BVH.h"
+#include "geometry/KdTree.h"
+#include "geometry/Accelerator.h"
+#include "geometry/Instance.h"
 #include "lights/Light.h"
 #include "lights/EnvironmentLight.h"
 #include "core/Camera.h"
@@ -23,7 +27,14 @@ public:
     std::vector<std::shared_ptr<Object>> objects;       // scene geometry
     std::vector<std::shared_ptr<Light>> lights;         // emissive sources
     std::shared_ptr<EnvironmentLight> environment_light = nullptr;
-    std::shared_ptr<BVH> bvh;                           // acceleration structure
+    std::shared_ptr<BVH> bvh;                           // binary BVH, built by buildBVH unless the accelerator is the kd-tree
+    std::shared_ptr<Accelerator> accelerator;           // structure answering ray queries: the BVH, a wide collapse of it or the kd-tree
+    AcceleratorType accelerator_type = AcceleratorType::BVH; // which structure buildBVH puts behind accelerator
+    KdTreeBuildSettings kdtree_settings;                // builder parameters for AcceleratorType::KdTree
+    BVHBuildSettings bvh_settings;                      // SAH builder parameters used by buildBVH
+    int bvh_width = 4;                                  // children per node used for traversal: 2, 4 or 8
+    bool bvh_compressed = false;                        // wide nodes with 8-bit quantized child bounds, half the memory
+    unsigned bvh_generation = 0;                        // unique id of the current bvh, keys the per-thread occluder cache
     std::vector<double> light_importance; // importance of each light source, for next event estimation
 
     vec3 ambient_color;
@@ -45,18 +56,33 @@ public:
         objects.push_back(obj);
     }
 
+    // place a shared mesh or object group in the world without copying its geometry
+    void addInstance(const std::shared_ptr<Object>& prototype, const Transform& object_to_world) {
+        objects.push_back(std::make_shared<Instance>(prototype, object_to_world));
+    }
+
     void addLight(const std::shared_ptr<Light>& light) {
         lights.push_back(light);
     }
 
-    void buildBVH() {
-        if (!objects.empty()) {
-            bvh = std::make_unique<BVH>(objects);
-        }
-    }
+    void buildBVH();
+    // bring the BVH up to date after the given objects moved (e.g. Instance::setTransform), refitting and
+    // rebuilding only the parts of the tree that hold them
+    void updateBVH(const std::vector<std::shared_ptr<Object>>& moved);
     void prepareLights();
     vec3 castRay(const Ray& ray, int depth) const;
     Hit closestIntersection(const Ray& ray) const;
+    // closest hits of a packet of coherent primary rays, hits[i] belongs to packet.rays[i]
+    void intersectPacket(const RayPacket& packet, Hit* hits) const;
+    // any-hit shadow query: true if something blocks the ray before t_max. passing the index of the light
+    // being tested lets each thread first retry the object that blocked that light last time
+    bool occluded(const Ray& ray, double t_max, int light_index = -1) const;
+
+private:
+    // point accelerator at the bvh, or at a wide collapse of it for bvh_width 4 / 8
+    void collapseBVH();
+    // point accelerator at a kd-tree built over the objects
+    void buildKdTree();
 };
 
 #endif
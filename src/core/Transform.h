@@ -0,0 +1,104 @@
+#ifndef __TRANSFORM_H__
+#define __TRANSFORM_H__
+
+#include <cmath>
+#include "core/Vec.h"
+#include "geometry/AABB.h"
+
+// affine transform p' = M p + t, enough for placing instances (no projection)
+struct Transform {
+    double m[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    vec3 t = vec3(0, 0, 0);
+
+    static Transform translate(const vec3& offset)
+    {
+        Transform result;
+        result.t = offset;
+        return result;
+    }
+
+    static Transform scale(const vec3& factors)
+    {
+        Transform result;
+        for (int i = 0; i < 3; i++) result.m[i][i] = factors[i];
+        return result;
+    }
+
+    // rotation by angle radians around axis (Rodrigues)
+    static Transform rotate(const vec3& axis, double angle)
+    {
+        vec3 a = axis.normalized();
+        double c = std::cos(angle), s = std::sin(angle), k = 1.0 - c;
+        Transform result;
+        result.m[0][0] = c + a[0] * a[0] * k;        result.m[0][1] = a[0] * a[1] * k - a[2] * s; result.m[0][2] = a[0] * a[2] * k + a[1] * s;
+        result.m[1][0] = a[1] * a[0] * k + a[2] * s; result.m[1][1] = c + a[1] * a[1] * k;        result.m[1][2] = a[1] * a[2] * k - a[0] * s;
+        result.m[2][0] = a[2] * a[0] * k - a[1] * s; result.m[2][1] = a[2] * a[1] * k + a[0] * s; result.m[2][2] = c + a[2] * a[2] * k;
+        return result;
+    }
+
+    vec3 applyVector(const vec3& v) const
+    {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    vec3 applyPoint(const vec3& p) const { return applyVector(p) + t; }
+
+    // M^T v. normals transform by the inverse transpose, i.e. inverse().applyTransposed(n)
+    vec3 applyTransposed(const vec3& n) const
+    {
+        return vec3(m[0][0] * n[0] + m[1][0] * n[1] + m[2][0] * n[2],
+                    m[0][1] * n[0] + m[1][1] * n[1] + m[2][1] * n[2],
+                    m[0][2] * n[0] + m[1][2] * n[1] + m[2][2] * n[2]);
+    }
+
+    // bounds of the transformed box (Arvo): per axis, pick the min / max contribution of each column
+    AABB applyBox(const AABB& box) const
+    {
+        AABB result;
+        result.min = t;
+        result.max = t;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                double a = m[i][j] * box.min[j], b = m[i][j] * box.max[j];
+                result.min[i] += a < b ? a : b;
+                result.max[i] += a < b ? b : a;
+            }
+        }
+        return result;
+    }
+
+    // this applied after other
+    Transform operator*(const Transform& other) const
+    {
+        Transform result;
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                result.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j] + m[i][2] * other.m[2][j];
+        result.t = applyPoint(other.t);
+        return result;
+    }
+
+    Transform inverse() const
+    {
+        Transform result;
+        double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                   - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                   + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        double inv_det = 1.0 / det;
+        result.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+        result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        result.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+        result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        result.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+        result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+        result.t = -result.applyVector(t);
+        return result;
+    }
+};
+
+#endif
@@ -5,6 +5,13 @@
 #include <cmath>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define VEC_SSE
+#endif
+
 static const double pi = 4 * atan(1.0);
 
 template<class T, int n> struct vec;
@@ -132,6 +139,251 @@ std::istream& operator >> (std::istream& in, vec<T,n> & u)
     return in;
 }
 
+#ifdef VEC_SSE
+// 3D vectors run their arithmetic in SSE registers. a float vector carries a zero fourth lane so it loads as
+// one register. a double vector keeps its 24 bytes, padding it to 32 would grow every AABB, BVHNode, mesh and
+// photon, so it is loaded as an xy pair and a z lane. lanewise results match the scalar loops bit for bit,
+// min and max take their operands in the order that reproduces std::min/std::max, NaNs included
+template<> struct vec<double,3>;
+template<> struct vec<float,3>;
+inline double dot(const vec<double,3>& u, const vec<double,3>& v);
+inline float dot(const vec<float,3>& u, const vec<float,3>& v);
+
+template<>
+struct vec<double,3> {
+    double x[3];
+
+    // the two registers a vector is loaded into
+    struct lanes { __m128d xy, z; };
+
+    vec() { make_zero(); }
+    explicit vec(const double& a) { fill(a); }
+    vec(const double& a, const double& b, const double& c) { x[0] = a; x[1] = b; x[2] = c; }
+    vec(const lanes& l) { _mm_storeu_pd(x, l.xy); _mm_store_sd(x + 2, l.z); }
+
+    template<class U>
+    explicit vec(const vec<U,3>& v) { for(int i = 0; i < 3; i++) x[i] = (double)v.x[i]; }
+
+    void make_zero() { fill(0); }
+    void fill(double value) { x[0] = x[1] = x[2] = value; }
+
+    lanes load() const { return {_mm_loadu_pd(x), _mm_load_sd(x + 2)}; }
+    static lanes broadcast(double c) { __m128d r = _mm_set1_pd(c); return {r, r}; }
+
+    vec& operator += (const vec& v) { return *this = *this + v; }
+    vec& operator -= (const vec& v) { return *this = *this - v; }
+    vec& operator *= (const vec& v) { return *this = *this * v; }
+    vec& operator /= (const vec& v) { return *this = *this / v; }
+    vec& operator *= (const double& c) { return *this = *this * c; }
+    vec& operator /= (const double& c) { return *this = *this / c; }
+
+    vec operator + () const { return *this; }
+    vec operator - () const { lanes a = load(), s = broadcast(-0.0); return lanes{_mm_xor_pd(a.xy, s.xy), _mm_xor_pd(a.z, s.z)}; }
+
+    vec operator + (const vec& v) const { lanes a = load(), b = v.load(); return lanes{_mm_add_pd(a.xy, b.xy), _mm_add_sd(a.z, b.z)}; }
+    vec operator - (const vec& v) const { lanes a = load(), b = v.load(); return lanes{_mm_sub_pd(a.xy, b.xy), _mm_sub_sd(a.z, b.z)}; }
+    vec operator * (const vec& v) const { lanes a = load(), b = v.load(); return lanes{_mm_mul_pd(a.xy, b.xy), _mm_mul_sd(a.z, b.z)}; }
+    vec operator / (const vec& v) const { lanes a = load(), b = v.load(); return lanes{_mm_div_pd(a.xy, b.xy), _mm_div_sd(a.z, b.z)}; }
+
+    vec operator * (const double& c) const { lanes a = load(), b = broadcast(c); return lanes{_mm_mul_pd(a.xy, b.xy), _mm_mul_sd(a.z, b.z)}; }
+    vec operator / (const double& c) const { lanes a = load(), b = broadcast(c); return lanes{_mm_div_pd(a.xy, b.xy), _mm_div_sd(a.z, b.z)}; }
+
+    const double& operator[] (int i) const { return x[i]; }
+    double& operator[] (int i) { return x[i]; }
+
+    double magnitude_squared() const { return dot(*this, *this); }
+    double magnitude() const { return _mm_cvtsd_f64(_mm_sqrt_sd(_mm_setzero_pd(), _mm_set_sd(magnitude_squared()))); }
+
+    vec normalized() const {
+        double mag = magnitude();
+        return mag ? *this / mag : vec();
+    }
+};
+
+template<>
+struct alignas(16) vec<float,3> {
+    float x[4]; // the fourth lane is padding and stays zero
+
+    vec() { make_zero(); }
+    explicit vec(const float& a) { fill(a); }
+    vec(const float& a, const float& b, const float& c) { x[0] = a; x[1] = b; x[2] = c; x[3] = 0; }
+    vec(__m128 l) { _mm_store_ps(x, l); }
+
+    template<class U>
+    explicit vec(const vec<U,3>& v) { for(int i = 0; i < 3; i++) x[i] = (float)v.x[i]; x[3] = 0; }
+
+    void make_zero() { fill(0); }
+    void fill(float value) { x[0] = x[1] = x[2] = value; x[3] = 0; }
+
+    __m128 load() const { return _mm_load_ps(x); }
+    // splat c into the three used lanes
+    static __m128 broadcast(float c) { return _mm_set_ps(0, c, c, c); }
+    // clear the padding lane after an operation that may have set it (0 / 0, 0 * inf)
+    static __m128 clearPadding(__m128 l) { return _mm_and_ps(l, _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1))); }
+
+    vec& operator += (const vec& v) { return *this = *this + v; }
+    vec& operator -= (const vec& v) { return *this = *this - v; }
+    vec& operator *= (const vec& v) { return *this = *this * v; }
+    vec& operator /= (const vec& v) { return *this = *this / v; }
+    vec& operator *= (const float& c) { return *this = *this * c; }
+    vec& operator /= (const float& c) { return *this = *this / c; }
+
+    vec operator + () const { return *this; }
+    vec operator - () const { return _mm_xor_ps(load(), broadcast(-0.0f)); }
+
+    vec operator + (const vec& v) const { return _mm_add_ps(load(), v.load()); }
+    vec operator - (const vec& v) const { return _mm_sub_ps(load(), v.load()); }
+    vec operator * (const vec& v) const { return _mm_mul_ps(load(), v.load()); }
+    vec operator / (const vec& v) const { return clearPadding(_mm_div_ps(load(), v.load())); }
+
+    vec operator * (const float& c) const { return clearPadding(_mm_mul_ps(load(), _mm_set1_ps(c))); }
+    vec operator / (const float& c) const { return clearPadding(_mm_div_ps(load(), _mm_set1_ps(c))); }
+
+    const float& operator[] (int i) const { return x[i]; }
+    float& operator[] (int i) { return x[i]; }
+
+    float magnitude_squared() const { return dot(*this, *this); }
+    float magnitude() const { return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(magnitude_squared()))); }
+
+    vec normalized() const {
+        float mag = magnitude();
+        return mag ? *this / mag : vec();
+    }
+};
+static_assert(sizeof(vec<float,3>) == 16, "vec3f should fill one SSE register");
+
+// summed in the same order as the scalar loop
+inline double dot(const vec<double,3>& u, const vec<double,3>& v)
+{
+    vec<double,3>::lanes a = u.load(), b = v.load();
+    __m128d p = _mm_mul_pd(a.xy, b.xy);
+    __m128d r = _mm_add_sd(_mm_add_sd(p, _mm_unpackhi_pd(p, p)), _mm_mul_sd(a.z, b.z));
+    return _mm_cvtsd_f64(r);
+}
+
+inline float dot(const vec<float,3>& u, const vec<float,3>& v)
+{
+    __m128 p = _mm_mul_ps(u.load(), v.load());
+    __m128 r = _mm_add_ss(_mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(p, p));
+    return _mm_cvtss_f32(r);
+}
+
+inline vec<double,3> cross(const vec<double,3>& u, const vec<double,3>& v)
+{
+    vec<double,3>::lanes a = u.load(), b = v.load();
+    __m128d a_yz = _mm_shuffle_pd(a.xy, a.z, 1), b_yz = _mm_shuffle_pd(b.xy, b.z, 1);
+    __m128d a_zx = _mm_unpacklo_pd(a.z, a.xy), b_zx = _mm_unpacklo_pd(b.z, b.xy);
+    __m128d xy = _mm_sub_pd(_mm_mul_pd(a_yz, b_zx), _mm_mul_pd(a_zx, b_yz));
+    __m128d p = _mm_mul_pd(a.xy, _mm_shuffle_pd(b.xy, b.xy, 1)); // u0 * v1, u1 * v0
+    return vec<double,3>::lanes{xy, _mm_sub_sd(p, _mm_unpackhi_pd(p, p))};
+}
+
+inline vec<float,3> cross(const vec<float,3>& u, const vec<float,3>& v)
+{
+    __m128 a = u.load(), b = v.load();
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1))),
+                          _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)), b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// maxpd/minpd return their second operand unless the first wins the comparison, so (b, a) is std::max(a, b)
+inline vec<double,3> componentwise_max(const vec<double,3>& u, const vec<double,3>& v)
+{
+    vec<double,3>::lanes a = u.load(), b = v.load();
+    return vec<double,3>::lanes{_mm_max_pd(b.xy, a.xy), _mm_max_sd(b.z, a.z)};
+}
+
+inline vec<double,3> componentwise_min(const vec<double,3>& u, const vec<double,3>& v)
+{
+    vec<double,3>::lanes a = u.load(), b = v.load();
+    return vec<double,3>::lanes{_mm_min_pd(b.xy, a.xy), _mm_min_sd(b.z, a.z)};
+}
+
+inline vec<float,3> componentwise_max(const vec<float,3>& u, const vec<float,3>& v) { return _mm_max_ps(v.load(), u.load()); }
+inline vec<float,3> componentwise_min(const vec<float,3>& u, const vec<float,3>& v) { return _mm_min_ps(v.load(), u.load()); }
+
+inline vec<double,3> clamp(const vec<double,3>& v, double min_val, double max_val)
+{
+    vec<double,3>::lanes a = v.load(), lo = vec<double,3>::broadcast(min_val), hi = vec<double,3>::broadcast(max_val);
+    return vec<double,3>::lanes{_mm_max_pd(_mm_min_pd(hi.xy, a.xy), lo.xy), _mm_max_sd(_mm_min_sd(hi.z, a.z), lo.z)};
+}
+
+inline vec<float,3> clamp(const vec<float,3>& v, float min_val, float max_val)
+{
+    return vec<float,3>::clearPadding(_mm_max_ps(_mm_min_ps(_mm_set1_ps(max_val), v.load()), _mm_set1_ps(min_val)));
+}
+#endif
+
+// N 3D vectors in SoA layout, one array per component, so a kernel that works on several rays or points at
+// once runs each lane loop over contiguous memory (N = 4 or 8 matches an SSE or AVX register of floats).
+// lanewise results come back as a vec<T,N>
+template<class T, int N>
+struct alignas(32) vec3_batch {
+    T x[N], y[N], z[N];
+
+    vec3_batch() { fill(vec<T,3>()); }
+    explicit vec3_batch(const vec<T,3>& v) { fill(v); }
+
+    void fill(const vec<T,3>& v) { for(int i = 0; i < N; i++) set(i, v); }
+    void set(int lane, const vec<T,3>& v) { x[lane] = v[0]; y[lane] = v[1]; z[lane] = v[2]; }
+    vec<T,3> get(int lane) const { return vec<T,3>(x[lane], y[lane], z[lane]); }
+
+    vec3_batch operator + (const vec3_batch& v) const { vec3_batch r; for(int i = 0; i < N; i++) { r.x[i] = x[i] + v.x[i]; r.y[i] = y[i] + v.y[i]; r.z[i] = z[i] + v.z[i]; } return r; }
+    vec3_batch operator - (const vec3_batch& v) const { vec3_batch r; for(int i = 0; i < N; i++) { r.x[i] = x[i] - v.x[i]; r.y[i] = y[i] - v.y[i]; r.z[i] = z[i] - v.z[i]; } return r; }
+    vec3_batch operator * (const vec3_batch& v) const { vec3_batch r; for(int i = 0; i < N; i++) { r.x[i] = x[i] * v.x[i]; r.y[i] = y[i] * v.y[i]; r.z[i] = z[i] * v.z[i]; } return r; }
+    vec3_batch operator * (const vec<T,N>& c) const { vec3_batch r; for(int i = 0; i < N; i++) { r.x[i] = x[i] * c[i]; r.y[i] = y[i] * c[i]; r.z[i] = z[i] * c[i]; } return r; }
+    vec3_batch operator * (const T& c) const { vec3_batch r; for(int i = 0; i < N; i++) { r.x[i] = x[i] * c; r.y[i] = y[i] * c; r.z[i] = z[i] * c; } return r; }
+
+    vec<T,N> magnitude_squared() const { return dot(*this, *this); }
+    vec<T,N> magnitude() const { vec<T,N> r = magnitude_squared(); for(int i = 0; i < N; i++) r[i] = sqrt(r[i]); return r; }
+
+    vec3_batch normalized() const {
+        vec<T,N> mag = magnitude();
+        vec3_batch r;
+        for(int i = 0; i < N; i++) {
+            T inv = mag[i] ? 1 / mag[i] : 0;
+            r.x[i] = x[i] * inv; r.y[i] = y[i] * inv; r.z[i] = z[i] * inv;
+        }
+        return r;
+    }
+};
+
+template <class T, int N>
+vec<T,N> dot(const vec3_batch<T,N>& u, const vec3_batch<T,N>& v)
+{
+    vec<T,N> r;
+    for(int i = 0; i < N; i++) r[i] = u.x[i] * v.x[i] + u.y[i] * v.y[i] + u.z[i] * v.z[i];
+    return r;
+}
+
+template <class T, int N>
+vec3_batch<T,N> cross(const vec3_batch<T,N>& u, const vec3_batch<T,N>& v)
+{
+    vec3_batch<T,N> r;
+    for(int i = 0; i < N; i++) {
+        r.x[i] = u.y[i] * v.z[i] - u.z[i] * v.y[i];
+        r.y[i] = u.z[i] * v.x[i] - u.x[i] * v.z[i];
+        r.z[i] = u.x[i] * v.y[i] - u.y[i] * v.x[i];
+    }
+    return r;
+}
+
+template <class T, int N>
+vec3_batch<T,N> componentwise_min(const vec3_batch<T,N>& u, const vec3_batch<T,N>& v)
+{
+    vec3_batch<T,N> r;
+    for(int i = 0; i < N; i++) { r.x[i] = std::min(u.x[i], v.x[i]); r.y[i] = std::min(u.y[i], v.y[i]); r.z[i] = std::min(u.z[i], v.z[i]); }
+    return r;
+}
+
+template <class T, int N>
+vec3_batch<T,N> componentwise_max(const vec3_batch<T,N>& u, const vec3_batch<T,N>& v)
+{
+    vec3_batch<T,N> r;
+    for(int i = 0; i < N; i++) { r.x[i] = std::max(u.x[i], v.x[i]); r.y[i] = std::max(u.y[i], v.y[i]); r.z[i] = std::max(u.z[i], v.z[i]); }
+    return r;
+}
+
 typedef vec<double,2> vec2;   // 2D double vector
 typedef vec<double,3> vec3;   // 3D double vector
 typedef vec<int,2> ivec2;     // 2D int vector
@@ -139,4 +391,7 @@ typedef vec<int,3> ivec3;     // 3D int vector
 typedef vec<float,2> vec2f;   // 2D float vector
 typedef vec<float,3> vec3f;   // 3D float vector
 
+typedef vec3_batch<double,4> vec3x4;  // 4 double vectors in SoA layout
+typedef vec3_batch<float,8> vec3fx8;  // 8 float vectors in SoA layout
+
 #endif
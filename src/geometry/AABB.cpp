@@ -1,20 +1,15 @@
 #include <limits>
 #include "AABB.h"
 
-// checks if the ray intersects the AABB box.
+// checks if the ray intersects the AABB box, using the reciprocal direction cached in the ray.
+// the ternaries (rather than std::min/max) drop the NaN produced by 0 * inf when the origin lies on a slab.
 bool AABB::intersect(const Ray &ray, double t_min, double t_max) const {
     for (int i = 0; i < 3; ++i) {
-        double invD = (std::abs(ray.direction[i]) > small_t) 
-                      ? 1.0 / ray.direction[i] 
-                      : std::numeric_limits<double>::infinity();
-        double t1 = (min[i] - ray.origin[i]) * invD;
-        double t2 = (max[i] - ray.origin[i]) * invD;
+        double t_near = ((ray.sign[i] ? max : min)[i] - ray.origin[i]) * ray.inv_direction[i];
+        double t_far = ((ray.sign[i] ? min : max)[i] - ray.origin[i]) * ray.inv_direction[i];
 
-        if (invD < 0.0)
-            std::swap(t1, t2);
-
-        t_min = std::max(t1, t_min);
-        t_max = std::min(t2, t_max);            
+        t_min = t_near > t_min ? t_near : t_min;
+        t_max = t_far < t_max ? t_far : t_max;
 
         if (t_max < t_min)
             return false;
@@ -38,13 +33,33 @@ AABB AABB::operator+(const vec3 &point) const {
     return box;
 }
 
+// the overlap of this box and bb, min exceeds max along some axis if there is none
+AABB AABB::intersection(const AABB &bb) const {
+    AABB box;
+    box.min = componentwise_max(min, bb.min);
+    box.max = componentwise_min(max, bb.max);
+    return box;
+}
+
 // create a box to which points can be correctly added using '+' operator
 void AABB::makeEmpty() {
     min.fill(std::numeric_limits<double>::max());
     max = -min;
 }
 
+bool AABB::isEmpty() const {
+    return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+}
+
 // return the center of the box (for BVH)
 vec3 AABB::center() const {
     return 0.5 * (min + max);
+}
+
+// return the surface area of the box, an empty box has no area
+double AABB::surfaceArea() const {
+    vec3 extent = max - min;
+    if (extent[0] < 0 || extent[1] < 0 || extent[2] < 0)
+        return 0.0;
+    return 2.0 * (extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0]);
 }
\ No newline at end of file
@@ -14,10 +14,16 @@ public:
     AABB operator+(const AABB &bb) const;
     // enlarge box if necessary to include the point, and return box
     AABB operator+(const vec3 &point) const;
+    // the region covered by both boxes, empty if they do not overlap
+    AABB intersection(const AABB &bb) const;
     // create a box to which points can be correctly added using '+' operator
     void makeEmpty();
+    // true if the box contains no point at all, e.g. right after makeEmpty()
+    bool isEmpty() const;
     // return center point of the box
     vec3 center() const;
+    // return the surface area of the box (used by the SAH builder), zero for an empty box
+    double surfaceArea() const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef __ACCELERATOR_H__
+#define __ACCELERATOR_H__
+
+#include "core/Ray.h"
+#include "core/RayPacket.h"
+#include "geometry/Object.h"
+#include "geometry/Hit.h"
+#include <memory>
+
+// structures Scene can answer its ray queries with
+enum class AcceleratorType {
+    BVH,   // the binary BVH or its wide collapse, see Scene::bvh_width
+    KdTree // SAH kd-tree with rope traversal
+};
+
+// query interface shared by the scene acceleration structures, Scene only talks to this
+class Accelerator {
+public:
+    virtual ~Accelerator() = default;
+
+    // closest hit in [small_t, inf), object is nullptr on a miss
+    virtual Hit intersect(const Ray& ray) const = 0;
+    // any-hit query for shadow rays: true as soon as some primitive is hit in [small_t, t_max).
+    // the blocking top-level primitive is written to occluder when requested
+    virtual bool occluded(const Ray& ray, double t_max, const Object** occluder = nullptr) const = 0;
+
+    // closest hit of every ray in the packet, hits[i] belongs to packet.rays[i].
+    // the default traces the rays one at a time, structures with a packet traversal override it
+    virtual void intersectPacket(const RayPacket& packet, Hit* hits) const
+    {
+        for (int i = 0; i < packet.size; i++) {
+            hits[i] = intersect(packet.rays[i]);
+        }
+    }
+};
+
+#endif
@@ -1,86 +1,692 @@
 #include "geometry/BVH.h"
 #include <algorithm>
 #include <limits>
+#include <bitset>
+#include <chrono>
+#include "utils/ThreadPool.h"
 
 
 extern const double small_t; // ensure small_t is declared somewhere globally
 
 
-BVH::BVH(const std::vector<std::shared_ptr<Object>>& objs) {
-    std::vector<std::shared_ptr<Object>> objects = objs; // make a modifiable copy
-    root = build(objects);
+BVH::BVH(const std::vector<std::shared_ptr<Object>>& objs, const BVHBuildSettings& build_settings)
+    : settings(build_settings) {
+    if (objs.empty()) return;
+    // cache bounds and centroids up front, the builder only ever partitions these records
+    std::vector<BuildPrimitive> prims(objs.size());
+    ThreadPool::global().parallelFor(0, static_cast<int>(objs.size()), settings.parallel_subtree_size, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            prims[i].bbox = objs[i]->getBoundingBox();
+            prims[i].centroid = prims[i].bbox.center();
+            prims[i].index = i;
+        }
+    });
+    buildTree(prims, &objs, settings.lazy_subtree_size);
+
+    // store the primitives in leaf order so every leaf is one contiguous range
+    primitives.reserve(prims.size());
+    for (const auto& prim : prims) {
+        primitives.push_back(objs[prim.index]);
+    }
+    groupLeavesByKind(0);
+    store = std::make_shared<PrimitiveStore>(primitives, settings.single_precision);
 }
 
 
-std::shared_ptr<BVH::BVHNode> BVH::build(std::vector<std::shared_ptr<Object>>& objects, int depth) {
-    auto node = std::make_shared<BVHNode>();
-    // compute bounding box enclosing all objects
-    AABB bbox;
-    bbox.makeEmpty();
-    for (const auto& obj : objects) {
-        bbox = bbox + obj->getBoundingBox();
+void BVH::storeFloatNode(int node_index) {
+    const BVHNode& node = nodes[node_index];
+    BVHNodeF& float_node = float_nodes[node_index];
+    for (int a = 0; a < 3; ++a) {
+        float_node.min[a] = roundDown(node.bbox.min[a]);
+        float_node.max[a] = roundUp(node.bbox.max[a]);
     }
-    node->bbox = bbox;
+    float_node.first = node.first;
+    float_node.count_axis = node.count << 2 | node.axis; // pending_axis fits the two bits
+}
+
+
+// order within a leaf is free, sorting it by kind lets the store test each kind as one run
+void BVH::groupLeavesByKind(int root) {
+    forEachNode(root, [&](int node_index) {
+        const BVHNode& node = nodes[node_index];
+        if (!node.isLeaf()) return;
+        std::stable_sort(primitives.begin() + node.first, primitives.begin() + node.first + node.count,
+            [](const std::shared_ptr<Object>& a, const std::shared_ptr<Object>& b) {
+                return PrimitiveStore::kindOf(*a) < PrimitiveStore::kindOf(*b);
+            });
+    });
+}
 
 
-    if (objects.size() <= 2 || depth > 16) {
-        node->primitives = objects;
-        return node;
+BVH::BVH(const std::vector<AABB>& bounds, std::vector<int>& leaf_order, const BVHBuildSettings& build_settings)
+    : settings(build_settings) {
+    leaf_order.clear();
+    if (bounds.empty()) return;
+    std::vector<BuildPrimitive> prims(bounds.size());
+    ThreadPool::global().parallelFor(0, static_cast<int>(bounds.size()), settings.parallel_subtree_size, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            prims[i].bbox = bounds[i];
+            prims[i].centroid = bounds[i].center();
+            prims[i].index = i;
+        }
+    });
+    buildTree(prims);
+
+    leaf_order.reserve(prims.size());
+    for (const auto& prim : prims) {
+        leaf_order.push_back(prim.index);
     }
+}
 
 
-    // determine axis to split (x=0, y=1, z=2)
-    int axis = depth % 3;
-    std::sort(objects.begin(), objects.end(), [axis](const std::shared_ptr<Object>& a, const std::shared_ptr<Object>& b) {
-        return a->getBoundingBox().center()[axis] < b->getBoundingBox().center()[axis];
+void BVH::buildTree(std::vector<BuildPrimitive>& prims, const std::vector<std::shared_ptr<Object>>* objects, int lazy_size) {
+    auto start_time = std::chrono::steady_clock::now();
+
+    int budget = 0;
+    if (objects && settings.quality == BVHBuildQuality::High) {
+        budget = static_cast<int>(settings.spatial_split_budget * prims.size());
+    }
+
+    // a binary tree over n primitives never needs more than 2n - 1 nodes. allocating them all up front
+    // lets parallel subtree builds claim sibling pairs with one atomic add and keeps node references stable.
+    // spatial splits add at most budget references
+    nodes.resize(2 * (prims.size() + budget) - 1);
+    next_node = 1;
+    nodes[0].parent = -1;
+    if (budget > 0) {
+        buildSBVH(*objects, prims, budget);
+    } else if (settings.quality == BVHBuildQuality::High) {
+        build(prims, BuildTarget{&next_node, 0, lazy_size, true}, 0, 0, static_cast<int>(prims.size()), 0);
+    } else {
+        buildLBVH(prims);
+    }
+    nodes.resize(next_node);
+    reserveLazySubtrees();
+    nodes.shrink_to_fit();
+    sah_cost = computeSAHCost();
+    if (settings.single_precision) {
+        float_nodes.resize(nodes.size());
+        for (int i = 0; i < static_cast<int>(nodes.size()); ++i) storeFloatNode(i);
+    }
+
+    build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+
+// bounds of the primitive boxes and of their centroids over [start, end), split into tasks for large ranges
+void BVH::computeBounds(const std::vector<BuildPrimitive>& prims, int start, int end, AABB& bbox, AABB& centroid_bounds, bool parallel) const {
+    auto accumulate = [&](int begin, int finish, AABB& box, AABB& centroids) {
+        box.makeEmpty();
+        centroids.makeEmpty();
+        for (int i = begin; i < finish; ++i) {
+            box = box + prims[i].bbox;
+            centroids = centroids + prims[i].centroid;
+        }
+    };
+    int count = end - start;
+    if (!parallel || count < settings.parallel_binning_size) {
+        accumulate(start, end, bbox, centroid_bounds);
+        return;
+    }
+
+    int chunk_size = settings.parallel_subtree_size;
+    int chunk_count = (count + chunk_size - 1) / chunk_size;
+    std::vector<AABB> boxes(chunk_count), centroids(chunk_count);
+    ThreadPool::global().parallelFor(0, chunk_count, 1, [&](int first_chunk, int last_chunk) {
+        for (int c = first_chunk; c < last_chunk; ++c) {
+            accumulate(start + c * chunk_size, std::min(end, start + (c + 1) * chunk_size), boxes[c], centroids[c]);
+        }
     });
+    bbox.makeEmpty();
+    centroid_bounds.makeEmpty();
+    for (int c = 0; c < chunk_count; ++c) {
+        bbox = bbox + boxes[c];
+        centroid_bounds = centroid_bounds + centroids[c];
+    }
+}
+
 
+void BVH::build(std::vector<BuildPrimitive>& prims, const BuildTarget& target, int node_index, int start, int end, int depth) {
+    // compute bounding box enclosing all primitives in [start, end)
+    AABB bbox, centroid_bounds;
+    computeBounds(prims, start, end, bbox, centroid_bounds, target.parallel);
 
-    size_t mid = objects.size() / 2;
-    std::vector<std::shared_ptr<Object>> left_objs(objects.begin(), objects.begin() + mid);
-    std::vector<std::shared_ptr<Object>> right_objs(objects.begin() + mid, objects.end());
+    int axis = 0;
+    bool make_leaf = (end - start) == 1 || depth >= max_depth - 1;
+    // a small enough range waits as one leaf until a ray reaches it
+    bool pending = !make_leaf && end - start <= target.lazy_size && end - start > settings.max_leaf_size;
+    int mid = make_leaf || pending ? start : partitionSAH(prims, start, end, bbox, centroid_bounds, axis, make_leaf, nullptr, target.parallel);
 
+    BVHNode& node = nodes[node_index];
+    node.bbox = bbox;
+    node.axis = pending ? pending_axis : axis;
+    if (make_leaf || pending) {
+        node.first = target.leaf_offset + start;
+        node.count = end - start;
+        return;
+    }
+
+    // siblings are allocated as a pair so the parent only stores the left index
+    int left = target.next_node->fetch_add(2);
+    node.first = left;
+    node.count = 0;
+    nodes[left].parent = node_index;
+    nodes[left + 1].parent = node_index;
 
-    node->left = build(left_objs, depth + 1);
-    node->right = build(right_objs, depth + 1);
-    return node;
+    // large subtrees are built as separate tasks, the two halves touch disjoint ranges of prims
+    if (target.parallel && end - start >= settings.parallel_subtree_size) {
+        ThreadPool& pool = ThreadPool::global();
+        TaskGroup group;
+        pool.submit(group, [&, left, start, mid, depth] { build(prims, target, left, start, mid, depth + 1); });
+        build(prims, target, left + 1, mid, end, depth + 1);
+        pool.wait(group);
+        return;
+    }
+    build(prims, target, left, start, mid, depth + 1);
+    build(prims, target, left + 1, mid, end, depth + 1);
 }
 
 
-Hit BVH::intersect(const Ray& ray) const {
-    return traverse(root.get(), ray);
+// binned SAH split: bin centroids along each axis, sweep the bins to find the cheapest plane,
+// then partition [start, end) around it. returns the first index of the right child.
+// best_split_cost receives the sum of child area times primitive count of the chosen plane.
+// parallel false keeps the binning on the calling thread, like computeBounds
+int BVH::partitionSAH(std::vector<BuildPrimitive>& prims, int start, int end, const AABB& bbox, const AABB& centroid_bounds,
+                      int& split_axis, bool& make_leaf, double* best_split_cost, bool parallel) const {
+    int count = end - start;
+    vec3 extent = centroid_bounds.max - centroid_bounds.min;
+
+    int bin_count = std::max(2, settings.bin_count);
+    vec3 scale;
+    for (int axis = 0; axis < 3; ++axis) {
+        scale[axis] = extent[axis] > 0.0 ? bin_count / extent[axis] : 0.0;
+    }
+
+    // bins of all three axes filled in one pass over the range: bins[axis * bin_count + b]
+    struct Bin {
+        AABB bounds;
+        int count;
+    };
+    auto fillBins = [&](int begin, int finish, Bin* bins) {
+        for (int b = 0; b < 3 * bin_count; ++b) {
+            bins[b].bounds.makeEmpty();
+            bins[b].count = 0;
+        }
+        for (int i = begin; i < finish; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                if (extent[axis] <= 0.0) continue; // all centroids on one plane, nothing to split
+                int b = std::min(bin_count - 1, static_cast<int>((prims[i].centroid[axis] - centroid_bounds.min[axis]) * scale[axis]));
+                Bin& bin = bins[axis * bin_count + b];
+                bin.bounds = bin.bounds + prims[i].bbox;
+                ++bin.count;
+            }
+        }
+    };
+
+    std::vector<Bin> bins(3 * bin_count);
+    if (!parallel || count < settings.parallel_binning_size) {
+        fillBins(start, end, bins.data());
+    } else {
+        // top levels: every task bins one chunk into its own copy, the copies are merged afterwards
+        int chunk_size = settings.parallel_subtree_size;
+        int chunk_count = (count + chunk_size - 1) / chunk_size;
+        std::vector<Bin> partial(chunk_count * 3 * bin_count);
+        ThreadPool::global().parallelFor(0, chunk_count, 1, [&](int first_chunk, int last_chunk) {
+            for (int c = first_chunk; c < last_chunk; ++c) {
+                fillBins(start + c * chunk_size, std::min(end, start + (c + 1) * chunk_size), &partial[c * 3 * bin_count]);
+            }
+        });
+        fillBins(0, 0, bins.data());
+        for (int c = 0; c < chunk_count; ++c) {
+            for (int b = 0; b < 3 * bin_count; ++b) {
+                bins[b].bounds = bins[b].bounds + partial[c * 3 * bin_count + b].bounds;
+                bins[b].count += partial[c * 3 * bin_count + b].count;
+            }
+        }
+    }
+
+    std::vector<double> right_area(bin_count);
+    std::vector<int> right_count(bin_count);
+    double best_cost = std::numeric_limits<double>::max();
+    int best_axis = -1;
+    int best_bin = -1;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.0) continue;
+        const Bin* axis_bins = &bins[axis * bin_count];
+
+        // sweep from the right so each candidate plane can read its right-hand side in O(1)
+        AABB accum;
+        accum.makeEmpty();
+        int accum_count = 0;
+        for (int b = bin_count - 1; b > 0; --b) {
+            accum = accum + axis_bins[b].bounds;
+            accum_count += axis_bins[b].count;
+            right_area[b] = accum.surfaceArea();
+            right_count[b] = accum_count;
+        }
+
+        accum.makeEmpty();
+        accum_count = 0;
+        for (int b = 0; b < bin_count - 1; ++b) {
+            accum = accum + axis_bins[b].bounds;
+            accum_count += axis_bins[b].count;
+            if (accum_count == 0 || right_count[b + 1] == 0) continue;
+            double cost = accum.surfaceArea() * accum_count + right_area[b + 1] * right_count[b + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    if (best_split_cost) *best_split_cost = best_cost;
+    double node_area = bbox.surfaceArea();
+    double leaf_cost = settings.intersection_cost * count;
+    double split_cost = settings.traversal_cost +
+        (node_area > 0.0 ? settings.intersection_cost * best_cost / node_area : leaf_cost);
+
+    if (best_axis < 0) {
+        // degenerate centroids, fall back to an even split if the node is too large for a leaf
+        make_leaf = count <= settings.max_leaf_size;
+        return start + count / 2;
+    }
+    if (count <= settings.max_leaf_size && split_cost >= leaf_cost) {
+        make_leaf = true;
+        return start;
+    }
+    split_axis = best_axis;
+
+    double axis_scale = scale[best_axis];
+    double axis_min = centroid_bounds.min[best_axis];
+    auto middle = std::partition(prims.begin() + start, prims.begin() + end,
+        [=](const BuildPrimitive& p) {
+            int b = std::min(bin_count - 1, static_cast<int>((p.centroid[best_axis] - axis_min) * axis_scale));
+            return b <= best_bin;
+        });
+    return static_cast<int>(middle - prims.begin());
 }
 
 
-Hit BVH::traverse(const BVHNode* node, const Ray& ray) const {
-    if (!node->bbox.intersect(ray, small_t, std::numeric_limits<double>::max()))
-        return Hit{nullptr, 0, 0};
+// SAH cost normalized by the root area, i.e. the expected work for a ray that hits the root box
+double BVH::computeSAHCost() const {
+    double root_area = nodes.empty() ? 0.0 : nodes[0].bbox.surfaceArea();
+    if (root_area <= 0.0) return 0.0;
+    double cost = 0.0;
+    forEachNode(0, [&](int node_index) {
+        cost += nodes[node_index].bbox.surfaceArea() * nodeCost(nodes[node_index]);
+    });
+    return cost / root_area;
+}
+
+
+double BVH::nodeCost(const BVHNode& node) const {
+    return node.isLeaf() ? settings.intersection_cost * node.count : settings.traversal_cost;
+}
+
+
+void BVH::prepareRefit() {
+    if (!reference_area.empty() || nodes.empty()) return;
+    reference_area.resize(nodes.size());
+    leaf_of.resize(primitives.size());
+    sah_sum = 0.0;
+    forEachNode(0, [&](int node_index) {
+        const BVHNode& node = nodes[node_index];
+        reference_area[node_index] = node.bbox.surfaceArea();
+        sah_sum += reference_area[node_index] * nodeCost(node);
+        if (node.isLeaf()) {
+            for (int i = node.first; i < node.first + node.count; ++i) leaf_of[i] = node_index;
+        }
+    });
+    for (int i = 0; i < static_cast<int>(primitives.size()); ++i) {
+        position_of.emplace(primitives[i].get(), i);
+    }
+    reference_sah = sah_cost;
+}
 
 
-    if (node->isLeaf()) {
-        Hit closest_hit{nullptr, 0, 0};
-        double min_t = std::numeric_limits<double>::max();
-        for (const auto& obj : node->primitives) {
-            Hit hit = obj->intersect(ray);
-            if (hit.object && hit.t >= small_t && hit.t < min_t) {
-                min_t = hit.t;
-                closest_hit = hit;
+BVHUpdate BVH::refit(const std::vector<const Object*>& moved) {
+    BVHUpdate update;
+    if (nodes.empty()) return update;
+    expandAll();
+    prepareRefit();
+
+    // bottom-up refit. a path stops at the first box that comes out unchanged, everything above it
+    // was computed from that same box
+    // a leaf split by a spatial split grows back to the full object bounds here, larger but still conservative
+    std::vector<int> moved_leaves;
+    for (const Object* object : moved) {
+        auto positions = position_of.equal_range(object);
+        for (auto found = positions.first; found != positions.second; ++found) {
+            moved_leaves.push_back(leaf_of[found->second]);
+            store->update(primitives, found->second, 1);
+        }
+    }
+    for (int leaf : moved_leaves) {
+        for (int node_index = leaf; node_index >= 0; node_index = nodes[node_index].parent) {
+            BVHNode& node = nodes[node_index];
+            AABB box;
+            box.makeEmpty();
+            if (node.isLeaf()) {
+                for (int i = node.first; i < node.first + node.count; ++i) box = box + primitives[i]->getBoundingBox();
+            } else {
+                box = nodes[node.first].bbox + nodes[node.first + 1].bbox;
             }
+            bool unchanged = true;
+            for (int a = 0; a < 3; ++a) {
+                unchanged = unchanged && box.min[a] == node.bbox.min[a] && box.max[a] == node.bbox.max[a];
+            }
+            if (unchanged) break;
+            sah_sum += (box.surfaceArea() - node.bbox.surfaceArea()) * nodeCost(node);
+            node.bbox = box;
+            if (!float_nodes.empty()) storeFloatNode(node_index);
+            update.refitted_nodes.push_back(node_index);
+            refitted_since_build.insert(node_index);
+        }
+    }
+
+    double root_area = nodes[0].bbox.surfaceArea();
+    sah_cost = root_area > 0.0 ? sah_sum / root_area : 0.0;
+    if (sah_cost <= reference_sah * (1.0 + settings.refit_degradation)) return update;
+
+    // the quality dropped: rebuild the topmost refitted subtrees whose boxes grew past the same ratio
+    std::unordered_set<int> degraded;
+    for (int node_index : refitted_since_build) {
+        if (reference_area[node_index] >= 0.0 &&
+            nodes[node_index].bbox.surfaceArea() > reference_area[node_index] * (1.0 + settings.refit_degradation)) {
+            degraded.insert(node_index);
+        }
+    }
+    std::vector<int> roots;
+    for (int node_index : degraded) {
+        bool topmost = true;
+        for (int ancestor = nodes[node_index].parent; ancestor >= 0 && topmost; ancestor = nodes[ancestor].parent) {
+            topmost = degraded.count(ancestor) == 0;
         }
-        return closest_hit;
+        if (topmost) roots.push_back(node_index);
+    }
+    for (int root : roots) {
+        rebuildSubtree(root);
+        ++update.rebuilt_subtrees;
     }
 
+    // replaced subtrees leave dead nodes behind, a full rebuild reclaims them once they outnumber the live ones
+    if (dead_nodes > static_cast<int>(nodes.size()) / 2) {
+        // every object once, spatial splits may have referenced some of them from several leaves
+        std::vector<std::shared_ptr<Object>> objects;
+        std::unordered_set<const Object*> seen;
+        for (const auto& primitive : primitives) {
+            if (seen.insert(primitive.get()).second) objects.push_back(primitive);
+        }
+        std::vector<BuildPrimitive> prims(objects.size());
+        for (size_t i = 0; i < prims.size(); ++i) {
+            prims[i].bbox = objects[i]->getBoundingBox();
+            prims[i].centroid = prims[i].bbox.center();
+            prims[i].index = static_cast<int>(i);
+        }
+        nodes.clear();
+        buildTree(prims, &objects);
+        primitives.clear();
+        for (const auto& prim : prims) primitives.push_back(objects[prim.index]);
+        groupLeavesByKind(0);
+        store = std::make_shared<PrimitiveStore>(primitives, settings.single_precision);
+        reference_area.clear();
+        position_of.clear();
+        refitted_since_build.clear();
+        dead_nodes = 0;
+        prepareRefit();
+        update.full_rebuild = true;
+        return update;
+    }
+
+    root_area = nodes[0].bbox.surfaceArea();
+    sah_cost = root_area > 0.0 ? sah_sum / root_area : 0.0;
+    return update;
+}
 
-    Hit left_hit = traverse(node->left.get(), ray);
-    Hit right_hit = traverse(node->right.get(), ray);
 
+// rebuild the subtree under root from the current primitive bounds. the new nodes are appended to the node
+// array and written into the root's slot, so the parent keeps pointing at it; the old nodes become dead
+void BVH::rebuildSubtree(int root) {
+    // a subtree always covers one contiguous range of primitive positions
+    int leftmost = root, rightmost = root;
+    while (!nodes[leftmost].isLeaf()) leftmost = nodes[leftmost].first;
+    while (!nodes[rightmost].isLeaf()) rightmost = nodes[rightmost].first + 1;
+    int start = nodes[leftmost].first;
+    int end = nodes[rightmost].first + nodes[rightmost].count;
 
-    if (left_hit.object && (!right_hit.object || left_hit.t < right_hit.t)) {
-        return left_hit;
+    forEachNode(root, [&](int node_index) {
+        sah_sum -= nodes[node_index].bbox.surfaceArea() * nodeCost(nodes[node_index]);
+        refitted_since_build.erase(node_index);
+        if (node_index != root) {
+            reference_area[node_index] = -1.0;
+            ++dead_nodes;
+        }
+    });
+
+    int depth = 0;
+    for (int ancestor = nodes[root].parent; ancestor >= 0; ancestor = nodes[ancestor].parent) ++depth;
+
+    std::vector<BuildPrimitive> prims(end - start);
+    for (int i = 0; i < end - start; ++i) {
+        prims[i].bbox = primitives[start + i]->getBoundingBox();
+        prims[i].centroid = prims[i].bbox.center();
+        prims[i].index = start + i;
+    }
+    int first_new = static_cast<int>(nodes.size());
+    nodes.resize(nodes.size() + 2 * prims.size());
+    next_node = first_new;
+    build(prims, BuildTarget{&next_node, start, 0, true}, root, 0, static_cast<int>(prims.size()), depth);
+    nodes.resize(next_node);
+
+    std::vector<std::shared_ptr<Object>> old_order(primitives.begin() + start, primitives.begin() + end);
+    for (const auto& object : old_order) {
+        auto positions = position_of.equal_range(object.get());
+        for (auto found = positions.first; found != positions.second;) {
+            found = found->second >= start && found->second < end ? position_of.erase(found) : std::next(found);
+        }
     }
-    return right_hit;
+    for (int i = 0; i < end - start; ++i) primitives[start + i] = old_order[prims[i].index - start];
+    groupLeavesByKind(root);
+    for (int i = start; i < end; ++i) position_of.emplace(primitives[i].get(), i);
+    store->update(primitives, start, end - start);
+
+    reference_area.resize(nodes.size());
+    if (!float_nodes.empty()) float_nodes.resize(nodes.size());
+    forEachNode(root, [&](int node_index) {
+        const BVHNode& node = nodes[node_index];
+        if (!float_nodes.empty()) storeFloatNode(node_index);
+        reference_area[node_index] = node.bbox.surfaceArea();
+        sah_sum += reference_area[node_index] * nodeCost(node);
+        if (node.isLeaf()) {
+            for (int i = node.first; i < node.first + node.count; ++i) leaf_of[i] = node_index;
+        }
+    });
 }
 
 
+void BVH::reserveLazySubtrees() {
+    lazy_subtrees.clear();
+    pending_slot.clear();
+    std::vector<int> pending;
+    forEachNode(0, [&](int node_index) {
+        if (nodes[node_index].isLeaf() && nodes[node_index].axis == pending_axis) pending.push_back(node_index);
+    });
+    if (pending.empty()) return;
+
+    // a binary tree over n primitives takes at most 2n - 1 nodes, reserving them now keeps the node array
+    // from moving under the rays that trigger the builds
+    pending_slot.assign(nodes.size(), -1);
+    int reserved = static_cast<int>(nodes.size());
+    for (int node_index : pending) {
+        auto subtree = std::make_unique<LazySubtree>();
+        subtree->base = reserved;
+        subtree->depth = 0;
+        for (int ancestor = nodes[node_index].parent; ancestor >= 0; ancestor = nodes[ancestor].parent) ++subtree->depth;
+        reserved += 2 * nodes[node_index].count - 1;
+        pending_slot[node_index] = static_cast<int>(lazy_subtrees.size());
+        lazy_subtrees.push_back(std::move(subtree));
+    }
+    nodes.resize(reserved);
+}
+
+
+int BVH::expandedRoot(int node_index) const {
+    LazySubtree& subtree = *lazy_subtrees[pending_slot[node_index]];
+    std::call_once(subtree.built, [&] { expandSubtree(node_index); });
+    return subtree.base;
+}
 
 
+// writes only the slots reserved for this subtree and the primitive positions of its range, neither of which
+// any ray reads before call_once returns, so builds of different subtrees run alongside each other and the
+// traversals. the build stays on the calling thread: waiting on pool tasks could run a task that needs this
+// very subtree
+void BVH::expandSubtree(int node_index) const {
+    BVH& self = const_cast<BVH&>(*this);
+    LazySubtree& subtree = *lazy_subtrees[pending_slot[node_index]];
+    int start = nodes[node_index].first;
+    int count = nodes[node_index].count;
+
+    std::vector<BuildPrimitive> prims(count);
+    for (int i = 0; i < count; ++i) {
+        prims[i].bbox = primitives[start + i]->getBoundingBox();
+        prims[i].centroid = prims[i].bbox.center();
+        prims[i].index = start + i;
+    }
+    std::atomic<int> next(subtree.base + 1);
+    self.nodes[subtree.base].parent = node_index;
+    self.build(prims, BuildTarget{&next, start, 0, false}, subtree.base, 0, count, subtree.depth);
+    subtree.used = next - subtree.base;
+
+    std::vector<std::shared_ptr<Object>> old_order(primitives.begin() + start, primitives.begin() + start + count);
+    for (int i = 0; i < count; ++i) self.primitives[start + i] = old_order[prims[i].index - start];
+    self.groupLeavesByKind(subtree.base);
+    store->update(primitives, start, count);
+    if (!float_nodes.empty()) {
+        forEachNode(subtree.base, [&](int index) { self.storeFloatNode(index); });
+    }
+    ++expanded_subtrees;
+}
+
+
+void BVH::expandAll() {
+    if (!isLazy()) return;
+    for (int node_index = 0; node_index < static_cast<int>(pending_slot.size()); ++node_index) {
+        if (pending_slot[node_index] < 0) continue;
+        int root = expandedRoot(node_index);
+        int reserved = 2 * nodes[node_index].count - 1;
+        int used = lazy_subtrees[pending_slot[node_index]]->used;
+        // the root's copy takes the pending node's place, its own slot and the unused reservation are dead
+        int parent = nodes[node_index].parent;
+        nodes[node_index] = nodes[root];
+        nodes[node_index].parent = parent;
+        if (!nodes[node_index].isLeaf()) {
+            nodes[nodes[node_index].first].parent = node_index;
+            nodes[nodes[node_index].first + 1].parent = node_index;
+        }
+        if (!float_nodes.empty()) storeFloatNode(node_index);
+        dead_nodes += reserved - used + 1;
+    }
+    lazy_subtrees.clear();
+    pending_slot.clear();
+    sah_cost = computeSAHCost();
+}
+
+
+Hit BVH::intersect(const Ray& ray) const {
+    Hit closest_hit{nullptr, 0, 0};
+    double t_max = std::numeric_limits<double>::max();
+    traverse(ray, t_max, [&](int first, int count, double& t_closest) {
+        store->intersect(first, count, ray, t_closest, closest_hit);
+        return false;
+    });
+    return closest_hit;
+}
+
+
+bool BVH::occluded(const Ray& ray, double t_max, const Object** occluder) const {
+    bool blocked = false;
+    traverse(ray, t_max, [&](int first, int count, double& t_limit) {
+        blocked = store->occluded(first, count, ray, t_limit, occluder);
+        return blocked;
+    });
+    return blocked;
+}
+
+
+void BVH::intersectPacket(const RayPacket& packet, Hit* hits) const {
+    double t_max[RayPacket::max_size];
+    for (int r = 0; r < packet.size; ++r) {
+        hits[r] = Hit{nullptr, 0, 0};
+        t_max[r] = std::numeric_limits<double>::max();
+    }
+    if (nodes.empty()) return;
+    if (!packet.coherent || isLazy()) {
+        // mixed octants cannot be bounded or ordered as one, trace the rays independently. so are the rays of a
+        // lazy tree, the packet loop does not build pending subtrees
+        Accelerator::intersectPacket(packet, hits);
+        return;
+    }
+
+    const size_t min_active_rays = std::max(2, packet.size / 4);
+    struct StackEntry {
+        int node;
+        uint64_t mask; // rays of the packet that may still hit something in this subtree
+    };
+    StackEntry stack[max_depth];
+    int stack_size = 0;
+    StackEntry entry{0, packet.fullMask()};
+
+    while (true) {
+        const BVHNode& node = nodes[entry.node];
+        uint64_t active = 0;
+
+        if (std::bitset<64>(entry.mask).count() < min_active_rays) {
+            // the packet has diverged, finish this subtree one ray at a time
+            for (uint64_t rays = entry.mask; rays; rays &= rays - 1) {
+                int r = lowestRay(rays);
+                const Ray& ray = packet.rays[r];
+                traverse(ray, t_max[r], [&](int first, int count, double& t_closest) {
+                    store->intersect(first, count, ray, t_closest, hits[r]);
+                    return false;
+                }, entry.node);
+            }
+        } else {
+            double packet_t_max = 0.0;
+            for (uint64_t rays = entry.mask; rays; rays &= rays - 1) {
+                packet_t_max = std::max(packet_t_max, t_max[lowestRay(rays)]);
+            }
+            if (packet.mayIntersect(node.bbox, small_t, packet_t_max)) {
+                // ranged traversal: rays before the first one that hits the box leave the packet,
+                // the rest descend and are only tested individually at the leaves
+                for (uint64_t rays = entry.mask; rays; rays &= rays - 1) {
+                    int r = lowestRay(rays);
+                    if (node.bbox.intersect(packet.rays[r], small_t, t_max[r])) {
+                        active = entry.mask & raysFrom(r);
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (active && node.isLeaf()) {
+            for (uint64_t rays = active; rays; rays &= rays - 1) {
+                int r = lowestRay(rays);
+                if (node.bbox.intersect(packet.rays[r], small_t, t_max[r])) {
+                    store->intersect(node.first, node.count, packet.rays[r], t_max[r], hits[r]);
+                }
+            }
+        } else if (active) {
+            // coherent packets share direction signs, so one near/far order suits every ray
+            int near_sign = packet.rays[0].sign[node.axis];
+            stack[stack_size++] = {node.first + 1 - near_sign, active};
+            entry = {node.first + near_sign, active};
+            continue;
+        }
+
+        if (stack_size == 0) break;
+        entry = stack[--stack_size];
+    }
+}
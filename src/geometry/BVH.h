@@ -3,36 +3,346 @@
 
 
 #include <vector>
+#include <cstdint>
 #include <memory>
+#include <limits>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include "core/Ray.h"
 #include "geometry/Object.h"
 #include "geometry/AABB.h"
 #include "geometry/Hit.h"
+#include "geometry/Accelerator.h"
+#include "geometry/PrimitiveStore.h"
+#include "utils/FloatRounding.h"
 
-class BVH {
+// which builder produces the tree
+enum class BVHBuildQuality {
+    Fast,   // Morton code LBVH, close to linear time, for interactive rebuilds
+    Medium, // LBVH followed by treelet reordering to recover most of the SAH quality
+    High    // binned SAH, the best trees and the slowest build
+};
+
+// knobs for the builders, the defaults work well for our mesh-heavy scenes
+struct BVHBuildSettings {
+    BVHBuildQuality quality = BVHBuildQuality::High;
+    int bin_count = 16;             // number of centroid bins evaluated per axis
+    int max_leaf_size = 4;          // a node holding more primitives than this is always split
+    double traversal_cost = 1.0;    // relative cost of visiting an interior node
+    double intersection_cost = 1.0; // relative cost of one primitive intersection test
+    int parallel_subtree_size = 4096;   // subtrees at least this large are built as separate thread pool tasks
+    int parallel_binning_size = 65536;  // nodes at least this large also split their bounds and binning passes into tasks
+    double refit_degradation = 0.25;    // refit() starts rebuilding subtrees once the SAH cost grew by this fraction
+    int treelet_size = 7;               // leaves of each treelet the Medium quality pass reorders, at most 8
+    double spatial_split_budget = 0.0;  // High quality over objects: extra references spatial splits may add, as a fraction
+                                        // of the object count. 0 turns the spatial split (SBVH) search off
+    double spatial_split_overlap = 1e-5; // spatial splits are only searched where the children of the best object split
+                                         // overlap by more than this fraction of the root area
+    bool single_precision = false;       // traverse float copies of the nodes and test float copies of the primitives,
+                                         // re-intersecting the closest candidate in double for the reported hit
+    int lazy_subtree_size = 0;           // High quality over objects: subtrees of at most this many primitives are left as one
+                                         // pending range and built the first time a ray enters them. 0 builds everything up front
+};
+
+// one node of the linearized tree, sized and aligned so a node never straddles two cache lines.
+// siblings are stored next to each other, so an interior node only needs the index of its left child.
+struct alignas(32) BVHNode {
+    AABB bbox;
+    int first; // leaf: offset of the first primitive, interior: index of the left child (right child is first + 1)
+    int count; // number of primitives in a leaf, 0 for interior nodes
+    int axis;  // split axis, used to visit the near child first. BVH::pending_axis marks a range not built yet
+    int parent; // index of the parent node, -1 for the root. lets refit() walk from a leaf to the root
+
+    bool isLeaf() const { return count > 0; }
+};
+static_assert(sizeof(BVHNode) == 64, "BVHNode should fill exactly one cache line");
+
+// what the single precision traversal reads instead of a BVHNode: the box rounded outwards to floats, and the
+// count and axis packed into one int. half the size, so a sibling pair shares a cache line
+struct alignas(32) BVHNodeF {
+    float min[3];
+    int first;
+    float max[3];
+    int count_axis; // count << 2 | axis
+
+    int count() const { return count_axis >> 2; }
+    int axis() const { return count_axis & 3; }
+    bool isLeaf() const { return count_axis >= 4; }
+};
+static_assert(sizeof(BVHNodeF) == 32, "BVHNodeF should fill half a cache line");
+
+// what BVH::refit() changed
+struct BVHUpdate {
+    std::vector<int> refitted_nodes; // nodes whose box was recomputed in place
+    int rebuilt_subtrees = 0;        // subtrees rebuilt from scratch, their nodes were replaced
+    bool full_rebuild = false;       // the whole tree was rebuilt to reclaim the nodes of replaced subtrees
+};
+
+class BVH : public Accelerator {
 public:
-    BVH(const std::vector<std::shared_ptr<Object>>& objects);
-    Hit intersect(const Ray& ray) const;
+    static constexpr int max_depth = 64; // also the size of the traversal stack
+    static constexpr int pending_axis = 3; // axis of a leaf standing in for a subtree that is built on first use
+
+    BVH(const std::vector<std::shared_ptr<Object>>& objects, const BVHBuildSettings& settings = BVHBuildSettings());
+    // tree over bare bounds for objects that test their own leaves through traverse(), e.g. mesh faces.
+    // leaf_order receives the input index of each leaf position, no primitive list is kept
+    BVH(const std::vector<AABB>& bounds, std::vector<int>& leaf_order, const BVHBuildSettings& settings = BVHBuildSettings());
+    Hit intersect(const Ray& ray) const override;
+    bool occluded(const Ray& ray, double t_max, const Object** occluder = nullptr) const override;
+    // packet traversal: culls boxes for the whole packet by interval arithmetic, then per ray, and
+    // finishes a subtree one ray at a time once too few rays of the packet are still active in it
+    void intersectPacket(const RayPacket& packet, Hit* hits) const override;
+
+    // walk the tree front to back. leaf_func(first, count, t_max) tests the primitive range
+    // [first, first + count) and lowers t_max when it finds a closer hit, which prunes the remaining boxes.
+    // returning true from leaf_func ends the traversal immediately. start_node restricts the walk to a subtree
+    template<class LeafFunc>
+    void traverse(const Ray& ray, double& t_max, LeafFunc leaf_func, int start_node = 0) const;
+    // traverse() over a node array that no BVH owns, e.g. one mapped from a file
+    template<class LeafFunc>
+    static void traverseNodes(const BVHNode* nodes, const Ray& ray, double& t_max, LeafFunc leaf_func, int start_node = 0);
+
+    // lazy build: subtrees still pending, and those rays have built so far
+    bool isLazy() const { return !lazy_subtrees.empty(); }
+    int getPendingSubtreeCount() const { return static_cast<int>(lazy_subtrees.size()); }
+    int getExpandedSubtreeCount() const { return expanded_subtrees; }
+    // build every pending subtree now and splice it into the tree, which is an ordinary BVH afterwards
+    void expandAll();
+
+    // update the tree after the objects in moved changed their bounds. boxes are refitted bottom-up from the
+    // leaves holding them, and once the SAH cost has degraded by more than settings.refit_degradation the topmost
+    // subtrees whose boxes grew by that much are rebuilt. the work is proportional to the moved objects and the
+    // rebuilt subtrees, except for the one-time setup on the first call and the occasional full rebuild
+    BVHUpdate refit(const std::vector<const Object*>& moved);
+
+    // expected cost of a random ray under the surface area heuristic, lower is better
+    double getSAHCost() const { return sah_cost; }
+    // wall clock seconds spent building the tree, excluding the primitive bounds
+    double getBuildTime() const { return build_time; }
+    int getNodeCount() const { return static_cast<int>(nodes.size()); }
+    const std::vector<BVHNode>& getNodes() const { return nodes; }
+    // primitives in leaf order, a leaf references the range [first, first + count). with spatial splits an object
+    // split across leaves appears once per leaf; a ray testing it twice finds the same t and closest-hit queries
+    // only accept strictly closer hits, so it is still reported once
+    const std::vector<std::shared_ptr<Object>>& getPrimitives() const { return primitives; }
+    // typed copy of the primitives the leaf tests run on, kept current by refit(). null for a bounds-only tree
+    std::shared_ptr<const PrimitiveStore> getPrimitiveStore() const { return store; }
 
 
 private:
-    struct BVHNode {
+    // bounds and centroid are cached once so the builder never calls the virtual getBoundingBox() again
+    struct BuildPrimitive {
         AABB bbox;
-        std::shared_ptr<BVHNode> left;
-        std::shared_ptr<BVHNode> right;
-        std::vector<std::shared_ptr<Object>> primitives;
+        vec3 centroid;
+        int index; // index into the objects passed to the constructor
+    };
 
+    // what one run of build() allocates from and writes, several runs may go on at once
+    struct BuildTarget {
+        std::atomic<int>* next_node; // next free slot of the preallocated node array
+        int leaf_offset;             // added to the leaf ranges, non-zero while building a subtree
+        int lazy_size;               // ranges of at most this many primitives are left pending, 0 builds all
+        bool parallel;               // split large builds into thread pool tasks
+    };
 
-        bool isLeaf() const {
-            return !primitives.empty();
-        }
+    // a pending subtree: the slots reserved for it, built once by the first ray that enters it
+    struct LazySubtree {
+        std::once_flag built;
+        int base;  // first reserved slot, the subtree root
+        int depth; // depth of the pending node, the subtree continues below it
+        int used = 0; // slots the build took of the 2 * count - 1 reserved
     };
 
-    std::shared_ptr<BVHNode> root;
+    std::vector<BVHNode> nodes; // nodes[0] is the root
+    std::vector<BVHNodeF> float_nodes; // single precision mode only, mirrors nodes
+    std::vector<std::shared_ptr<Object>> primitives;
+    std::shared_ptr<PrimitiveStore> store;
+    BVHBuildSettings settings;
+    double sah_cost = 0.0;
+    double build_time = 0.0;
+    std::atomic<int> next_node{0}; // next free slot of the preallocated node array during the build
+    std::vector<std::unique_ptr<LazySubtree>> lazy_subtrees;
+    std::vector<int> pending_slot; // lazy_subtrees index of each pending node, -1 elsewhere
+    mutable std::atomic<int> expanded_subtrees{0};
+
+    // refit state, set up on the first refit() call
+    std::vector<double> reference_area;   // node areas when the node was last built, -1 for dead nodes
+    std::vector<int> leaf_of;             // leaf node holding each primitive position
+    std::unordered_multimap<const Object*, int> position_of; // primitive positions of each object, several after spatial splits
+    double sah_sum = 0.0;       // SAH cost of the live nodes before normalizing by the root area
+    double reference_sah = 0.0; // SAH cost after the last full build
+    std::unordered_set<int> refitted_since_build; // rebuild candidates gathered over all refits since their last build
+    int dead_nodes = 0;         // nodes of replaced subtrees still occupying the node array
 
-    std::shared_ptr<BVHNode> build(std::vector<std::shared_ptr<Object>>& objects, int depth = 0);
-    Hit traverse(const BVHNode* node, const Ray& ray) const;
+    // objects, when given, lets the High quality build clip them for spatial splits
+    // lazy_size leaves ranges pending as in BVHBuildSettings::lazy_subtree_size, for the binned SAH builder only
+    void buildTree(std::vector<BuildPrimitive>& prims, const std::vector<std::shared_ptr<Object>>* objects = nullptr, int lazy_size = 0);
+    // spatial split builder, in SBVH.cpp
+    void buildSBVH(const std::vector<std::shared_ptr<Object>>& objects, std::vector<BuildPrimitive>& prims, int budget);
+    void buildSpatial(const std::vector<std::shared_ptr<Object>>& objects, std::vector<BuildPrimitive>& refs, int node_index, int depth,
+                      double min_overlap, int& budget, std::vector<BuildPrimitive>& leaf_refs);
+    double findSpatialSplit(const std::vector<std::shared_ptr<Object>>& objects, const std::vector<BuildPrimitive>& refs,
+                            const AABB& bbox, int& split_axis, double& split_position) const;
+    void splitReferences(const std::vector<std::shared_ptr<Object>>& objects, std::vector<BuildPrimitive>& refs, int axis, double position,
+                         int& budget, std::vector<BuildPrimitive>& left, std::vector<BuildPrimitive>& right) const;
+    // Morton code builder and treelet reordering, in LBVH.cpp
+    void buildLBVH(std::vector<BuildPrimitive>& prims);
+    AABB emitLBVH(const std::vector<BuildPrimitive>& prims, const std::vector<uint64_t>& codes, int node_index, int start, int end, int depth);
+    void optimizeTreelets(int node_index, int depth, std::vector<double>& cost, std::vector<int>& height);
+    void reorderTreelet(int node_index, int depth, std::vector<double>& cost, std::vector<int>& height);
+    double relayout(const std::vector<BVHNode>& reordered, const std::vector<BuildPrimitive>& prims, int old_index, int new_index,
+                    std::vector<BuildPrimitive>& ordered);
+    void build(std::vector<BuildPrimitive>& prims, const BuildTarget& target, int node_index, int start, int end, int depth);
+    void computeBounds(const std::vector<BuildPrimitive>& prims, int start, int end, AABB& bbox, AABB& centroid_bounds,
+                       bool parallel = true) const;
+    int partitionSAH(std::vector<BuildPrimitive>& prims, int start, int end, const AABB& bbox, const AABB& centroid_bounds,
+                     int& split_axis, bool& make_leaf, double* best_split_cost = nullptr, bool parallel = true) const;
+    double computeSAHCost() const;
+    double nodeCost(const BVHNode& node) const;
+    void groupLeavesByKind(int root);
+    void storeFloatNode(int node_index);
+    void prepareRefit();
+    void rebuildSubtree(int root);
+    // lazy build: reserve the slots of every pending node after the eager build
+    void reserveLazySubtrees();
+    // root of the subtree standing behind a pending node, built by the first caller
+    int expandedRoot(int node_index) const;
+    void expandSubtree(int node_index) const;
+    template<class NodeFunc>
+    void forEachNode(int root, NodeFunc node_func) const;
+    template<class LeafFunc>
+    void traverseSingle(const Ray& ray, double& t_max, LeafFunc leaf_func, int start_node) const;
+    template<class LeafFunc>
+    void traverseLazy(const Ray& ray, double& t_max, LeafFunc leaf_func, int start_node) const;
 };
 
 
-#endif
\ No newline at end of file
+// visits every node of the subtree under root
+template<class NodeFunc>
+void BVH::forEachNode(int root, NodeFunc node_func) const {
+    int stack[max_depth];
+    int stack_size = 0;
+    stack[stack_size++] = root;
+    while (stack_size > 0) {
+        int node_index = stack[--stack_size];
+        node_func(node_index);
+        if (!nodes[node_index].isLeaf()) {
+            stack[stack_size++] = nodes[node_index].first;
+            stack[stack_size++] = nodes[node_index].first + 1;
+        }
+    }
+}
+
+
+template<class LeafFunc>
+void BVH::traverse(const Ray& ray, double& t_max, LeafFunc leaf_func, int start_node) const {
+    if (nodes.empty()) return;
+    if (!float_nodes.empty()) {
+        traverseSingle(ray, t_max, leaf_func, start_node);
+        return;
+    }
+    if (isLazy()) {
+        traverseLazy(ray, t_max, leaf_func, start_node);
+        return;
+    }
+    traverseNodes(nodes.data(), ray, t_max, leaf_func, start_node);
+}
+
+
+template<class LeafFunc>
+void BVH::traverseNodes(const BVHNode* nodes, const Ray& ray, double& t_max, LeafFunc leaf_func, int start_node) {
+    int stack[max_depth];
+    int stack_size = 0;
+    int node_index = start_node;
+    while (true) {
+        const BVHNode& node = nodes[node_index];
+        if (node.bbox.intersect(ray, small_t, t_max)) {
+            if (node.isLeaf()) {
+                if (leaf_func(node.first, node.count, t_max)) return;
+            } else {
+                // the near child is the one on the side the ray starts from along the split axis
+                int near_child = node.first + ray.sign[node.axis];
+                stack[stack_size++] = node.first + 1 - ray.sign[node.axis];
+                node_index = near_child;
+                continue;
+            }
+        }
+        if (stack_size == 0) break;
+        node_index = stack[--stack_size];
+    }
+}
+
+
+// traverse() over the float nodes. the slab test errs towards hits like the WideBVH one, so no box the
+// double test enters is skipped
+template<class LeafFunc>
+void BVH::traverseSingle(const Ray& ray, double& t_max, LeafFunc leaf_func, int start_node) const {
+    FloatRay float_ray(ray);
+    const float t_min = roundDown(small_t);
+    float t_limit = roundUp(t_max);
+
+    int stack[max_depth];
+    int stack_size = 0;
+    int node_index = start_node;
+    while (true) {
+        const BVHNodeF& node = float_nodes[node_index];
+        float near_t = t_min;
+        float far_t = t_limit;
+        for (int a = 0; a < 3; ++a) {
+            float t0 = ((float_ray.sign[a] ? node.max[a] : node.min[a]) - float_ray.origin_near[a]) * float_ray.inv_direction[a];
+            float t1 = ((float_ray.sign[a] ? node.min[a] : node.max[a]) - float_ray.origin_far[a]) * float_ray.inv_direction[a];
+            near_t = t0 > near_t ? t0 : near_t;
+            far_t = t1 < far_t ? t1 : far_t;
+        }
+        if (near_t <= far_t * float_far_padding) {
+            if (node.isLeaf()) {
+                if (node.axis() == pending_axis) {
+                    node_index = expandedRoot(node_index);
+                    continue;
+                }
+                if (leaf_func(node.first, node.count(), t_max)) return;
+                t_limit = roundUp(t_max);
+            } else {
+                int near_child = node.first + float_ray.sign[node.axis()];
+                stack[stack_size++] = node.first + 1 - float_ray.sign[node.axis()];
+                node_index = near_child;
+                continue;
+            }
+        }
+        if (stack_size == 0) break;
+        node_index = stack[--stack_size];
+    }
+}
+
+
+// traverseNodes() that builds the pending subtrees it reaches and continues into them
+template<class LeafFunc>
+void BVH::traverseLazy(const Ray& ray, double& t_max, LeafFunc leaf_func, int start_node) const {
+    int stack[max_depth];
+    int stack_size = 0;
+    int node_index = start_node;
+    while (true) {
+        const BVHNode& node = nodes[node_index];
+        if (node.bbox.intersect(ray, small_t, t_max)) {
+            if (node.isLeaf()) {
+                if (node.axis == pending_axis) {
+                    node_index = expandedRoot(node_index);
+                    continue;
+                }
+                if (leaf_func(node.first, node.count, t_max)) return;
+            } else {
+                int near_child = node.first + ray.sign[node.axis];
+                stack[stack_size++] = node.first + 1 - ray.sign[node.axis];
+                node_index = near_child;
+                continue;
+            }
+        }
+        if (stack_size == 0) break;
+        node_index = stack[--stack_size];
+    }
+}
+
+
+#endif
@@ -0,0 +1,352 @@
+#include "ChunkedMesh.h"
+#include "core/Kernels.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+
+const char chunk_magic[8] = {'P', 'F', 'C', 'H', 'U', 'N', 'K', 0};
+const uint32_t chunk_version = 1;
+
+uint64_t alignToPage(uint64_t offset)
+{
+    return (offset + MappedFile::page_size - 1) / MappedFile::page_size * MappedFile::page_size;
+}
+
+AABB faceBox(const vec3& p0, const vec3& p1, const vec3& p2)
+{
+    AABB box;
+    box.makeEmpty();
+    box = box + p0;
+    box = box + p1;
+    box = box + p2;
+    // padded like TriangleMesh's face bounds
+    box.min -= vec3(small_t);
+    box.max += vec3(small_t);
+    return box;
+}
+
+}
+
+bool ChunkedMesh::writeFile(const std::string& path, const std::vector<vec3>& positions, const std::vector<uint32_t>& indices,
+                            int faces_per_chunk)
+{
+    int total_faces = static_cast<int>(indices.size() / 3);
+    if (total_faces == 0 || faces_per_chunk <= 0) {
+        std::cerr << "Error: No faces to write to " << path << std::endl;
+        return false;
+    }
+
+    // consecutive faces in the leaf order of a BVH over the whole mesh are close in space, cutting that order
+    // into runs gives compact chunks
+    std::vector<AABB> face_bounds(total_faces);
+    for (int f = 0; f < total_faces; f++)
+        face_bounds[f] = faceBox(positions[indices[3 * f]], positions[indices[3 * f + 1]], positions[indices[3 * f + 2]]);
+    std::vector<int> face_order;
+    BVH whole_mesh(face_bounds, face_order);
+
+    int chunk_count = (total_faces + faces_per_chunk - 1) / faces_per_chunk;
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Error: Could not write " << path << std::endl;
+        return false;
+    }
+
+    FileHeader header;
+    std::memcpy(header.magic, chunk_magic, sizeof(chunk_magic));
+    header.version = chunk_version;
+    header.chunk_count = static_cast<uint32_t>(chunk_count);
+    header.node_bytes = sizeof(BVHNode);
+    header.vertex_bytes = sizeof(vec3);
+
+    // the table is written last, once every chunk knows its offset
+    std::vector<ChunkRecord> records(chunk_count);
+    uint64_t offset = alignToPage(sizeof(FileHeader) + chunk_count * sizeof(ChunkRecord));
+
+    BVHBuildSettings settings;
+    settings.max_leaf_size = 2 * block_width;
+    settings.intersection_cost = 1.0 / block_width;
+
+    for (int c = 0; c < chunk_count; c++) {
+        int first = c * faces_per_chunk;
+        int count = std::min(faces_per_chunk, total_faces - first);
+
+        // renumber the vertices the chunk uses
+        std::unordered_map<uint32_t, uint32_t> local_index;
+        std::vector<vec3> local_positions;
+        std::vector<uint32_t> local_indices(3 * count);
+        std::vector<AABB> local_bounds(count);
+        AABB chunk_bounds;
+        chunk_bounds.makeEmpty();
+        for (int f = 0; f < count; f++) {
+            int face = face_order[first + f];
+            for (int k = 0; k < 3; k++) {
+                uint32_t vertex = indices[3 * face + k];
+                auto inserted = local_index.emplace(vertex, static_cast<uint32_t>(local_positions.size()));
+                if (inserted.second) local_positions.push_back(positions[vertex]);
+                local_indices[3 * f + k] = inserted.first->second;
+            }
+            local_bounds[f] = face_bounds[face];
+            chunk_bounds = chunk_bounds + face_bounds[face];
+        }
+
+        // the chunk's own tree, faces stored in its leaf order like TriangleMesh does
+        std::vector<int> leaf_order;
+        BVH chunk_bvh(local_bounds, leaf_order, settings);
+        std::vector<uint32_t> ordered_indices(3 * count);
+        for (int f = 0; f < count; f++) {
+            for (int k = 0; k < 3; k++) ordered_indices[3 * f + k] = local_indices[3 * leaf_order[f] + k];
+        }
+
+        const std::vector<BVHNode>& nodes = chunk_bvh.getNodes();
+        ChunkRecord& record = records[c];
+        record.bounds = chunk_bounds;
+        record.offset = offset;
+        record.node_count = static_cast<uint32_t>(nodes.size());
+        record.vertex_count = static_cast<uint32_t>(local_positions.size());
+        record.face_count = static_cast<uint32_t>(count);
+        record.first_face = static_cast<uint32_t>(first);
+        record.bytes = nodes.size() * sizeof(BVHNode) + local_positions.size() * sizeof(vec3) + ordered_indices.size() * sizeof(uint32_t);
+
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(BVHNode));
+        file.write(reinterpret_cast<const char*>(local_positions.data()), local_positions.size() * sizeof(vec3));
+        file.write(reinterpret_cast<const char*>(ordered_indices.data()), ordered_indices.size() * sizeof(uint32_t));
+        offset = alignToPage(offset + record.bytes);
+    }
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(ChunkRecord));
+    if (!file) {
+        std::cerr << "Error: Could not write " << path << std::endl;
+        return false;
+    }
+    std::cout << "Chunked mesh: wrote " << total_faces << " faces in " << chunk_count << " chunks to " << path << std::endl;
+    return true;
+}
+
+ChunkedMesh::ChunkedMesh(const std::string& path, std::shared_ptr<Material> material, size_t cache_bytes)
+    : file(path),
+      cache(cache_bytes,
+            [this](int chunk) { file.willNeed(chunks[chunk].offset, chunks[chunk].bytes); },
+            [this](int chunk) { file.dontNeed(chunks[chunk].offset, alignToPage(chunks[chunk].bytes)); })
+{
+    material_shader = material;
+    bounds.makeEmpty();
+    if (!file.isOpen()) return;
+
+    FileHeader header;
+    if (file.size() < sizeof(FileHeader)) {
+        std::cerr << "Error: " << path << " is not a chunked mesh" << std::endl;
+        return;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, chunk_magic, sizeof(chunk_magic)) != 0 || header.version != chunk_version) {
+        std::cerr << "Error: " << path << " is not a chunked mesh" << std::endl;
+        return;
+    }
+    if (header.node_bytes != sizeof(BVHNode) || header.vertex_bytes != sizeof(vec3)
+        || file.size() < sizeof(FileHeader) + header.chunk_count * sizeof(ChunkRecord)) {
+        std::cerr << "Error: " << path << " was written by an incompatible build" << std::endl;
+        return;
+    }
+
+    chunks.resize(header.chunk_count);
+    std::memcpy(chunks.data(), file.data() + sizeof(FileHeader), chunks.size() * sizeof(ChunkRecord));
+    std::vector<AABB> chunk_bounds(chunks.size());
+    for (size_t c = 0; c < chunks.size(); c++) {
+        if (chunks[c].offset + chunks[c].bytes > file.size()) {
+            std::cerr << "Error: " << path << " is truncated" << std::endl;
+            chunks.clear();
+            bounds.makeEmpty();
+            face_count = 0;
+            return;
+        }
+        chunk_bounds[c] = chunks[c].bounds;
+        bounds = bounds + chunks[c].bounds;
+        face_count += chunks[c].face_count;
+    }
+
+    cache.setItemCount(static_cast<int>(chunks.size()));
+
+    // the top level is all that stays resident besides the table
+    top_level = std::make_unique<BVH>(chunk_bounds, chunk_order);
+
+    std::cout << "Chunked mesh: " << face_count << " faces in " << chunks.size() << " chunks, "
+              << cache_bytes / 1024 << " KB cache" << std::endl;
+}
+
+ChunkedMesh::ChunkView ChunkedMesh::view(int chunk) const
+{
+    const ChunkRecord& record = chunks[chunk];
+    const uint8_t* data = file.data() + record.offset;
+    ChunkView result;
+    result.nodes = reinterpret_cast<const BVHNode*>(data);
+    result.positions = reinterpret_cast<const vec3*>(data + record.node_count * sizeof(BVHNode));
+    result.indices = reinterpret_cast<const uint32_t*>(data + record.node_count * sizeof(BVHNode) + record.vertex_count * sizeof(vec3));
+    result.first_face = static_cast<int>(record.first_face);
+    return result;
+}
+
+ChunkedMesh::ChunkView ChunkedMesh::acquire(int chunk) const
+{
+    cache.touch(chunk, chunks[chunk].bytes);
+    return view(chunk);
+}
+
+int ChunkedMesh::chunkOfFace(int face) const
+{
+    auto after = std::upper_bound(chunks.begin(), chunks.end(), static_cast<uint32_t>(face),
+                                  [](uint32_t f, const ChunkRecord& record) { return f < record.first_face; });
+    return static_cast<int>(after - chunks.begin()) - 1;
+}
+
+vec3 ChunkedMesh::faceNormal(const ChunkView& chunk, int face) const
+{
+    const uint32_t* f = &chunk.indices[3 * face];
+    const vec3& p0 = chunk.positions[f[0]];
+    return cross(chunk.positions[f[1]] - p0, chunk.positions[f[2]] - p0).normalized();
+}
+
+// same gather as TriangleMesh's, lanes record the face within the chunk
+void ChunkedMesh::gatherBlock(const ChunkView& chunk, int first, int count, TriangleBlock<block_width>& block) const
+{
+    for (int lane = 0; lane < count; lane++) {
+        const uint32_t* face = &chunk.indices[3 * (first + lane)];
+        block.set(lane, chunk.positions[face[0]], chunk.positions[face[1]], chunk.positions[face[2]], first + lane);
+    }
+}
+
+void ChunkedMesh::intersectChunk(const ChunkView& chunk, const Ray& ray, const WatertightRay& watertight, double& t_max, Hit& hit) const
+{
+    BVH::traverseNodes(chunk.nodes, ray, t_max, [&](int first, int count, double& t_closest) {
+        for (int i = first; i < first + count; i += block_width) {
+            TriangleBlock<block_width> block;
+            gatherBlock(chunk, i, std::min(block_width, first + count - i), block);
+            double b1, b2;
+            int lane = kernels().triangle_block(block, watertight, ray.origin, small_t, t_closest, b1, b2);
+            if (lane >= 0) {
+                hit = Hit{this, t_closest, chunk.first_face + block.primitive[lane]};
+                hit.u = b1;
+                hit.v = b2;
+            }
+        }
+        return false;
+    });
+}
+
+Hit ChunkedMesh::intersect(const Ray& ray) const
+{
+    Hit closest_hit{nullptr, 0, 0};
+    if (!top_level) return closest_hit;
+    WatertightRay watertight(ray);
+    double t_max = std::numeric_limits<double>::max();
+    top_level->traverse(ray, t_max, [&](int first, int count, double& t_closest) {
+        for (int i = first; i < first + count; i++) intersectChunk(acquire(chunk_order[i]), ray, watertight, t_closest, closest_hit);
+        return false;
+    });
+    return closest_hit;
+}
+
+bool ChunkedMesh::occluded(const Ray& ray, double t_max) const
+{
+    bool blocked = false;
+    if (!top_level) return blocked;
+    WatertightRay watertight(ray);
+    top_level->traverse(ray, t_max, [&](int first, int count, double& t_limit) {
+        for (int i = first; i < first + count && !blocked; i++) {
+            ChunkView chunk = acquire(chunk_order[i]);
+            double chunk_limit = t_limit;
+            BVH::traverseNodes(chunk.nodes, ray, chunk_limit, [&](int leaf_first, int leaf_count, double& t_leaf) {
+                for (int j = leaf_first; j < leaf_first + leaf_count; j += block_width) {
+                    TriangleBlock<block_width> block;
+                    gatherBlock(chunk, j, std::min(block_width, leaf_first + leaf_count - j), block);
+                    double t = t_leaf, b1, b2;
+                    if (kernels().triangle_block(block, watertight, ray.origin, small_t, t, b1, b2) >= 0) {
+                        blocked = true;
+                        return true;
+                    }
+                }
+                return false;
+            });
+        }
+        return blocked;
+    });
+    return blocked;
+}
+
+void ChunkedMesh::intersect(const Ray* rays, int count, Hit* hits) const
+{
+    for (int r = 0; r < count; r++) hits[r] = Hit{nullptr, 0, 0};
+    if (!top_level) return;
+
+    // every (chunk, ray) pair whose chunk box the ray crosses, found without touching any chunk
+    std::vector<std::pair<int, int>> visits;
+    for (int r = 0; r < count; r++) {
+        double t_max = std::numeric_limits<double>::max();
+        top_level->traverse(rays[r], t_max, [&](int first, int leaf_count, double&) {
+            for (int i = first; i < first + leaf_count; i++) visits.emplace_back(chunk_order[i], r);
+            return false;
+        });
+    }
+
+    // resident chunks first: they cost no paging and their hits shorten the rays before the rest is read
+    std::vector<char> resident(chunks.size(), 0);
+    for (const auto& visit : visits) resident[visit.first] = cache.isResident(visit.first) ? 1 : 0;
+    std::sort(visits.begin(), visits.end(), [&](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+        if (resident[a.first] != resident[b.first]) return resident[a.first] > resident[b.first];
+        return a < b;
+    });
+
+    std::vector<double> t_max(count, std::numeric_limits<double>::max());
+    for (size_t i = 0; i < visits.size();) {
+        int chunk_index = visits[i].first;
+        ChunkView chunk = acquire(chunk_index);
+        for (; i < visits.size() && visits[i].first == chunk_index; i++) {
+            int r = visits[i].second;
+            intersectChunk(chunk, rays[r], WatertightRay(rays[r]), t_max[r], hits[r]);
+        }
+    }
+}
+
+vec3 ChunkedMesh::getNormal(const vec3& point) const
+{
+    if (chunks.empty()) return vec3();
+    // the chunk whose box lies closest, then the face whose center does
+    int best_chunk = 0;
+    double best_distance = std::numeric_limits<double>::max();
+    for (int c = 0; c < getChunkCount(); c++) {
+        vec3 outside = componentwise_max(componentwise_max(chunks[c].bounds.min - point, point - chunks[c].bounds.max), vec3());
+        double distance = outside.magnitude();
+        if (distance < best_distance) {
+            best_distance = distance;
+            best_chunk = c;
+        }
+    }
+    ChunkView chunk = acquire(best_chunk);
+    int best_face = 0;
+    best_distance = std::numeric_limits<double>::max();
+    for (int f = 0; f < static_cast<int>(chunks[best_chunk].face_count); f++) {
+        const uint32_t* face = &chunk.indices[3 * f];
+        vec3 center = (chunk.positions[face[0]] + chunk.positions[face[1]] + chunk.positions[face[2]]) / 3.0;
+        double distance = (center - point).magnitude();
+        if (distance < best_distance) {
+            best_distance = distance;
+            best_face = f;
+        }
+    }
+    return faceNormal(chunk, best_face);
+}
+
+vec3 ChunkedMesh::getNormal(const vec3& point, const Hit& hit) const
+{
+    if (hit.object != this || hit.part < 0 || hit.part >= face_count) return getNormal(point);
+    int chunk_index = chunkOfFace(hit.part);
+    ChunkView chunk = acquire(chunk_index);
+    return faceNormal(chunk, hit.part - chunk.first_face);
+}
@@ -0,0 +1,90 @@
+#ifndef __CHUNKED_MESH_H__
+#define __CHUNKED_MESH_H__
+
+#include "Object.h"
+#include "BVH.h"
+#include "TriangleKernel.h"
+#include "utils/MappedFile.h"
+#include "utils/ResidencyCache.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// a triangle mesh too large to keep in memory, rendered from a file written by ChunkedMesh::writeFile.
+// the faces are cut into spatially coherent chunks, each stored with its own BVH, vertices and indices on
+// pages of its own. only the chunk table and a BVH over the chunk bounds stay resident: the file is memory
+// mapped, a chunk is paged in when a ray reaches it and dropped again once the LRU cache needs the room.
+// a hit reports the face in Hit::part, numbered across all chunks
+class ChunkedMesh : public Object {
+public:
+    static constexpr int block_width = 4; // triangles a chunk leaf gathers into one run of the block kernel
+
+    ChunkedMesh(const std::string& path, std::shared_ptr<Material> material, size_t cache_bytes = size_t(256) << 20);
+
+    // preprocess an in-memory mesh into a chunk file. smaller chunks page at a finer grain but give the
+    // resident top level more to hold. returns false if the file could not be written
+    static bool writeFile(const std::string& path, const std::vector<vec3>& positions, const std::vector<uint32_t>& indices,
+                          int faces_per_chunk = 4096);
+
+    Hit intersect(const Ray& ray) const override;
+    bool occluded(const Ray& ray, double t_max) const override;
+    // closest hits of many rays at once. the chunks every ray reaches are collected first and the rays are then
+    // tested chunk by chunk, resident chunks first, so each chunk is paged in at most once per call
+    void intersect(const Ray* rays, int count, Hit* hits) const;
+    // without a hit the face is unknown, this searches the chunk closest to the point
+    vec3 getNormal(const vec3& point) const override;
+    vec3 getNormal(const vec3& point, const Hit& hit) const override;
+    AABB getBoundingBox() const override { return bounds; }
+    int getNumberOfParts() const override { return face_count; }
+
+    bool isLoaded() const { return top_level != nullptr; }
+    int getChunkCount() const { return static_cast<int>(chunks.size()); }
+    ResidencyCache::Stats getCacheStats() const { return cache.getStats(); }
+
+private:
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t chunk_count;
+        uint32_t node_bytes;   // sizeof(BVHNode) and sizeof(vec3) of the writer, the file is read back as is
+        uint32_t vertex_bytes;
+    };
+
+    // one entry of the chunk table that follows the header
+    struct ChunkRecord {
+        AABB bounds;
+        uint64_t offset; // page aligned start of the chunk: its BVH nodes, then the positions, then the indices
+        uint64_t bytes;
+        uint32_t node_count;
+        uint32_t vertex_count;
+        uint32_t face_count;
+        uint32_t first_face; // number of the chunk's first face across the whole mesh
+    };
+
+    // a chunk's arrays inside the mapping
+    struct ChunkView {
+        const BVHNode* nodes;
+        const vec3* positions;
+        const uint32_t* indices;
+        int first_face;
+    };
+
+    MappedFile file;
+    std::vector<ChunkRecord> chunks;
+    std::vector<int> chunk_order; // chunk at each leaf position of top_level
+    std::unique_ptr<BVH> top_level;
+    AABB bounds;
+    int face_count = 0;
+    mutable ResidencyCache cache;
+
+    ChunkView view(int chunk) const;
+    // view of a chunk that was made resident first
+    ChunkView acquire(int chunk) const;
+    vec3 faceNormal(const ChunkView& chunk, int face) const;
+    void gatherBlock(const ChunkView& chunk, int first, int count, TriangleBlock<block_width>& block) const;
+    void intersectChunk(const ChunkView& chunk, const Ray& ray, const WatertightRay& watertight, double& t_max, Hit& hit) const;
+    int chunkOfFace(int face) const;
+};
+
+#endif
@@ -8,6 +8,13 @@ struct Hit
     const Object* object; // non owning pointer to the object that was hit
     double t; // distance from the ray origin to the hit point
     int part; // which part of the object was hit (if applicable, e.g. for meshes)
+    double u = 0.0, v = 0.0; // barycentrics of the hit on a triangle, weights of its second and third vertex
+    const Object* instance = nullptr; // instance the ray went through to reach object, its transform places object in the world
+
+    // world space normal at the world space point of this hit
+    vec3 getNormal(const vec3& point) const;
+    // world space normal of the surface itself, without normal interpolation
+    vec3 getGeometricNormal(const vec3& point) const;
 };
 
 #endif
\ No newline at end of file
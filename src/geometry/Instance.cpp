@@ -0,0 +1,65 @@
+#include "geometry/Instance.h"
+
+Instance::Instance(std::shared_ptr<Object> prototype, const Transform& object_to_world)
+    : prototype(prototype), object_to_world(object_to_world), world_to_object(object_to_world.inverse())
+{
+    material_shader = prototype->material_shader;
+    bounds = object_to_world.applyBox(prototype->getBoundingBox());
+}
+
+void Instance::setTransform(const Transform& transform)
+{
+    object_to_world = transform;
+    world_to_object = transform.inverse();
+    bounds = object_to_world.applyBox(prototype->getBoundingBox());
+}
+
+Ray Instance::toObject(const Ray& ray, double& scale) const
+{
+    // the object space ray is normalized again, so t is rescaled by the length the unit direction maps to
+    vec3 direction = world_to_object.applyVector(ray.direction);
+    scale = direction.magnitude();
+    return Ray(world_to_object.applyPoint(ray.origin), direction);
+}
+
+vec3 Instance::toWorldNormal(const vec3& normal) const
+{
+    return world_to_object.applyTransposed(normal).normalized();
+}
+
+Hit Instance::intersect(const Ray& ray) const
+{
+    double scale;
+    Hit hit = prototype->intersect(toObject(ray, scale));
+    if (hit.object) {
+        hit.t /= scale;
+        hit.instance = this;
+    }
+    return hit;
+}
+
+bool Instance::occluded(const Ray& ray, double t_max) const
+{
+    double scale;
+    Ray local = toObject(ray, scale);
+    return prototype->occluded(local, t_max * scale);
+}
+
+vec3 Instance::getNormal(const vec3& point) const
+{
+    return toWorldNormal(prototype->getNormal(world_to_object.applyPoint(point)));
+}
+
+vec3 Instance::getNormal(const vec3& point, const Hit& hit) const
+{
+    Hit local = hit;
+    local.instance = nullptr;
+    return toWorldNormal(local.getNormal(world_to_object.applyPoint(point)));
+}
+
+vec3 Instance::getGeometricNormal(const vec3& point, const Hit& hit) const
+{
+    Hit local = hit;
+    local.instance = nullptr;
+    return toWorldNormal(local.getGeometricNormal(world_to_object.applyPoint(point)));
+}
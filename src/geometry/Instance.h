@@ -0,0 +1,40 @@
+#ifndef __INSTANCE_H__
+#define __INSTANCE_H__
+
+#include <memory>
+#include "geometry/Object.h"
+#include "core/Transform.h"
+
+// one placement of a shared bottom-level object (a TriangleMesh or an ObjectGroup) in the world.
+// the scene BVH is built over instances like any other object, and an instance maps each ray into the
+// prototype's object space instead of copying its geometry. hits report the prototype's primitive in
+// Hit::object and this instance in Hit::instance. prototypes must not contain instances themselves.
+class Instance : public Object {
+public:
+    Instance(std::shared_ptr<Object> prototype, const Transform& object_to_world);
+
+    Hit intersect(const Ray& ray) const override;
+    bool occluded(const Ray& ray, double t_max) const override;
+    vec3 getNormal(const vec3& point) const override;
+    vec3 getNormal(const vec3& point, const Hit& hit) const override;
+    vec3 getGeometricNormal(const vec3& point, const Hit& hit) const override;
+    AABB getBoundingBox() const override { return bounds; }
+    int getNumberOfParts() const override { return prototype->getNumberOfParts(); }
+
+    const std::shared_ptr<Object>& getPrototype() const { return prototype; }
+    const Transform& getTransform() const { return object_to_world; }
+    // move the instance. the scene BVH keeps the old bounds until Scene::updateBVH is told about it
+    void setTransform(const Transform& transform);
+
+private:
+    std::shared_ptr<Object> prototype;
+    Transform object_to_world;
+    Transform world_to_object;
+    AABB bounds; // world space
+
+    // the ray in object space, scale converts object space distances back to world space ones
+    Ray toObject(const Ray& ray, double& scale) const;
+    vec3 toWorldNormal(const vec3& normal) const;
+};
+
+#endif
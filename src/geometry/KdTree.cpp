@@ -0,0 +1,207 @@
+#include "geometry/KdTree.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+
+KdTree::KdTree(const std::vector<std::shared_ptr<Object>>& objects, const KdTreeBuildSettings& build_settings)
+    : settings(build_settings) {
+    bounds.makeEmpty();
+    if (objects.empty()) return;
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<AABB> primitive_bounds(objects.size());
+    std::vector<int> all(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i) {
+        primitive_bounds[i] = objects[i]->getBoundingBox();
+        bounds = bounds + primitive_bounds[i];
+        all[i] = static_cast<int>(i);
+    }
+    int max_depth = settings.max_depth >= 0 ? settings.max_depth
+                                            : static_cast<int>(std::lround(8 + 1.3 * std::log2(static_cast<double>(objects.size()))));
+    buildNode(bounds, primitive_bounds, objects, all, max_depth, 0);
+
+    const int no_ropes[6] = {-1, -1, -1, -1, -1, -1};
+    buildRopes(0, bounds, no_ropes);
+    store = std::make_shared<PrimitiveStore>(primitives);
+    build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+void KdTree::buildNode(const AABB& node_bounds, const std::vector<AABB>& primitive_bounds, const std::vector<std::shared_ptr<Object>>& objects,
+                       std::vector<int>& node_primitives, int depth, int bad_refines) {
+    int node_index = static_cast<int>(nodes.size());
+    nodes.push_back(KdNode{0.0, 0, 3});
+    int count = static_cast<int>(node_primitives.size());
+    double area = node_bounds.surfaceArea();
+    if (count <= settings.max_leaf_size || depth == 0 || !(area > 0.0)) {
+        makeLeaf(node_index, objects, node_primitives);
+        return;
+    }
+
+    // sweep the bound edges along the axis of largest extent for the cheapest SAH split, trying the other
+    // axes only if that one has no edge strictly inside the node
+    vec3 extent = node_bounds.max - node_bounds.min;
+    int axis = extent[0] > extent[1] && extent[0] > extent[2] ? 0 : (extent[1] > extent[2] ? 1 : 2);
+    double best_cost = std::numeric_limits<double>::max();
+    int best_axis = -1, best_offset = -1;
+    std::vector<BoundEdge> edges[3];
+    for (int retries = 0; retries < 3 && best_axis < 0; ++retries, axis = (axis + 1) % 3) {
+        std::vector<BoundEdge>& axis_edges = edges[axis];
+        axis_edges.reserve(2 * count);
+        for (int primitive : node_primitives) {
+            axis_edges.push_back(BoundEdge{primitive_bounds[primitive].min[axis], primitive, true});
+            axis_edges.push_back(BoundEdge{primitive_bounds[primitive].max[axis], primitive, false});
+        }
+        // starts before ends at equal positions
+        std::sort(axis_edges.begin(), axis_edges.end(), [](const BoundEdge& a, const BoundEdge& b) {
+            return a.t < b.t || (a.t == b.t && a.start && !b.start);
+        });
+
+        int other1 = (axis + 1) % 3, other2 = (axis + 2) % 3;
+        double cap_area = 2.0 * extent[other1] * extent[other2];
+        double side_length = 2.0 * (extent[other1] + extent[other2]);
+        int below = 0, above = count;
+        for (int i = 0; i < 2 * count; ++i) {
+            if (!axis_edges[i].start) --above;
+            double t = axis_edges[i].t;
+            if (t > node_bounds.min[axis] && t < node_bounds.max[axis]) {
+                double p_below = (cap_area + (t - node_bounds.min[axis]) * side_length) / area;
+                double p_above = (cap_area + (node_bounds.max[axis] - t) * side_length) / area;
+                double bonus = (below == 0 || above == 0) ? settings.empty_bonus : 0.0;
+                double cost = settings.traversal_cost + settings.intersection_cost * (1.0 - bonus) * (p_below * below + p_above * above);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_offset = i;
+                }
+            }
+            if (axis_edges[i].start) ++below;
+        }
+    }
+
+    // give up after a few splits in a row that did not pay for themselves
+    double leaf_cost = settings.intersection_cost * count;
+    if (best_cost > leaf_cost) ++bad_refines;
+    if (best_axis < 0 || (best_cost > 4.0 * leaf_cost && count < 16) || bad_refines == 3) {
+        makeLeaf(node_index, objects, node_primitives);
+        return;
+    }
+
+    const std::vector<BoundEdge>& split_edges = edges[best_axis];
+    std::vector<int> below_primitives, above_primitives;
+    for (int i = 0; i < best_offset; ++i) {
+        if (split_edges[i].start) below_primitives.push_back(split_edges[i].primitive);
+    }
+    for (int i = best_offset + 1; i < 2 * count; ++i) {
+        if (!split_edges[i].start) above_primitives.push_back(split_edges[i].primitive);
+    }
+    double split = split_edges[best_offset].t;
+    for (auto& axis_edges : edges) std::vector<BoundEdge>().swap(axis_edges);
+    std::vector<int>().swap(node_primitives);
+
+    AABB below_bounds = node_bounds, above_bounds = node_bounds;
+    below_bounds.max[best_axis] = split;
+    above_bounds.min[best_axis] = split;
+    nodes[node_index].split = split;
+    nodes[node_index].axis = best_axis;
+    buildNode(below_bounds, primitive_bounds, objects, below_primitives, depth - 1, bad_refines);
+    nodes[node_index].child = static_cast<int>(nodes.size());
+    buildNode(above_bounds, primitive_bounds, objects, above_primitives, depth - 1, bad_refines);
+}
+
+
+void KdTree::makeLeaf(int node_index, const std::vector<std::shared_ptr<Object>>& objects, const std::vector<int>& node_primitives) {
+    KdLeaf leaf;
+    leaf.first = static_cast<int>(primitives.size());
+    leaf.count = static_cast<int>(node_primitives.size());
+    for (int primitive : node_primitives) primitives.push_back(objects[primitive]);
+    // runs of one kind for the primitive store, as in BVH leaves
+    std::stable_sort(primitives.begin() + leaf.first, primitives.end(),
+        [](const std::shared_ptr<Object>& a, const std::shared_ptr<Object>& b) {
+            return PrimitiveStore::kindOf(*a) < PrimitiveStore::kindOf(*b);
+        });
+    nodes[node_index].child = static_cast<int>(leaves.size());
+    nodes[node_index].axis = 3;
+    leaves.push_back(leaf);
+}
+
+
+void KdTree::buildRopes(int node_index, const AABB& node_bounds, const int (&ropes)[6]) {
+    const KdNode& node = nodes[node_index];
+    if (node.isLeaf()) {
+        KdLeaf& leaf = leaves[node.child];
+        leaf.bbox = node_bounds;
+        for (int face = 0; face < 6; ++face) leaf.ropes[face] = pushRope(ropes[face], face, node_bounds);
+        return;
+    }
+    int axis = node.axis;
+    int below_ropes[6], above_ropes[6];
+    std::copy(ropes, ropes + 6, below_ropes);
+    std::copy(ropes, ropes + 6, above_ropes);
+    below_ropes[2 * axis + 1] = node.child;
+    above_ropes[2 * axis] = node_index + 1;
+    AABB below_bounds = node_bounds, above_bounds = node_bounds;
+    below_bounds.max[axis] = node.split;
+    above_bounds.min[axis] = node.split;
+    int above_child = node.child;
+    buildRopes(node_index + 1, below_bounds, below_ropes);
+    buildRopes(above_child, above_bounds, above_ropes);
+}
+
+
+int KdTree::pushRope(int rope, int face, const AABB& cell) const {
+    int face_axis = face / 2;
+    bool max_side = face & 1;
+    while (rope >= 0 && !nodes[rope].isLeaf()) {
+        const KdNode& node = nodes[rope];
+        if (node.axis == face_axis) {
+            // the child touching the face
+            rope = max_side ? rope + 1 : node.child;
+        } else if (node.split <= cell.min[node.axis]) {
+            rope = node.child;
+        } else if (node.split >= cell.max[node.axis]) {
+            rope = rope + 1;
+        } else {
+            break; // the plane cuts through the face
+        }
+    }
+    return rope;
+}
+
+
+int KdTree::locate(int node_index, const vec3& point, const vec3& direction) const {
+    while (!nodes[node_index].isLeaf()) {
+        const KdNode& node = nodes[node_index];
+        double x = point[node.axis];
+        bool above = x > node.split || (x == node.split && direction[node.axis] > 0.0);
+        node_index = above ? node.child : node_index + 1;
+    }
+    return node_index;
+}
+
+
+size_t KdTree::getMemoryUsage() const {
+    return nodes.size() * sizeof(KdNode) + leaves.size() * sizeof(KdLeaf) + primitives.size() * sizeof(std::shared_ptr<Object>);
+}
+
+
+Hit KdTree::intersect(const Ray& ray) const {
+    Hit closest_hit{nullptr, 0, 0};
+    double t_max = std::numeric_limits<double>::max();
+    traverse(ray, t_max, [&](int first, int count, double& t_closest) {
+        store->intersect(first, count, ray, t_closest, closest_hit);
+        return false;
+    });
+    return closest_hit;
+}
+
+
+bool KdTree::occluded(const Ray& ray, double t_max, const Object** occluder) const {
+    bool blocked = false;
+    traverse(ray, t_max, [&](int first, int count, double& t_limit) {
+        blocked = store->occluded(first, count, ray, t_limit, occluder);
+        return blocked;
+    });
+    return blocked;
+}
@@ -0,0 +1,133 @@
+#ifndef __KD_TREE_H__
+#define __KD_TREE_H__
+
+#include <vector>
+#include <memory>
+#include <limits>
+#include "core/Ray.h"
+#include "geometry/Object.h"
+#include "geometry/AABB.h"
+#include "geometry/Hit.h"
+#include "geometry/Accelerator.h"
+#include "geometry/PrimitiveStore.h"
+
+// knobs for the kd-tree builder, the defaults are pbrt's
+struct KdTreeBuildSettings {
+    double traversal_cost = 1.0;     // relative cost of stepping through an interior node
+    double intersection_cost = 80.0; // relative cost of one primitive intersection test
+    double empty_bonus = 0.5;        // discount on a split that cuts off an empty child
+    int max_leaf_size = 1;           // a node holding more primitives than this is split if the SAH allows it
+    int max_depth = -1;              // -1 picks 8 + 1.3 log2 of the object count
+};
+
+// interior node: the split plane, the child below it is the next node and the one above it is at child.
+// a leaf only points into the leaf table, which the traversal reads once per leaf
+struct KdNode {
+    double split;
+    int child; // interior: index of the child above the plane, leaf: index into the leaf table
+    int axis;  // split axis, 3 for leaves
+
+    bool isLeaf() const { return axis == 3; }
+};
+static_assert(sizeof(KdNode) == 16, "KdNode should pack four to a cache line");
+
+// a leaf cell with its primitive range and its ropes: for each face (-x, +x, -y, +y, -z, +z) the smallest
+// node on the other side that still covers the whole face, -1 where the face lies on the scene bounds
+struct KdLeaf {
+    AABB bbox;
+    int first;
+    int count;
+    int ropes[6];
+};
+
+// SAH kd-tree over the scene objects, the alternative to the BVH for scenes with large axis aligned
+// primitives, which a kd-tree can cut where a BVH can only enclose them. built with the O(N log^2 N) sweep
+// and traversed with ropes: a ray locates the leaf holding its entry point once and then steps from leaf to
+// leaf through the face it leaves by, without a stack. an object overlapping several cells is referenced by
+// each of their leaves
+class KdTree : public Accelerator {
+public:
+    KdTree(const std::vector<std::shared_ptr<Object>>& objects, const KdTreeBuildSettings& settings = KdTreeBuildSettings());
+    Hit intersect(const Ray& ray) const override;
+    bool occluded(const Ray& ray, double t_max, const Object** occluder = nullptr) const override;
+
+    int getNodeCount() const { return static_cast<int>(nodes.size()); }
+    int getLeafCount() const { return static_cast<int>(leaves.size()); }
+    // object references over all leaves, at least the object count
+    int getReferenceCount() const { return static_cast<int>(primitives.size()); }
+    // wall clock seconds spent building the tree
+    double getBuildTime() const { return build_time; }
+    // bytes held by the nodes, the leaf table and the references
+    size_t getMemoryUsage() const;
+
+private:
+    // start or end of a primitive's bounds along the swept axis
+    struct BoundEdge {
+        double t;
+        int primitive;
+        bool start;
+    };
+
+    KdTreeBuildSettings settings;
+    AABB bounds;
+    std::vector<KdNode> nodes; // nodes[0] is the root
+    std::vector<KdLeaf> leaves;
+    std::vector<std::shared_ptr<Object>> primitives; // references in leaf order, grouped by kind within a leaf
+    std::shared_ptr<PrimitiveStore> store;
+    double build_time = 0.0;
+
+    void buildNode(const AABB& node_bounds, const std::vector<AABB>& primitive_bounds, const std::vector<std::shared_ptr<Object>>& objects,
+                   std::vector<int>& node_primitives, int depth, int bad_refines);
+    void makeLeaf(int node_index, const std::vector<std::shared_ptr<Object>>& objects, const std::vector<int>& node_primitives);
+    // fills in the leaf cells and their ropes, ropes holds the neighbours of the node's own cell
+    void buildRopes(int node_index, const AABB& node_bounds, const int (&ropes)[6]);
+    // descend a rope to the smallest node that still covers the face of the leaf cell
+    int pushRope(int rope, int face, const AABB& cell) const;
+    // the leaf below node_index whose cell holds the point, ties go to the side the ray is heading to
+    int locate(int node_index, const vec3& point, const vec3& direction) const;
+
+    // walk the leaves the ray passes through, front to back. leaf_func(first, count, t_max) tests the
+    // primitive range and lowers t_max on a closer hit; the walk ends once t_max lies within the leaf just
+    // tested, or when leaf_func returns true
+    template<class LeafFunc>
+    void traverse(const Ray& ray, double& t_max, LeafFunc leaf_func) const;
+};
+
+template<class LeafFunc>
+void KdTree::traverse(const Ray& ray, double& t_max, LeafFunc leaf_func) const {
+    if (nodes.empty()) return;
+
+    // clip the ray to the scene bounds, an axis the ray runs parallel to gives NaN and is skipped
+    double t_enter = 0.0, t_leave = std::numeric_limits<double>::max();
+    for (int a = 0; a < 3; ++a) {
+        double t_near = (bounds.min[a] - ray.origin[a]) * ray.inv_direction[a];
+        double t_far = (bounds.max[a] - ray.origin[a]) * ray.inv_direction[a];
+        if (t_near > t_far) std::swap(t_near, t_far);
+        if (t_near > t_enter) t_enter = t_near;
+        if (t_far < t_leave) t_leave = t_far;
+    }
+    if (t_enter > t_leave || t_enter > t_max) return;
+
+    int node = locate(0, ray.origin + t_enter * ray.direction, ray.direction);
+    while (true) {
+        const KdLeaf& leaf = leaves[nodes[node].child];
+        // where the ray leaves the cell, and through which face
+        int face = -1;
+        t_leave = std::numeric_limits<double>::max();
+        for (int a = 0; a < 3; ++a) {
+            if (ray.direction[a] == 0.0) continue;
+            bool up = ray.direction[a] > 0.0;
+            double t = ((up ? leaf.bbox.max[a] : leaf.bbox.min[a]) - ray.origin[a]) * ray.inv_direction[a];
+            if (t < t_leave) {
+                t_leave = t;
+                face = 2 * a + (up ? 1 : 0);
+            }
+        }
+        if (leaf.count > 0 && leaf_func(leaf.first, leaf.count, t_max)) return;
+        if (face < 0 || t_leave >= t_max || leaf.ropes[face] < 0) return;
+        if (t_leave > t_enter) t_enter = t_leave;
+        node = locate(leaf.ropes[face], ray.origin + t_enter * ray.direction, ray.direction);
+    }
+}
+
+#endif
@@ -0,0 +1,361 @@
+#include "geometry/BVH.h"
+#include "utils/ThreadPool.h"
+#include <algorithm>
+#include <limits>
+
+
+// spread the low 21 bits of x so two zero bits separate each of them
+static uint64_t expandBits21(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+// 63-bit Morton code, x in the highest bit of every triple. bit b therefore splits along axis 2 - b % 3
+static uint64_t mortonCode(const vec3& p, const AABB& bounds) {
+    uint64_t q[3];
+    for (int a = 0; a < 3; ++a) {
+        double extent = bounds.max[a] - bounds.min[a];
+        double t = extent > 0.0 ? (p[a] - bounds.min[a]) / extent : 0.0;
+        q[a] = static_cast<uint64_t>(std::min(std::max(t * 2097152.0, 0.0), 2097151.0));
+    }
+    return expandBits21(q[0]) << 2 | expandBits21(q[1]) << 1 | expandBits21(q[2]);
+}
+
+
+// stable LSD radix sort of (key, value) pairs, 8 bits per pass. each pass counts digits per chunk in
+// parallel, turns the counts into per-chunk output offsets, then scatters the chunks in parallel.
+// passes whose digit is the same for every key are skipped
+static void radixSort(std::vector<uint64_t>& keys, std::vector<int>& values, int chunk_size) {
+    int n = static_cast<int>(keys.size());
+    int chunk_count = (n + chunk_size - 1) / chunk_size;
+    std::vector<uint64_t> keys_out(n);
+    std::vector<int> values_out(n);
+    std::vector<int> offsets(chunk_count * 256);
+    ThreadPool& pool = ThreadPool::global();
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        pool.parallelFor(0, chunk_count, 1, [&](int first_chunk, int last_chunk) {
+            for (int c = first_chunk; c < last_chunk; ++c) {
+                int* histogram = &offsets[c * 256];
+                for (int i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); ++i) {
+                    ++histogram[(keys[i] >> shift) & 0xff];
+                }
+            }
+        });
+
+        // exclusive prefix sum in (digit, chunk) order
+        int total = 0;
+        bool single_digit = false;
+        for (int digit = 0; digit < 256; ++digit) {
+            int digit_total = 0;
+            for (int c = 0; c < chunk_count; ++c) {
+                int count = offsets[c * 256 + digit];
+                offsets[c * 256 + digit] = total + digit_total;
+                digit_total += count;
+            }
+            if (digit_total == n) single_digit = true;
+            total += digit_total;
+        }
+        if (single_digit) continue;
+
+        pool.parallelFor(0, chunk_count, 1, [&](int first_chunk, int last_chunk) {
+            for (int c = first_chunk; c < last_chunk; ++c) {
+                int* offset = &offsets[c * 256];
+                for (int i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); ++i) {
+                    int destination = offset[(keys[i] >> shift) & 0xff]++;
+                    keys_out[destination] = keys[i];
+                    values_out[destination] = values[i];
+                }
+            }
+        });
+        keys.swap(keys_out);
+        values.swap(values_out);
+    }
+}
+
+
+// linear BVH (Lauterbach et al. 2009): sort the primitives along a Morton curve through their centroids,
+// then split every range where the highest differing code bit flips. the codes already encode the spatial
+// subdivision, so no split plane is ever evaluated
+void BVH::buildLBVH(std::vector<BuildPrimitive>& prims) {
+    int n = static_cast<int>(prims.size());
+    AABB bbox, centroid_bounds;
+    computeBounds(prims, 0, n, bbox, centroid_bounds);
+
+    std::vector<uint64_t> codes(n);
+    std::vector<int> order(n);
+    ThreadPool::global().parallelFor(0, n, settings.parallel_subtree_size, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            codes[i] = mortonCode(prims[i].centroid, centroid_bounds);
+            order[i] = i;
+        }
+    });
+    radixSort(codes, order, settings.parallel_subtree_size);
+
+    std::vector<BuildPrimitive> sorted(n);
+    for (int i = 0; i < n; ++i) sorted[i] = prims[order[i]];
+    prims.swap(sorted);
+
+    emitLBVH(prims, codes, 0, 0, n, 0);
+
+    if (settings.quality == BVHBuildQuality::Medium) {
+        std::vector<double> cost(next_node);
+        std::vector<int> height(next_node);
+        optimizeTreelets(0, 0, cost, height);
+
+        // reordering mixed up the leaf ranges, lay nodes and primitives out again in depth-first order
+        std::vector<BVHNode> reordered(nodes.begin(), nodes.begin() + next_node);
+        std::vector<BuildPrimitive> ordered;
+        ordered.reserve(n);
+        nodes.clear();
+        nodes.emplace_back();
+        nodes[0].parent = -1;
+        relayout(reordered, prims, 0, 0, ordered);
+        prims.swap(ordered);
+        next_node = static_cast<int>(nodes.size());
+    }
+}
+
+
+// copy the subtree under old_index to new_index, appending its primitives to ordered so every subtree covers
+// a contiguous range again. Medium quality emits single primitive leaves for the treelets to work with,
+// so sibling leaves are merged here whenever one leaf is cheaper under the SAH. returns the subtree cost
+double BVH::relayout(const std::vector<BVHNode>& reordered, const std::vector<BuildPrimitive>& prims, int old_index, int new_index,
+                     std::vector<BuildPrimitive>& ordered) {
+    const BVHNode& old_node = reordered[old_index];
+    double area = old_node.bbox.surfaceArea();
+    if (old_node.isLeaf()) {
+        BVHNode& node = nodes[new_index];
+        node.bbox = old_node.bbox;
+        node.first = static_cast<int>(ordered.size());
+        node.count = old_node.count;
+        node.axis = old_node.axis;
+        ordered.insert(ordered.end(), prims.begin() + old_node.first, prims.begin() + old_node.first + old_node.count);
+        return settings.intersection_cost * old_node.count * area;
+    }
+
+    int left = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    nodes.emplace_back();
+    nodes[left].parent = new_index;
+    nodes[left + 1].parent = new_index;
+    double children_cost = relayout(reordered, prims, old_node.first, left, ordered) +
+                           relayout(reordered, prims, old_node.first + 1, left + 1, ordered);
+
+    BVHNode& node = nodes[new_index];
+    node.bbox = old_node.bbox;
+    node.axis = old_node.axis;
+    const BVHNode& left_node = nodes[left];
+    const BVHNode& right_node = nodes[left + 1];
+    int count = left_node.count + right_node.count;
+    if (left_node.isLeaf() && right_node.isLeaf() && count <= settings.max_leaf_size &&
+        settings.intersection_cost * count * area <= settings.traversal_cost * area + children_cost) {
+        // the two leaves were just appended, so their primitives are adjacent and their pair is the last one
+        node.first = left_node.first;
+        node.count = count;
+        nodes.pop_back();
+        nodes.pop_back();
+        return settings.intersection_cost * count * area;
+    }
+    node.first = left;
+    node.count = 0;
+    return settings.traversal_cost * area + children_cost;
+}
+
+
+AABB BVH::emitLBVH(const std::vector<BuildPrimitive>& prims, const std::vector<uint64_t>& codes, int node_index, int start, int end, int depth) {
+    int count = end - start;
+    BVHNode& node = nodes[node_index];
+    int leaf_size = settings.quality == BVHBuildQuality::Medium ? 1 : settings.max_leaf_size;
+    if (count <= leaf_size || depth >= max_depth - 1) {
+        AABB bbox;
+        bbox.makeEmpty();
+        for (int i = start; i < end; ++i) bbox = bbox + prims[i].bbox;
+        node.bbox = bbox;
+        node.first = start;
+        node.count = count;
+        node.axis = 0;
+        return bbox;
+    }
+
+    int mid;
+    uint64_t differing = codes[start] ^ codes[end - 1];
+    if (differing == 0) {
+        // identical codes carry no spatial order, halve the range
+        mid = start + count / 2;
+        node.axis = 0;
+    } else {
+        // codes are sorted, so the first one with the highest differing bit set starts the right child
+        int bit = 63 - __builtin_clzll(differing);
+        uint64_t mask = uint64_t(1) << bit;
+        mid = static_cast<int>(std::partition_point(codes.begin() + start, codes.begin() + end,
+            [mask](uint64_t code) { return (code & mask) == 0; }) - codes.begin());
+        node.axis = 2 - bit % 3;
+    }
+
+    int left = next_node.fetch_add(2);
+    node.first = left;
+    node.count = 0;
+    nodes[left].parent = node_index;
+    nodes[left + 1].parent = node_index;
+
+    AABB left_box, right_box;
+    if (count >= settings.parallel_subtree_size) {
+        ThreadPool& pool = ThreadPool::global();
+        TaskGroup group;
+        pool.submit(group, [&, left, start, mid, depth] { left_box = emitLBVH(prims, codes, left, start, mid, depth + 1); });
+        right_box = emitLBVH(prims, codes, left + 1, mid, end, depth + 1);
+        pool.wait(group);
+    } else {
+        left_box = emitLBVH(prims, codes, left, start, mid, depth + 1);
+        right_box = emitLBVH(prims, codes, left + 1, mid, end, depth + 1);
+    }
+    // nodes may not be held by reference across the recursion, a sibling task can be writing next to it
+    nodes[node_index].bbox = left_box + right_box;
+    return nodes[node_index].bbox;
+}
+
+
+// treelet reordering (Karras and Aila 2013), bottom-up: at every interior node, grow a treelet of up to
+// treelet_size leaves by repeatedly opening its largest interior leaf, then find the binary tree over those
+// leaves with the lowest SAH cost by dynamic programming over leaf subsets and rewire the treelet to it.
+// the rewired treelet reuses the sibling pairs of the nodes it opened, so no node is allocated.
+// cost[] and height[] receive the SAH cost (area weighted, not normalized) and height of every subtree
+void BVH::optimizeTreelets(int node_index, int depth, std::vector<double>& cost, std::vector<int>& height) {
+    const BVHNode& node = nodes[node_index];
+    if (node.isLeaf()) {
+        cost[node_index] = settings.intersection_cost * node.count * node.bbox.surfaceArea();
+        height[node_index] = 0;
+        return;
+    }
+
+    // the top levels split into tasks, lower subtrees are too small to be worth it
+    int left = node.first;
+    if (depth < 8 && ThreadPool::global().getThreadCount() > 1) {
+        ThreadPool& pool = ThreadPool::global();
+        TaskGroup group;
+        pool.submit(group, [&, left, depth] { optimizeTreelets(left, depth + 1, cost, height); });
+        optimizeTreelets(left + 1, depth + 1, cost, height);
+        pool.wait(group);
+    } else {
+        optimizeTreelets(left, depth + 1, cost, height);
+        optimizeTreelets(left + 1, depth + 1, cost, height);
+    }
+    cost[node_index] = settings.traversal_cost * node.bbox.surfaceArea() + cost[left] + cost[left + 1];
+    height[node_index] = 1 + std::max(height[left], height[left + 1]);
+    reorderTreelet(node_index, depth, cost, height);
+}
+
+
+// the subset tables are kept out of the recursive frames above
+void BVH::reorderTreelet(int node_index, int depth, std::vector<double>& cost, std::vector<int>& height) {
+    // grow the treelet
+    int left = nodes[node_index].first;
+    constexpr int max_leaves = 8;
+    int size = std::min(max_leaves, std::max(3, settings.treelet_size));
+    int leaves[max_leaves] = {left, left + 1};
+    int leaf_count = 2;
+    int pairs[max_leaves - 1] = {left}; // first slot of each sibling pair the treelet owns
+    int pair_count = 1;
+    while (leaf_count < size) {
+        int best = -1;
+        double best_area = -1.0;
+        for (int i = 0; i < leaf_count; ++i) {
+            const BVHNode& candidate = nodes[leaves[i]];
+            if (!candidate.isLeaf() && candidate.bbox.surfaceArea() > best_area) {
+                best_area = candidate.bbox.surfaceArea();
+                best = i;
+            }
+        }
+        if (best < 0) break;
+        int opened = nodes[leaves[best]].first;
+        pairs[pair_count++] = opened;
+        leaves[best] = opened;
+        leaves[leaf_count++] = opened + 1;
+    }
+    if (leaf_count < 3) return; // two leaves allow one topology only
+
+    // optimal topology over every subset of the treelet leaves
+    int subsets = 1 << leaf_count;
+    AABB box[1 << max_leaves];
+    double best_cost[1 << max_leaves];
+    int best_split[1 << max_leaves];
+    int best_height[1 << max_leaves];
+    for (int s = 1; s < subsets; ++s) {
+        int lowest = __builtin_ctz(s);
+        if ((s & (s - 1)) == 0) {
+            box[s] = nodes[leaves[lowest]].bbox;
+            best_cost[s] = cost[leaves[lowest]];
+            best_height[s] = height[leaves[lowest]];
+            continue;
+        }
+        box[s] = box[s & (s - 1)] + box[1 << lowest];
+        best_cost[s] = std::numeric_limits<double>::max();
+        // every proper split once: the part holding the lowest leaf goes left
+        for (int part = (s - 1) & s; part > 0; part = (part - 1) & s) {
+            if (!(part & (1 << lowest))) continue;
+            double split_cost = best_cost[part] + best_cost[s ^ part];
+            if (split_cost < best_cost[s]) {
+                best_cost[s] = split_cost;
+                best_split[s] = part;
+            }
+        }
+        best_cost[s] += settings.traversal_cost * box[s].surfaceArea();
+        best_height[s] = 1 + std::max(best_height[best_split[s]], best_height[s ^ best_split[s]]);
+    }
+
+    int full = subsets - 1;
+    if (best_cost[full] >= cost[node_index] * (1.0 - 1e-9) || depth + best_height[full] >= max_depth) return;
+
+    // rewire: treelet leaves keep their contents, interior nodes of the new topology take the owned pairs
+    BVHNode leaf_nodes[max_leaves];
+    double leaf_cost[max_leaves];
+    int leaf_height[max_leaves];
+    for (int i = 0; i < leaf_count; ++i) {
+        leaf_nodes[i] = nodes[leaves[i]];
+        leaf_cost[i] = cost[leaves[i]];
+        leaf_height[i] = height[leaves[i]];
+    }
+    int next_pair = 0;
+    auto place = [&](auto&& self, int s, int target) -> void {
+        int parent = nodes[target].parent;
+        if ((s & (s - 1)) == 0) {
+            int i = __builtin_ctz(s);
+            nodes[target] = leaf_nodes[i];
+            nodes[target].parent = parent;
+            if (!leaf_nodes[i].isLeaf()) {
+                nodes[leaf_nodes[i].first].parent = target;
+                nodes[leaf_nodes[i].first + 1].parent = target;
+            }
+            cost[target] = leaf_cost[i];
+            height[target] = leaf_height[i];
+            return;
+        }
+        int pair = pairs[next_pair++];
+        int part = best_split[s];
+        BVHNode& interior = nodes[target];
+        interior.bbox = box[s];
+        interior.first = pair;
+        interior.count = 0;
+        // visit order follows the axis along which the two halves lie farthest apart
+        vec3 separation = box[s ^ part].center() - box[part].center();
+        interior.axis = 0;
+        for (int a = 1; a < 3; ++a) {
+            if (std::abs(separation[a]) > std::abs(separation[interior.axis])) interior.axis = a;
+        }
+        bool swap_children = separation[interior.axis] < 0.0; // keep the lower half on the left
+        nodes[pair].parent = target;
+        nodes[pair + 1].parent = target;
+        self(self, swap_children ? s ^ part : part, pair);
+        self(self, swap_children ? part : s ^ part, pair + 1);
+        cost[target] = best_cost[s];
+        height[target] = best_height[s];
+    };
+    place(place, full, node_index);
+}
@@ -0,0 +1,33 @@
+#include "Object.h"
+
+// generic any-hit test, correct for every shape but pays for a full closest-hit intersection
+bool Object::occluded(const Ray& ray, double t_max) const {
+    Hit hit = intersect(ray);
+    return hit.object && hit.t >= small_t && hit.t < t_max;
+}
+
+
+AABB Object::getClippedBoundingBox(const AABB& box) const {
+    return getBoundingBox().intersection(box);
+}
+
+
+vec3 Object::getNormal(const vec3& point, const Hit&) const {
+    return getNormal(point);
+}
+
+vec3 Object::getGeometricNormal(const vec3& point, const Hit& hit) const {
+    return getNormal(point, hit);
+}
+
+const Material* Object::getMaterial(const Hit&) const {
+    return material_shader.get();
+}
+
+vec3 Hit::getNormal(const vec3& point) const {
+    return (instance ? instance : object)->getNormal(point, *this);
+}
+
+vec3 Hit::getGeometricNormal(const vec3& point) const {
+    return (instance ? instance : object)->getGeometricNormal(point, *this);
+}
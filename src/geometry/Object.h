@@ -9,6 +9,7 @@
 #include "materials/Material.h"
 
 class Material;
+struct Hit;
 
 class Object {
 public:
@@ -22,9 +23,21 @@ public:
     virtual ~Object() = default; // virtual destructor for polymorphic behavior
 
     virtual Hit intersect(const Ray& ray) const = 0; // pure virtual function for intersection
+    // any-hit test used by shadow rays, true if the ray hits this object anywhere in [small_t, t_max).
+    // the default falls back to intersect(), shapes override it with a cheaper early-out test
+    virtual bool occluded(const Ray& ray, double t_max) const;
     virtual vec3 getNormal(const vec3& point) const = 0; // pure virtual function for normal calculation
+    // normal at a hit of this object, lets objects made of many faces use hit.part and the barycentrics
+    virtual vec3 getNormal(const vec3& point, const Hit& hit) const;
+    // normal of the surface itself at a hit, differs from getNormal only where normals are interpolated
+    virtual vec3 getGeometricNormal(const vec3& point, const Hit& hit) const;
     virtual AABB getBoundingBox() const = 0; // pure virtual function for bounding box
+    // bounds of the part of the object inside box, empty if none of it is. used by the spatial split builder,
+    // the default is the overlap of the two boxes and shapes override it with something tighter
+    virtual AABB getClippedBoundingBox(const AABB& box) const;
     virtual int getNumberOfParts() const = 0; // pure virtual function for number of parts
+    // material at a hit, objects whose parts differ in material use hit.part. the default is material_shader
+    virtual const Material* getMaterial(const Hit& hit) const;
     bool hasMaterial() const { return material_shader != nullptr; } // check if object has a material
 };
 
@@ -0,0 +1,21 @@
+#include "geometry/ObjectGroup.h"
+
+ObjectGroup::ObjectGroup(const std::vector<std::shared_ptr<Object>>& objects)
+    : objects(objects), bvh(std::make_unique<BVH>(objects))
+{
+    bounds.makeEmpty();
+    for (const auto& object : objects) {
+        bounds = bounds + object->getBoundingBox();
+    }
+}
+
+vec3 ObjectGroup::getNormal(const vec3& point) const
+{
+    for (const auto& object : objects) {
+        AABB box = object->getBoundingBox();
+        if (point[0] >= box.min[0] && point[1] >= box.min[1] && point[2] >= box.min[2] &&
+            point[0] <= box.max[0] && point[1] <= box.max[1] && point[2] <= box.max[2])
+            return object->getNormal(point);
+    }
+    return vec3(0, 0, 1);
+}
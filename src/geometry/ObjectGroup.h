@@ -0,0 +1,28 @@
+#ifndef __OBJECT_GROUP_H__
+#define __OBJECT_GROUP_H__
+
+#include <vector>
+#include <memory>
+#include "geometry/Object.h"
+#include "geometry/BVH.h"
+
+// a set of objects behind its own BVH, used as the shared bottom-level structure of instanced assets
+// that are not a single mesh. hits report the member object that was hit.
+class ObjectGroup : public Object {
+public:
+    explicit ObjectGroup(const std::vector<std::shared_ptr<Object>>& objects);
+
+    Hit intersect(const Ray& ray) const override { return bvh->intersect(ray); }
+    bool occluded(const Ray& ray, double t_max) const override { return bvh->occluded(ray, t_max); }
+    // hits name the member, so this is only reached without a hit: asks the member whose box holds the point
+    vec3 getNormal(const vec3& point) const override;
+    AABB getBoundingBox() const override { return bounds; }
+    int getNumberOfParts() const override { return static_cast<int>(objects.size()); }
+
+private:
+    std::vector<std::shared_ptr<Object>> objects;
+    std::unique_ptr<BVH> bvh;
+    AABB bounds;
+};
+
+#endif
@@ -0,0 +1,283 @@
+#include "geometry/PrimitiveStore.h"
+#include "geometry/Sphere.h"
+#include "geometry/Triangle.h"
+#include "core/Kernels.h"
+#include "utils/FloatRounding.h"
+#include <typeinfo>
+#include <limits>
+#include <cmath>
+
+
+template<class Real>
+static void resizeArrays(PrimitiveArrays<Real>& arrays, int sphere_count, int triangle_count) {
+    for (int a = 0; a < 3; ++a) {
+        arrays.sphere_center[a].resize(sphere_count);
+        for (int k = 0; k < 3; ++k) arrays.triangle_vertex[k][a].resize(triangle_count);
+    }
+    arrays.sphere_radius.resize(sphere_count);
+}
+
+
+template<class Real>
+static void loadSphere(PrimitiveArrays<Real>& arrays, int s, const Sphere& sphere) {
+    for (int a = 0; a < 3; ++a) arrays.sphere_center[a][s] = static_cast<Real>(sphere.getCenter()[a]);
+    arrays.sphere_radius[s] = static_cast<Real>(sphere.getRadius());
+}
+
+
+template<class Real>
+static void loadTriangle(PrimitiveArrays<Real>& arrays, int s, const Triangle& triangle) {
+    for (int a = 0; a < 3; ++a) {
+        arrays.triangle_vertex[0][a][s] = static_cast<Real>(triangle.v0[a]);
+        arrays.triangle_vertex[1][a][s] = static_cast<Real>(triangle.v1[a]);
+        arrays.triangle_vertex[2][a][s] = static_cast<Real>(triangle.v2[a]);
+    }
+}
+
+
+PrimitiveStore::PrimitiveStore(const std::vector<std::shared_ptr<Object>>& primitives, bool single_precision)
+    : objects(primitives), kinds(primitives.size()), slot(primitives.size()), single_precision(single_precision) {
+    int sphere_count = 0, triangle_count = 0;
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        kinds[i] = kindOf(*primitives[i]);
+        slot[i] = kinds[i] == PrimitiveKind::Sphere ? sphere_count++ : kinds[i] == PrimitiveKind::Triangle ? triangle_count++ : -1;
+    }
+    if (single_precision) resizeArrays(reduced, sphere_count, triangle_count);
+    else resizeArrays(exact, sphere_count, triangle_count);
+    for (int i = 0; i < static_cast<int>(primitives.size()); ++i) load(i);
+}
+
+
+PrimitiveKind PrimitiveStore::kindOf(const Object& object) {
+    if (typeid(object) == typeid(Sphere)) return PrimitiveKind::Sphere;
+    if (typeid(object) == typeid(Triangle)) return PrimitiveKind::Triangle;
+    return PrimitiveKind::Other;
+}
+
+
+void PrimitiveStore::load(int position) {
+    int s = slot[position];
+    if (kinds[position] == PrimitiveKind::Sphere) {
+        const Sphere& sphere = static_cast<const Sphere&>(*objects[position]);
+        if (single_precision) loadSphere(reduced, s, sphere);
+        else loadSphere(exact, s, sphere);
+    } else if (kinds[position] == PrimitiveKind::Triangle) {
+        const Triangle& triangle = static_cast<const Triangle&>(*objects[position]);
+        if (single_precision) loadTriangle(reduced, s, triangle);
+        else loadTriangle(exact, s, triangle);
+    }
+}
+
+
+void PrimitiveStore::update(const std::vector<std::shared_ptr<Object>>& primitives, int first, int count) {
+    // slots follow leaf order, so the range holds a contiguous block of slots of every kind starting at its
+    // smallest one. a permutation within the range keeps the kinds, the block is handed out again in order
+    int next_slot[2] = {std::numeric_limits<int>::max(), std::numeric_limits<int>::max()};
+    for (int i = first; i < first + count; ++i) {
+        if (kinds[i] != PrimitiveKind::Other) {
+            int& next = next_slot[static_cast<int>(kinds[i])];
+            next = std::min(next, slot[i]);
+        }
+    }
+    for (int i = first; i < first + count; ++i) {
+        objects[i] = primitives[i];
+        kinds[i] = kindOf(*objects[i]);
+        slot[i] = kinds[i] == PrimitiveKind::Other ? -1 : next_slot[static_cast<int>(kinds[i])]++;
+        load(i);
+    }
+}
+
+
+void PrimitiveStore::intersect(int first, int count, const Ray& ray, double& t_closest, Hit& closest_hit) const {
+    for (int i = first, end = first + count; i < end;) {
+        int run_end = runEnd(i, end);
+        switch (kinds[i]) {
+        case PrimitiveKind::Sphere:
+            intersectSpheres(i, run_end - i, ray, t_closest, closest_hit);
+            break;
+        case PrimitiveKind::Triangle:
+            intersectTriangles(i, run_end - i, ray, t_closest, closest_hit);
+            break;
+        default:
+            intersectObjects(i, run_end - i, ray, t_closest, closest_hit);
+        }
+        i = run_end;
+    }
+}
+
+
+bool PrimitiveStore::occluded(int first, int count, const Ray& ray, double t_max, const Object** occluder) const {
+    for (int i = first, end = first + count; i < end;) {
+        int run_end = runEnd(i, end);
+        int blocker = -1;
+        switch (kinds[i]) {
+        case PrimitiveKind::Sphere:
+            blocker = occludedSpheres(i, run_end - i, ray, t_max);
+            break;
+        case PrimitiveKind::Triangle:
+            blocker = occludedTriangles(i, run_end - i, ray, t_max);
+            break;
+        default:
+            blocker = occludedObjects(i, run_end - i, ray, t_max);
+        }
+        if (blocker >= 0) {
+            if (occluder) *occluder = objects[blocker].get();
+            return true;
+        }
+        i = run_end;
+    }
+    return false;
+}
+
+
+void PrimitiveStore::intersectObjects(int first, int count, const Ray& ray, double& t_closest, Hit& closest_hit) const {
+    for (int i = first; i < first + count; ++i) confirmHit(i, ray, t_closest, closest_hit);
+}
+
+
+int PrimitiveStore::occludedObjects(int first, int count, const Ray& ray, double t_max) const {
+    for (int i = first; i < first + count; ++i) {
+        if (objects[i]->occluded(ray, t_max)) return i;
+    }
+    return -1;
+}
+
+
+bool PrimitiveStore::confirmHit(int position, const Ray& ray, double& t_closest, Hit& closest_hit) const {
+    Hit hit = objects[position]->intersect(ray);
+    if (!hit.object || hit.t < small_t || hit.t >= t_closest) return false;
+    t_closest = hit.t;
+    closest_hit = hit;
+    return true;
+}
+
+
+void PrimitiveStore::intersectSpheres(int first, int count, const Ray& ray, double& t_closest, Hit& closest_hit) const {
+    if (!single_precision) {
+        int k = kernels().closest_sphere(exact.sphere_center, exact.sphere_radius, slot[first], count, ray, small_t, 0.0, small_t, t_closest);
+        if (k >= 0) closest_hit = Hit{objects[first + k].get(), t_closest, -1};
+        return;
+    }
+    float t = roundUp(t_closest) * float_far_padding;
+    int k = kernels().closest_sphere_float(reduced.sphere_center, reduced.sphere_radius, slot[first], count, ray, 0.0f, floatErrorBound(8), roundDown(small_t), t);
+    if (k >= 0 && !confirmHit(first + k, ray, t_closest, closest_hit)) intersectObjects(first, count, ray, t_closest, closest_hit);
+}
+
+
+int PrimitiveStore::occludedSpheres(int first, int count, const Ray& ray, double t_max) const {
+    if (!single_precision) {
+        int k = kernels().occluding_sphere(exact.sphere_center, exact.sphere_radius, slot[first], 0, count, ray, small_t, 0.0, small_t, t_max);
+        return k >= 0 ? first + k : -1;
+    }
+    float t_limit = roundUp(t_max) * float_far_padding;
+    const float slack = floatErrorBound(8);
+    const KernelTable& kernel = kernels();
+    for (int k = kernel.occluding_sphere_float(reduced.sphere_center, reduced.sphere_radius, slot[first], 0, count, ray, 0.0f, slack, roundDown(small_t), t_limit); k >= 0;
+         k = kernel.occluding_sphere_float(reduced.sphere_center, reduced.sphere_radius, slot[first], k + 1, count, ray, 0.0f, slack, roundDown(small_t), t_limit)) {
+        if (objects[first + k]->occluded(ray, t_max)) return first + k;
+    }
+    return -1;
+}
+
+
+template<class Real, int Width>
+void PrimitiveStore::gatherBlock(const PrimitiveArrays<Real>& arrays, int first_triangle, int lanes, TriangleBlock<Width, Real>& block) const {
+    for (int k = 0; k < 3; ++k)
+        for (int a = 0; a < 3; ++a)
+            for (int lane = 0; lane < lanes; ++lane) block.v[k][a][lane] = arrays.triangle_vertex[k][a][first_triangle + lane];
+}
+
+
+// double: whole blocks are copied straight from the SoA arrays and a shorter tail, not worth the padded lanes,
+// goes through the scalar kernel. single: twice as wide blocks, padded, and the candidate is re-tested in double
+void PrimitiveStore::intersectTriangles(int first, int count, const Ray& ray, double& t_closest, Hit& closest_hit) const {
+    WatertightRay watertight(ray);
+    int base = slot[first];
+    if (single_precision) {
+        float t = roundUp(t_closest) * float_far_padding;
+        int candidate = -1;
+        for (int offset = 0; offset < count; offset += float_block_width) {
+            TriangleBlock<float_block_width, float> block;
+            gatherBlock(reduced, base + offset, std::min(float_block_width, count - offset), block);
+            float b1, b2;
+            int lane = kernels().triangle_block_float(block, watertight, ray.origin, roundDown(small_t), t, b1, b2);
+            if (lane >= 0) candidate = offset + lane;
+        }
+        if (candidate >= 0 && !confirmHit(first + candidate, ray, t_closest, closest_hit)) {
+            intersectObjects(first, count, ray, t_closest, closest_hit);
+        }
+        return;
+    }
+
+    int hit_offset = -1;
+    double hit_b1 = 0.0, hit_b2 = 0.0;
+    int offset = 0;
+    for (; offset + block_width <= count; offset += block_width) {
+        TriangleBlock<block_width> block;
+        gatherBlock(exact, base + offset, block_width, block);
+        double b1, b2;
+        int lane = kernels().triangle_block(block, watertight, ray.origin, small_t, t_closest, b1, b2);
+        if (lane >= 0) {
+            hit_offset = offset + lane;
+            hit_b1 = b1;
+            hit_b2 = b2;
+        }
+    }
+    for (; offset < count; ++offset) {
+        int s = base + offset;
+        const auto& v = exact.triangle_vertex;
+        double t, b1, b2;
+        if (intersectTriangle(watertight, ray.origin, vec3(v[0][0][s], v[0][1][s], v[0][2][s]), vec3(v[1][0][s], v[1][1][s], v[1][2][s]),
+                              vec3(v[2][0][s], v[2][1][s], v[2][2][s]), small_t, t_closest, t, b1, b2)) {
+            t_closest = t;
+            hit_offset = offset;
+            hit_b1 = b1;
+            hit_b2 = b2;
+        }
+    }
+    if (hit_offset >= 0) {
+        closest_hit = Hit{objects[first + hit_offset].get(), t_closest, 0};
+        closest_hit.u = hit_b1;
+        closest_hit.v = hit_b2;
+    }
+}
+
+
+int PrimitiveStore::occludedTriangles(int first, int count, const Ray& ray, double t_max) const {
+    WatertightRay watertight(ray);
+    int base = slot[first];
+    if (single_precision) {
+        float t_limit = roundUp(t_max) * float_far_padding;
+        for (int offset = 0; offset < count; offset += float_block_width) {
+            int lanes = std::min(float_block_width, count - offset);
+            TriangleBlock<float_block_width, float> block;
+            gatherBlock(reduced, base + offset, lanes, block);
+            float t = t_limit, b1, b2;
+            int lane = kernels().triangle_block_float(block, watertight, ray.origin, roundDown(small_t), t, b1, b2);
+            if (lane < 0) continue;
+            if (objects[first + offset + lane]->occluded(ray, t_max)) return first + offset + lane;
+            int blocker = occludedObjects(first + offset, lanes, ray, t_max);
+            if (blocker >= 0) return blocker;
+        }
+        return -1;
+    }
+
+    int offset = 0;
+    for (; offset + block_width <= count; offset += block_width) {
+        TriangleBlock<block_width> block;
+        gatherBlock(exact, base + offset, block_width, block);
+        double t = t_max, b1, b2;
+        int lane = kernels().triangle_block(block, watertight, ray.origin, small_t, t, b1, b2);
+        if (lane >= 0) return first + offset + lane;
+    }
+    for (; offset < count; ++offset) {
+        int s = base + offset;
+        const auto& v = exact.triangle_vertex;
+        double t, b1, b2;
+        if (intersectTriangle(watertight, ray.origin, vec3(v[0][0][s], v[0][1][s], v[0][2][s]), vec3(v[1][0][s], v[1][1][s], v[1][2][s]),
+                              vec3(v[2][0][s], v[2][1][s], v[2][2][s]), small_t, t_max, t, b1, b2)) {
+            return first + offset;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,87 @@
+#ifndef __PRIMITIVE_STORE_H__
+#define __PRIMITIVE_STORE_H__
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "core/Ray.h"
+#include "geometry/Object.h"
+#include "geometry/Hit.h"
+#include "geometry/TriangleKernel.h"
+
+// shapes the store keeps its own copy of, everything else is tested through the virtual Object interface
+enum class PrimitiveKind : uint8_t {
+    Sphere,
+    Triangle,
+    Other
+};
+
+// per-kind SoA arrays of one precision
+template<class Real>
+struct PrimitiveArrays {
+    std::vector<Real> sphere_center[3]; // [axis][sphere]
+    std::vector<Real> sphere_radius;
+    std::vector<Real> triangle_vertex[3][3]; // [vertex][axis][triangle]
+};
+
+// the leaf primitives of an acceleration structure split by type into SoA arrays: sphere centers and radii,
+// triangle vertices. the owner groups every leaf's primitives by kind, so a leaf range is a few runs of one
+// kind and each run is tested by one non-virtual kernel over contiguous memory. the Object pointers are only
+// read to report a hit and for the Other kind, Object stays the authoring interface of the scene.
+// in single precision the arrays hold floats instead, and the closest float candidate of a run is
+// re-intersected through its Object so the reported hit is the double precision one
+class PrimitiveStore {
+public:
+    // primitives in leaf order, a leaf range [first, first + count) indexes them
+    PrimitiveStore(const std::vector<std::shared_ptr<Object>>& primitives, bool single_precision = false);
+
+    // exact type only, a subclass may override intersect() and is left to the virtual call
+    static PrimitiveKind kindOf(const Object& object);
+
+    // re-read the primitives at [first, first + count) after they moved or were permuted within the range
+    void update(const std::vector<std::shared_ptr<Object>>& primitives, int first, int count);
+
+    // closest hit of the range, lowers t_closest and updates closest_hit on a closer hit
+    void intersect(int first, int count, const Ray& ray, double& t_closest, Hit& closest_hit) const;
+    // any hit of the range in [small_t, t_max), the blocking primitive is written to occluder when requested
+    bool occluded(int first, int count, const Ray& ray, double t_max, const Object** occluder) const;
+
+    // triangles one run of the block kernel tests: as in TriangleMesh, and twice as many floats
+    static constexpr int block_width = 4;
+    static constexpr int float_block_width = 8;
+
+private:
+    std::vector<std::shared_ptr<Object>> objects; // leaf order
+    std::vector<PrimitiveKind> kinds;             // per leaf position
+    // per leaf position, index into the arrays of its kind. assigned in leaf order, so a run of one
+    // kind in a leaf is also a contiguous run of its arrays
+    std::vector<int> slot;
+    bool single_precision;
+    PrimitiveArrays<double> exact;  // filled in double precision mode
+    PrimitiveArrays<float> reduced; // filled in single precision mode
+
+    void load(int position);
+    void intersectSpheres(int first, int count, const Ray& ray, double& t_closest, Hit& closest_hit) const;
+    void intersectTriangles(int first, int count, const Ray& ray, double& t_closest, Hit& closest_hit) const;
+    // position of a blocking primitive of the run, -1 if none
+    int occludedSpheres(int first, int count, const Ray& ray, double t_max) const;
+    int occludedTriangles(int first, int count, const Ray& ray, double t_max) const;
+    // single precision: the double test of a float candidate, and the virtual calls over the whole run for
+    // the rare candidate the double test rejects
+    bool confirmHit(int position, const Ray& ray, double& t_closest, Hit& closest_hit) const;
+    void intersectObjects(int first, int count, const Ray& ray, double& t_closest, Hit& closest_hit) const;
+    int occludedObjects(int first, int count, const Ray& ray, double t_max) const;
+
+    template<class Real, int Width>
+    void gatherBlock(const PrimitiveArrays<Real>& arrays, int first_triangle, int lanes, TriangleBlock<Width, Real>& block) const;
+
+    // end of the run of one kind starting at first, at most end
+    int runEnd(int first, int end) const
+    {
+        int run_end = first + 1;
+        while (run_end < end && kinds[run_end] == kinds[first]) ++run_end;
+        return run_end;
+    }
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "geometry/BVH.h"
+#include <algorithm>
+#include <limits>
+
+
+// spatial split BVH (Stich et al.): besides partitioning objects, a node may cut space at a plane and reference
+// an object from both children, each clipped to its side. that keeps huge floor and wall triangles from
+// inflating every box they pass through. the build is serial and works on per-node reference lists because
+// a spatial split makes the children hold more references than their parent
+void BVH::buildSBVH(const std::vector<std::shared_ptr<Object>>& objects, std::vector<BuildPrimitive>& prims, int budget) {
+    AABB bbox, centroid_bounds;
+    computeBounds(prims, 0, static_cast<int>(prims.size()), bbox, centroid_bounds);
+    double min_overlap = settings.spatial_split_overlap * bbox.surfaceArea();
+
+    std::vector<BuildPrimitive> leaf_refs;
+    leaf_refs.reserve(prims.size() + budget);
+    buildSpatial(objects, prims, 0, 0, min_overlap, budget, leaf_refs);
+    prims.swap(leaf_refs);
+}
+
+
+void BVH::buildSpatial(const std::vector<std::shared_ptr<Object>>& objects, std::vector<BuildPrimitive>& refs, int node_index, int depth,
+                       double min_overlap, int& budget, std::vector<BuildPrimitive>& leaf_refs) {
+    int count = static_cast<int>(refs.size());
+    AABB bbox, centroid_bounds;
+    computeBounds(refs, 0, count, bbox, centroid_bounds);
+
+    int axis = 0;
+    double object_cost = std::numeric_limits<double>::max();
+    bool make_leaf = count == 1 || depth >= max_depth - 1;
+    int mid = make_leaf ? 0 : partitionSAH(refs, 0, count, bbox, centroid_bounds, axis, make_leaf, &object_cost);
+
+    std::vector<BuildPrimitive> left, right;
+    if (!make_leaf && budget > 0) {
+        // only nodes whose object split children overlap noticeably are worth the spatial search
+        AABB left_box, right_box, unused;
+        computeBounds(refs, 0, mid, left_box, unused);
+        computeBounds(refs, mid, count, right_box, unused);
+        AABB overlap = left_box.intersection(right_box);
+        int spatial_axis;
+        double position;
+        if (!overlap.isEmpty() && overlap.surfaceArea() > min_overlap &&
+            findSpatialSplit(objects, refs, bbox, spatial_axis, position) < object_cost) {
+            splitReferences(objects, refs, spatial_axis, position, budget, left, right);
+            axis = spatial_axis;
+        }
+    }
+
+    BVHNode& node = nodes[node_index];
+    node.bbox = bbox;
+    node.axis = axis;
+    if (make_leaf) {
+        node.first = static_cast<int>(leaf_refs.size());
+        node.count = count;
+        leaf_refs.insert(leaf_refs.end(), refs.begin(), refs.end());
+        return;
+    }
+    if (left.empty()) {
+        left.assign(refs.begin(), refs.begin() + mid);
+        right.assign(refs.begin() + mid, refs.end());
+    }
+    // the parent's list is not needed once the children have theirs, release it before descending
+    std::vector<BuildPrimitive>().swap(refs);
+
+    int left_index = next_node.fetch_add(2);
+    node.first = left_index;
+    node.count = 0;
+    nodes[left_index].parent = node_index;
+    nodes[left_index + 1].parent = node_index;
+    buildSpatial(objects, left, left_index, depth + 1, min_overlap, budget, leaf_refs);
+    buildSpatial(objects, right, left_index + 1, depth + 1, min_overlap, budget, leaf_refs);
+}
+
+
+// bin the references into equal slabs of the node box along each axis, clipping every reference to each slab
+// it crosses. a reference enters the leftmost and exits the rightmost of its slabs, so the sweep counts it on
+// both sides of every plane it straddles. returns the cost of the best plane in the units of partitionSAH
+double BVH::findSpatialSplit(const std::vector<std::shared_ptr<Object>>& objects, const std::vector<BuildPrimitive>& refs,
+                             const AABB& bbox, int& split_axis, double& split_position) const {
+    int bin_count = std::max(2, settings.bin_count);
+    std::vector<AABB> bin_bounds(bin_count);
+    std::vector<int> enter(bin_count), exit(bin_count);
+    std::vector<double> right_area(bin_count);
+    std::vector<int> right_count(bin_count);
+    double best_cost = std::numeric_limits<double>::max();
+
+    for (int axis = 0; axis < 3; ++axis) {
+        double axis_min = bbox.min[axis];
+        double width = (bbox.max[axis] - axis_min) / bin_count;
+        if (width <= 0.0) continue;
+        for (int b = 0; b < bin_count; ++b) {
+            bin_bounds[b].makeEmpty();
+            enter[b] = 0;
+            exit[b] = 0;
+        }
+        auto binOf = [&](double x) { return std::min(bin_count - 1, std::max(0, static_cast<int>((x - axis_min) / width))); };
+
+        for (const BuildPrimitive& ref : refs) {
+            int first_bin = binOf(ref.bbox.min[axis]);
+            int last_bin = binOf(ref.bbox.max[axis]);
+            ++enter[first_bin];
+            ++exit[last_bin];
+            if (first_bin == last_bin) {
+                bin_bounds[first_bin] = bin_bounds[first_bin] + ref.bbox;
+                continue;
+            }
+            for (int b = first_bin; b <= last_bin; ++b) {
+                AABB slab = ref.bbox;
+                slab.min[axis] = std::max(slab.min[axis], axis_min + b * width);
+                slab.max[axis] = std::min(slab.max[axis], b == bin_count - 1 ? bbox.max[axis] : axis_min + (b + 1) * width);
+                AABB piece = objects[ref.index]->getClippedBoundingBox(slab);
+                if (!piece.isEmpty()) bin_bounds[b] = bin_bounds[b] + piece;
+            }
+        }
+
+        AABB accum;
+        accum.makeEmpty();
+        int accum_count = 0;
+        for (int b = bin_count - 1; b > 0; --b) {
+            accum = accum + bin_bounds[b];
+            accum_count += exit[b];
+            right_area[b] = accum.surfaceArea();
+            right_count[b] = accum_count;
+        }
+        accum.makeEmpty();
+        accum_count = 0;
+        for (int b = 0; b < bin_count - 1; ++b) {
+            accum = accum + bin_bounds[b];
+            accum_count += enter[b];
+            if (accum_count == 0 || right_count[b + 1] == 0) continue;
+            double cost = accum.surfaceArea() * accum_count + right_area[b + 1] * right_count[b + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                split_axis = axis;
+                split_position = axis_min + (b + 1) * width;
+            }
+        }
+    }
+    return best_cost;
+}
+
+
+// distribute refs to the two sides of the plane. a straddling reference is clipped into both children unless
+// keeping it whole on one side is cheaper (reference unsplitting) or the duplication budget is used up
+void BVH::splitReferences(const std::vector<std::shared_ptr<Object>>& objects, std::vector<BuildPrimitive>& refs, int axis, double position,
+                          int& budget, std::vector<BuildPrimitive>& left, std::vector<BuildPrimitive>& right) const {
+    struct Straddler {
+        int ref;
+        AABB left_piece, right_piece;
+    };
+    std::vector<Straddler> straddlers;
+    AABB left_box, right_box;
+    left_box.makeEmpty();
+    right_box.makeEmpty();
+    for (int i = 0; i < static_cast<int>(refs.size()); ++i) {
+        const BuildPrimitive& ref = refs[i];
+        if (ref.bbox.max[axis] <= position) {
+            left.push_back(ref);
+            left_box = left_box + ref.bbox;
+        } else if (ref.bbox.min[axis] >= position) {
+            right.push_back(ref);
+            right_box = right_box + ref.bbox;
+        } else {
+            Straddler straddler{i, ref.bbox, ref.bbox};
+            straddler.left_piece.max[axis] = position;
+            straddler.right_piece.min[axis] = position;
+            straddler.left_piece = objects[ref.index]->getClippedBoundingBox(straddler.left_piece);
+            straddler.right_piece = objects[ref.index]->getClippedBoundingBox(straddler.right_piece);
+            if (!straddler.left_piece.isEmpty()) left_box = left_box + straddler.left_piece;
+            if (!straddler.right_piece.isEmpty()) right_box = right_box + straddler.right_piece;
+            straddlers.push_back(straddler);
+        }
+    }
+
+    int left_count = static_cast<int>(left.size() + straddlers.size());
+    int right_count = static_cast<int>(right.size() + straddlers.size());
+    for (const Straddler& straddler : straddlers) {
+        const BuildPrimitive& ref = refs[straddler.ref];
+        double left_area = left_box.surfaceArea(), right_area = right_box.surfaceArea();
+        double split_cost = left_area * left_count + right_area * right_count;
+        double keep_left = (left_box + ref.bbox).surfaceArea() * left_count + right_area * (right_count - 1);
+        double keep_right = left_area * (left_count - 1) + (right_box + ref.bbox).surfaceArea() * right_count;
+        bool split = budget > 0 && !straddler.left_piece.isEmpty() && !straddler.right_piece.isEmpty() &&
+                     split_cost < std::min(keep_left, keep_right);
+        if (split) {
+            BuildPrimitive piece = ref;
+            piece.bbox = straddler.left_piece;
+            piece.centroid = piece.bbox.center();
+            left.push_back(piece);
+            piece.bbox = straddler.right_piece;
+            piece.centroid = piece.bbox.center();
+            right.push_back(piece);
+            --budget;
+        } else if (straddler.right_piece.isEmpty() || (!straddler.left_piece.isEmpty() && keep_left <= keep_right)) {
+            left.push_back(ref);
+            left_box = left_box + ref.bbox;
+            --right_count;
+        } else {
+            right.push_back(ref);
+            right_box = right_box + ref.bbox;
+            --left_count;
+        }
+    }
+
+    // everything ended up on one side, fall back to halving the list so the recursion still makes progress
+    if (left.empty() || right.empty()) {
+        std::vector<BuildPrimitive>& all = left.empty() ? right : left;
+        int half = static_cast<int>(all.size()) / 2;
+        std::nth_element(all.begin(), all.begin() + half, all.end(),
+            [axis](const BuildPrimitive& a, const BuildPrimitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+        (left.empty() ? left : right).assign(all.begin() + half, all.end());
+        all.resize(half);
+    }
+}
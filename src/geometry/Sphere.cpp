@@ -24,6 +24,21 @@ Hit Sphere::intersect(const Ray &ray) const {
     return { this, t, -1 }; // return hit with this object and t
 }
 
+// shadow ray test, only needs to know whether either root lies in [small_t, t_max)
+bool Sphere::occluded(const Ray &ray, double t_max) const {
+    vec3 oc = ray.origin - center;
+    double b = dot(oc, ray.direction); // direction is unit length, so a = 1 and the half-b form applies
+    double c = dot(oc, oc) - radius * radius;
+    double discriminant = b * b - c;
+    // the grazing threshold of intersect, whose discriminant is four times this one
+    if (4 * discriminant < small_t) return false;
+
+    double root = std::sqrt(discriminant);
+    double t1 = -b - root;
+    double t2 = -b + root;
+    return (t1 >= small_t && t1 < t_max) || (t1 < small_t && t2 >= small_t && t2 < t_max);
+}
+
 // calculate the normal at the point of intersection
 vec3 Sphere::getNormal(const vec3 &point) const {
     return (point - center).normalized(); // normal is the direction from center to point
@@ -13,8 +13,11 @@ public:
     Sphere(const vec3 &center_input, double radius_input)
         : center(center_input), radius(radius_input) {}
     virtual Hit intersect(const Ray &ray) const override;
+    virtual bool occluded(const Ray &ray, double t_max) const override;
     virtual vec3 getNormal(const vec3 &point) const override;
     virtual int getNumberOfParts() const override { return 1; } // Sphere is a single part
     virtual AABB getBoundingBox() const override;
+    const vec3& getCenter() const { return center; }
+    double getRadius() const { return radius; }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+#include "SphereCloud.h"
+#include "core/Kernels.h"
+#include <iostream>
+#include <limits>
+
+SphereCloud::SphereCloud(const std::vector<vec3>& centers, const std::vector<double>& radii, const std::vector<std::shared_ptr<Material>>& materials,
+                         const std::vector<uint32_t>& material_ids)
+    : materials(materials)
+{
+    material_shader = materials.empty() ? nullptr : materials[0];
+    int sphere_count = static_cast<int>(centers.size());
+
+    std::vector<AABB> sphere_bounds(sphere_count);
+    bounds.makeEmpty();
+    for (int s = 0; s < sphere_count; s++) {
+        sphere_bounds[s].min = centers[s] - vec3(radii[s]);
+        sphere_bounds[s].max = centers[s] + vec3(radii[s]);
+        bounds = bounds + sphere_bounds[s];
+    }
+
+    // a leaf's spheres go through one loop of the kernel, so a sphere costs a fraction of a node visit
+    BVHBuildSettings settings;
+    settings.max_leaf_size = leaf_size;
+    settings.intersection_cost = 1.0 / 4;
+    std::vector<int> leaf_order;
+    bvh = std::make_unique<BVH>(sphere_bounds, leaf_order, settings);
+
+    // store the spheres in leaf order, a leaf then addresses its spheres directly
+    for (int a = 0; a < 3; a++) center[a].resize(sphere_count);
+    radius.resize(sphere_count);
+    if (!material_ids.empty()) material_id.resize(sphere_count);
+    for (int s = 0; s < sphere_count; s++) {
+        int source = leaf_order[s];
+        for (int a = 0; a < 3; a++) center[a][s] = centers[source][a];
+        radius[s] = radii[source];
+        if (!material_ids.empty()) material_id[s] = material_ids[source];
+    }
+
+    std::cout << "Sphere cloud: " << sphere_count << " spheres, " << materials.size() << " materials, "
+              << (sphere_count > 0 ? getMemoryUsage() / sphere_count : 0) << " bytes per sphere" << std::endl;
+}
+
+size_t SphereCloud::getMemoryUsage() const
+{
+    return 3 * center[0].capacity() * sizeof(double) + radius.capacity() * sizeof(double) + material_id.capacity() * sizeof(uint32_t)
+         + bvh->getNodes().capacity() * sizeof(BVHNode);
+}
+
+AABB SphereCloud::getBoundingBox() const
+{
+    return bounds;
+}
+
+const Material* SphereCloud::getMaterial(const Hit& hit) const
+{
+    if (material_id.empty() || hit.part < 0) return material_shader.get();
+    return materials[material_id[hit.part]].get();
+}
+
+vec3 SphereCloud::getNormal(const vec3& point) const
+{
+    int best_sphere = 0;
+    double best_distance = std::numeric_limits<double>::max();
+    for (int s = 0; s < getSphereCount(); s++) {
+        double distance = std::abs((point - getCenter(s)).magnitude() - radius[s]);
+        if (distance < best_distance) {
+            best_distance = distance;
+            best_sphere = s;
+        }
+    }
+    return getSphereCount() > 0 ? (point - getCenter(best_sphere)).normalized() : vec3();
+}
+
+vec3 SphereCloud::getNormal(const vec3& point, const Hit& hit) const
+{
+    if (hit.object != this || hit.part < 0) return getNormal(point);
+    return (point - getCenter(hit.part)).normalized();
+}
+
+Hit SphereCloud::intersect(const Ray& ray) const
+{
+    Hit closest_hit{nullptr, 0, 0};
+    double t_max = std::numeric_limits<double>::max();
+    bvh->traverse(ray, t_max, [&](int first, int count, double& t_closest) {
+        int k = kernels().closest_sphere(center, radius, first, count, ray, small_t, 0.0, small_t, t_closest);
+        if (k >= 0) closest_hit = Hit{this, t_closest, first + k};
+        return false;
+    });
+    return closest_hit;
+}
+
+bool SphereCloud::occluded(const Ray& ray, double t_max) const
+{
+    bool blocked = false;
+    bvh->traverse(ray, t_max, [&](int first, int count, double& t_limit) {
+        blocked = kernels().occluding_sphere(center, radius, first, 0, count, ray, small_t, 0.0, small_t, t_limit) >= 0;
+        return blocked;
+    });
+    return blocked;
+}
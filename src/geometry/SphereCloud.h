@@ -0,0 +1,44 @@
+#ifndef __SPHERE_CLOUD_H__
+#define __SPHERE_CLOUD_H__
+
+#include "Object.h"
+#include "../core/Vec.h"
+#include "BVH.h"
+#include <vector>
+#include <cstdint>
+
+// many small spheres as one object, for particles and point clouds: centers and radii in SoA arrays and a
+// material index per sphere instead of a heap Sphere and a Material pointer each. the BVH is built over the
+// spheres and the arrays are reordered to match its leaves, so a leaf tests the spheres [first, first + count)
+// in one run of the sphere kernel and a hit reports its sphere in Hit::part.
+class SphereCloud : public Object {
+    public:
+        // material_ids[i] picks the material of sphere i, all spheres use materials[0] when it is empty
+        SphereCloud(const std::vector<vec3>& centers, const std::vector<double>& radii, const std::vector<std::shared_ptr<Material>>& materials,
+                    const std::vector<uint32_t>& material_ids = std::vector<uint32_t>());
+        Hit intersect(const Ray& ray) const override;
+        bool occluded(const Ray& ray, double t_max) const override;
+        // without a hit the sphere is unknown, this searches for the sphere closest to the point
+        vec3 getNormal(const vec3& point) const override;
+        vec3 getNormal(const vec3& point, const Hit& hit) const override;
+        AABB getBoundingBox() const override;
+        int getNumberOfParts() const override { return getSphereCount(); }
+        const Material* getMaterial(const Hit& hit) const override;
+
+        int getSphereCount() const { return static_cast<int>(radius.size()); }
+        vec3 getCenter(int sphere) const { return vec3(center[0][sphere], center[1][sphere], center[2][sphere]); }
+        // bytes held by the sphere arrays and the BVH
+        size_t getMemoryUsage() const;
+
+        // spheres per leaf, tested together
+        static constexpr int leaf_size = 8;
+
+    private:
+        std::vector<double> center[3]; // [axis][sphere], leaf order
+        std::vector<double> radius;
+        std::vector<uint32_t> material_id; // empty when every sphere uses materials[0]
+        std::vector<std::shared_ptr<Material>> materials;
+        AABB bounds;
+        std::unique_ptr<BVH> bvh;
+};
+#endif
@@ -0,0 +1,73 @@
+#ifndef __SPHERE_KERNEL_H__
+#define __SPHERE_KERNEL_H__
+
+#include <cmath>
+#include <vector>
+#include "core/Vec.h"
+#include "core/Ray.h"
+#include "utils/CpuFeatures.h"
+
+// sphere tests over SoA arrays: centers [axis][sphere] and radii, a run of count spheres starting at first_slot.
+// every sphere runs the same arithmetic so the loops map onto SIMD lanes. PrimitiveStore and SphereCloud call
+// them through kernels() (core/Kernels.h), compiled for each instruction set level
+
+// closest sphere of the run with t in [t_min, t_closest), lowers t_closest. in double (slack 0) this is the
+// arithmetic of Sphere::intersect, so both report identical hits. a float search passes the rounding error
+// bound as slack and accepts grazing rays whose discriminant only rounded below the threshold
+template<class Real>
+SIMD_INLINE int closestSphere(const std::vector<Real> (&center)[3], const std::vector<Real>& radii, int first_slot, int count, const Ray& ray,
+                              Real discriminant_min, Real slack, Real t_min, Real& t_closest) {
+    const Real* cx = &center[0][first_slot];
+    const Real* cy = &center[1][first_slot];
+    const Real* cz = &center[2][first_slot];
+    const Real* radius = &radii[first_slot];
+    const Real o[3] = {static_cast<Real>(ray.origin[0]), static_cast<Real>(ray.origin[1]), static_cast<Real>(ray.origin[2])};
+    const Real d[3] = {static_cast<Real>(ray.direction[0]), static_cast<Real>(ray.direction[1]), static_cast<Real>(ray.direction[2])};
+    Real a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+
+    int closest = -1;
+    for (int k = 0; k < count; ++k) {
+        Real ox = o[0] - cx[k], oy = o[1] - cy[k], oz = o[2] - cz[k];
+        Real b = 2 * (ox * d[0] + oy * d[1] + oz * d[2]);
+        Real c = (ox * ox + oy * oy + oz * oz) - radius[k] * radius[k];
+        Real discriminant = b * b - 4 * a * c;
+        bool crosses = discriminant >= (slack > 0 ? discriminant_min - slack * (b * b + std::abs(4 * a * c)) : discriminant_min);
+        Real root = std::sqrt(discriminant >= discriminant_min ? discriminant : 0);
+        Real t1 = (-b - root) / (2 * a);
+        Real t2 = (-b + root) / (2 * a);
+        Real t = t1 < t_min ? t2 : t1;
+        if (crosses && t >= t_min && t < t_closest) {
+            t_closest = t;
+            closest = k;
+        }
+    }
+    return closest;
+}
+
+
+// first sphere from offset on with a root in [t_min, t_max), the test of Sphere::occluded. discriminant_min
+// applies to the full form b * b - 4 * a * c like in closestSphere, so both reject the same grazing rays. slack as above
+template<class Real>
+SIMD_INLINE int firstOccludingSphere(const std::vector<Real> (&center)[3], const std::vector<Real>& radii, int first_slot, int offset, int count,
+                                     const Ray& ray, Real discriminant_min, Real slack, Real t_min, Real t_max) {
+    const Real* cx = &center[0][first_slot];
+    const Real* cy = &center[1][first_slot];
+    const Real* cz = &center[2][first_slot];
+    const Real* radius = &radii[first_slot];
+    const Real o[3] = {static_cast<Real>(ray.origin[0]), static_cast<Real>(ray.origin[1]), static_cast<Real>(ray.origin[2])};
+    const Real d[3] = {static_cast<Real>(ray.direction[0]), static_cast<Real>(ray.direction[1]), static_cast<Real>(ray.direction[2])};
+    for (int k = offset; k < count; ++k) {
+        Real ox = o[0] - cx[k], oy = o[1] - cy[k], oz = o[2] - cz[k];
+        Real b = ox * d[0] + oy * d[1] + oz * d[2];
+        Real c = (ox * ox + oy * oy + oz * oz) - radius[k] * radius[k];
+        Real discriminant = b * b - c;
+        if (4 * discriminant < (slack > 0 ? discriminant_min - 4 * slack * (b * b + std::abs(c)) : discriminant_min)) continue;
+        Real root = std::sqrt(discriminant > 0 ? discriminant : 0);
+        Real t1 = -b - root;
+        Real t2 = -b + root;
+        if ((t1 >= t_min && t1 < t_max) || (t1 < t_min && t2 >= t_min && t2 < t_max)) return k;
+    }
+    return -1;
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef __SURFACE_INTERACTION_H__
+#define __SURFACE_INTERACTION_H__
+
+#include "core/Ray.h"
+#include "geometry/Hit.h"
+
+// what shading needs to know about the closest hit of a ray. traversal only ever produces the small Hit
+// record, this is built from the final one and computes each field the first time it is asked for, then
+// keeps it. a path that stops at the material never pays for the normals.
+// the ray must outlive the interaction
+class SurfaceInteraction {
+public:
+    SurfaceInteraction(const Ray& ray, const Hit& hit) : ray(ray), hit(hit) {}
+
+    bool isHit() const { return hit.object != nullptr; }
+    const Hit& getHit() const { return hit; }
+    const Ray& getRay() const { return ray; }
+    double getT() const { return hit.t; }
+    int getPrimitive() const { return hit.part; } // face of a mesh or sphere of a cloud, -1 when the object has no parts
+    vec2 getBarycentrics() const { return vec2(hit.u, hit.v); }
+    // objects share materials by pointer, so the pointer doubles as the material id
+    const Material* getMaterial() const { return hit.object->getMaterial(hit); }
+
+    const vec3& getPosition() const
+    {
+        if (!(computed & position_bit)) {
+            position = ray.origin + hit.t * ray.direction;
+            computed |= position_bit;
+        }
+        return position;
+    }
+
+    // interpolated vertex normal where the object has one, what lighting uses
+    const vec3& getShadingNormal() const
+    {
+        if (!(computed & shading_normal_bit)) {
+            shading_normal = hit.getNormal(getPosition());
+            computed |= shading_normal_bit;
+        }
+        return shading_normal;
+    }
+
+    // normal of the actual surface, e.g. the face normal of a mesh triangle
+    const vec3& getGeometricNormal() const
+    {
+        if (!(computed & geometric_normal_bit)) {
+            geometric_normal = hit.getGeometricNormal(getPosition());
+            computed |= geometric_normal_bit;
+        }
+        return geometric_normal;
+    }
+
+    // unit vector from the hit back towards the ray origin
+    const vec3& getViewDirection() const
+    {
+        if (!(computed & view_direction_bit)) {
+            view_direction = -ray.direction;
+            computed |= view_direction_bit;
+        }
+        return view_direction;
+    }
+
+private:
+    enum : unsigned { position_bit = 1, shading_normal_bit = 2, geometric_normal_bit = 4, view_direction_bit = 8 };
+
+    const Ray& ray;
+    Hit hit;
+    mutable unsigned computed = 0; // bits of the fields below that hold a value
+    mutable vec3 position, shading_normal, geometric_normal, view_direction;
+};
+
+#endif
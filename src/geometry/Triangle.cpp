@@ -1,4 +1,6 @@
 #include "Triangle.h"
+#include "TriangleKernel.h"
+#include <algorithm>
 
 Triangle::Triangle(const vec3& vertex0, const vec3& vertex1, const vec3& vertex2, std::shared_ptr<Material> material) : v0(vertex0), v1(vertex1), v2(vertex2) 
 {
@@ -17,46 +19,25 @@ vec3 Triangle::getNormal(const vec3& point) const
 }
 
 Hit Triangle::intersect(const Ray& ray) const {
-    Hit hit;
-    hit.t = std::numeric_limits<double>::infinity();
-    hit.object = nullptr;
-    hit.part = -1; 
-    
-    // get our triangle vertices
-    vec3 a = v0;
-    vec3 b = v1;
-    vec3 c = v2;
-    
-    const double smallT = 1e-8;
-    static const double weightTolerance = 1e-4;
-    
-    vec3 l = ray.origin;
-    vec3 d = ray.direction;
-    double intersectionTop = dot(a - l, normal);
-    double intersectionBottom = dot(d, normal);
-    
-    if (std::abs(intersectionBottom) > smallT) {
-        double intersection = intersectionTop / intersectionBottom;
-        if (intersection > smallT) {
-            vec3 intersectionP = ray.origin + intersection * ray.direction;
-            
-            // Bary coords check
-            double baryArea = cross(b - a, c - a).magnitude();
-            double baryAlpha = (cross(b - intersectionP, c - b).magnitude()) / baryArea;
-            double baryBeta = (cross(c - intersectionP, a - c).magnitude()) / baryArea;
-            double baryGamma = (cross(a - intersectionP, b - a).magnitude()) / baryArea;
-            
-            if ((baryAlpha > -weightTolerance && baryAlpha < 1+weightTolerance && baryBeta > -weightTolerance && baryBeta < 1+weightTolerance && baryGamma > -weightTolerance && baryGamma < 1+weightTolerance) && ((baryAlpha + baryBeta + baryGamma) < 1 + weightTolerance)) {
-                hit.t = intersection;
-                hit.object = this;
-                hit.part = 0;
-                return hit;
-            }
-        }
+    Hit hit{nullptr, std::numeric_limits<double>::infinity(), -1};
+
+    // watertight test, rays through a shared edge always hit one of the two triangles
+    double t, b1, b2;
+    if (intersectTriangle(WatertightRay(ray), ray.origin, v0, v1, v2, small_t, std::numeric_limits<double>::infinity(), t, b1, b2)) {
+        hit.t = t;
+        hit.object = this;
+        hit.part = 0;
+        hit.u = b1;
+        hit.v = b2;
     }
     return hit;
 }
 
+bool Triangle::occluded(const Ray& ray, double t_max) const {
+    double t, b1, b2;
+    return intersectTriangle(WatertightRay(ray), ray.origin, v0, v1, v2, small_t, t_max, t, b1, b2);
+}
+
 AABB Triangle::getBoundingBox() const {
     AABB box;
     box.makeEmpty();
@@ -68,4 +49,40 @@ AABB Triangle::getBoundingBox() const {
     box.max += vec3(small_t);
     
     return box;
-}
\ No newline at end of file
+}
+// clip the triangle against the six planes of box (Sutherland-Hodgman) and bound what is left
+AABB Triangle::getClippedBoundingBox(const AABB& box) const {
+    // every plane can add at most one vertex to the polygon
+    vec3 polygon[9] = {v0, v1, v2};
+    vec3 clipped[9];
+    int count = 3;
+    for (int axis = 0; axis < 3 && count > 0; ++axis) {
+        for (int side = 0; side < 2 && count > 0; ++side) {
+            double plane = side ? box.max[axis] : box.min[axis];
+            auto inside = [&](const vec3& p) { return side ? p[axis] <= plane : p[axis] >= plane; };
+            int clipped_count = 0;
+            for (int i = 0; i < count; ++i) {
+                const vec3& a = polygon[i];
+                const vec3& b = polygon[(i + 1) % count];
+                if (inside(a)) clipped[clipped_count++] = a;
+                if (inside(a) != inside(b)) {
+                    vec3 p = a + (plane - a[axis]) / (b[axis] - a[axis]) * (b - a);
+                    p[axis] = plane;
+                    clipped[clipped_count++] = p;
+                }
+            }
+            std::copy(clipped, clipped + clipped_count, polygon);
+            count = clipped_count;
+        }
+    }
+
+    AABB result;
+    result.makeEmpty();
+    for (int i = 0; i < count; ++i) result = result + polygon[i];
+    if (count == 0) return result;
+    // padded like getBoundingBox, pieces meeting at a split plane overlap a little instead of just touching
+    result = result.intersection(box);
+    result.min -= vec3(small_t);
+    result.max += vec3(small_t);
+    return result;
+}
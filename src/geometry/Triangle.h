@@ -15,8 +15,11 @@ public:
     Triangle(const vec3 &vertex0, const vec3 &vertex1, const vec3 &vertex2, std::shared_ptr<Material> material);
 
     Hit intersect(const Ray &ray) const override;
+    bool occluded(const Ray &ray, double t_max) const override;
     vec3 getNormal(const vec3 &point) const override;
     AABB getBoundingBox() const override;
+    // bounds of the triangle clipped to box, so a large triangle split across nodes only widens each node by its own piece
+    AABB getClippedBoundingBox(const AABB &box) const override;
 
     virtual int getNumberOfParts() const override { return 1; }
 
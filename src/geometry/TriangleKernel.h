@@ -0,0 +1,140 @@
+#ifndef __TRIANGLE_KERNEL_H__
+#define __TRIANGLE_KERNEL_H__
+
+#include <cmath>
+#include <limits>
+#include <utility>
+#include "core/Vec.h"
+#include "core/Ray.h"
+#include "utils/CpuFeatures.h"
+
+// Watertight ray/triangle intersection (Woop, Benthin, Wald 2013). The vertices are translated to the
+// ray origin and sheared so the ray runs along +z, then three 2D edge functions decide the hit. Two
+// triangles sharing an edge evaluate the exact same edge function on it, so no ray slips between them.
+// Returned barycentrics follow the usual convention: b1 weights v1, b2 weights v2.
+
+// per-ray axis permutation and shear, derived from the reciprocal direction the ray already caches
+struct WatertightRay {
+    int kx, ky, kz; // kz is the dominant axis of the direction
+    double sx, sy, sz;
+
+    explicit WatertightRay(const Ray& ray)
+    {
+        kz = 0;
+        if (std::abs(ray.direction[1]) > std::abs(ray.direction[kz])) kz = 1;
+        if (std::abs(ray.direction[2]) > std::abs(ray.direction[kz])) kz = 2;
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        if (ray.direction[kz] < 0.0) std::swap(kx, ky); // keep the winding of the triangles
+        sz = ray.inv_direction[kz];
+        sx = ray.direction[kx] * sz;
+        sy = ray.direction[ky] * sz;
+    }
+};
+
+// scalar kernel, true for a hit with t in [t_min, t_max)
+inline bool intersectTriangle(const WatertightRay& wr, const vec3& origin,
+    const vec3& p0, const vec3& p1, const vec3& p2,
+    double t_min, double t_max, double& t, double& b1, double& b2)
+{
+    vec3 a = p0 - origin, b = p1 - origin, c = p2 - origin;
+    double ax = a[wr.kx] - wr.sx * a[wr.kz], ay = a[wr.ky] - wr.sy * a[wr.kz];
+    double bx = b[wr.kx] - wr.sx * b[wr.kz], by = b[wr.ky] - wr.sy * b[wr.kz];
+    double cx = c[wr.kx] - wr.sx * c[wr.kz], cy = c[wr.ky] - wr.sy * c[wr.kz];
+
+    // edge functions, all of one sign when the ray passes inside
+    double u = cx * by - cy * bx;
+    double v = ax * cy - ay * cx;
+    double w = bx * ay - by * ax;
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+
+    double det = u + v + w;
+    if (det == 0.0) return false; // the ray lies in the plane of the triangle
+
+    double inv_det = 1.0 / det;
+    double hit_t = (u * a[wr.kz] + v * b[wr.kz] + w * c[wr.kz]) * wr.sz * inv_det;
+    if (!(hit_t >= t_min && hit_t < t_max)) return false;
+
+    t = hit_t;
+    b1 = v * inv_det;
+    b2 = w * inv_det;
+    return true;
+}
+
+// Width triangles in SoA layout, the unit a BVH leaf tests at once. unused lanes hold a degenerate
+// triangle, which the kernel rejects through its zero determinant. Real = float packs twice the lanes
+// into a SIMD register, for the single precision mode that re-intersects its candidate in double
+template<int Width, class Real = double>
+struct alignas(32) TriangleBlock {
+    Real v[3][3][Width]; // [vertex][axis][lane]
+    int primitive[Width];  // owner's index of the triangle in each lane, -1 for padding
+
+    TriangleBlock()
+    {
+        for (int k = 0; k < 3; k++)
+            for (int a = 0; a < 3; a++)
+                for (int lane = 0; lane < Width; lane++) v[k][a][lane] = 0;
+        for (int lane = 0; lane < Width; lane++) primitive[lane] = -1;
+    }
+
+    void set(int lane, const vec3& p0, const vec3& p1, const vec3& p2, int primitive_index)
+    {
+        for (int a = 0; a < 3; a++) {
+            v[0][a][lane] = static_cast<Real>(p0[a]);
+            v[1][a][lane] = static_cast<Real>(p1[a]);
+            v[2][a][lane] = static_cast<Real>(p2[a]);
+        }
+        primitive[lane] = primitive_index;
+    }
+};
+
+// block kernel: every lane runs the same branch-free arithmetic so the loops map onto SIMD lanes. called
+// through kernels() (core/Kernels.h), which holds it compiled for each instruction set level.
+// returns the lane of the closest hit in [t_min, t_max) and lowers t_max to it, or -1 on a miss
+template<int Width, class Real>
+SIMD_INLINE int intersectTriangleBlock(const TriangleBlock<Width, Real>& block, const WatertightRay& wr, const vec3& origin,
+    Real t_min, Real& t_max, Real& b1, Real& b2)
+{
+    const Real* p0x = block.v[0][wr.kx]; const Real* p0y = block.v[0][wr.ky]; const Real* p0z = block.v[0][wr.kz];
+    const Real* p1x = block.v[1][wr.kx]; const Real* p1y = block.v[1][wr.ky]; const Real* p1z = block.v[1][wr.kz];
+    const Real* p2x = block.v[2][wr.kx]; const Real* p2y = block.v[2][wr.ky]; const Real* p2z = block.v[2][wr.kz];
+    const Real ox = static_cast<Real>(origin[wr.kx]), oy = static_cast<Real>(origin[wr.ky]), oz = static_cast<Real>(origin[wr.kz]);
+    const Real sx = static_cast<Real>(wr.sx), sy = static_cast<Real>(wr.sy), sz = static_cast<Real>(wr.sz);
+
+    Real lane_t[Width], lane_v[Width], lane_w[Width], lane_inv_det[Width];
+    for (int lane = 0; lane < Width; lane++) {
+        Real az = p0z[lane] - oz, bz = p1z[lane] - oz, cz = p2z[lane] - oz;
+        Real ax = (p0x[lane] - ox) - sx * az, ay = (p0y[lane] - oy) - sy * az;
+        Real bx = (p1x[lane] - ox) - sx * bz, by = (p1y[lane] - oy) - sy * bz;
+        Real cx = (p2x[lane] - ox) - sx * cz, cy = (p2y[lane] - oy) - sy * cz;
+
+        Real u = cx * by - cy * bx;
+        Real v = ax * cy - ay * cx;
+        Real w = bx * ay - by * ax;
+        Real det = u + v + w;
+        bool inside = !((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) && det != 0;
+
+        // multiply by the reciprocal like intersectTriangle, so both round t the same way
+        Real inv_det = 1 / (det != 0 ? det : 1);
+        Real t = (u * az + v * bz + w * cz) * sz * inv_det;
+        lane_t[lane] = (inside && t >= t_min && t < t_max) ? t : std::numeric_limits<Real>::infinity();
+        lane_v[lane] = v;
+        lane_w[lane] = w;
+        lane_inv_det[lane] = inv_det;
+    }
+
+    int closest = -1;
+    for (int lane = 0; lane < Width; lane++) {
+        if (lane_t[lane] < t_max) {
+            t_max = lane_t[lane];
+            closest = lane;
+        }
+    }
+    if (closest >= 0) {
+        b1 = lane_v[closest] * lane_inv_det[closest];
+        b2 = lane_w[closest] * lane_inv_det[closest];
+    }
+    return closest;
+}
+
+#endif
@@ -1,44 +1,147 @@
 #include "TriangleMesh.h"
+#include "core/Kernels.h"
+#include <iostream>
 
-TriangleMesh::TriangleMesh(const std::vector<vec3>& vertices, const std::vector<int>& indices, std::shared_ptr<Material> material)
-    : vertices(vertices)
+TriangleMesh::TriangleMesh(const std::vector<vec3>& positions, const std::vector<uint32_t>& indices, std::shared_ptr<Material> material,
+                           const std::vector<vec3>& normals, const std::vector<vec2>& uvs)
+    : positions(positions), normals(normals), uvs(uvs)
 {
-    // loop through in 3s and create triangles
-    for (int i = 0; i < indices.size(); i += 3) 
-    {
-        vec3 v0 = vertices[indices[i]];
-        vec3 v1 = vertices[indices[i + 1]];
-        vec3 v2 = vertices[indices[i + 2]];
+    material_shader = material;
+    int face_count = static_cast<int>(indices.size() / 3);
 
-        triangleObjects.push_back(std::make_shared<Triangle>(v0, v1, v2, material));
+    std::vector<AABB> face_bounds(face_count);
+    bounds.makeEmpty();
+    for (int f = 0; f < face_count; f++) {
+        AABB box;
+        box.makeEmpty();
+        box = box + positions[indices[3 * f]];
+        box = box + positions[indices[3 * f + 1]];
+        box = box + positions[indices[3 * f + 2]];
+        // padded like Triangle::getBoundingBox, an exact box can lose rays through its corners to rounding
+        box.min -= vec3(small_t);
+        box.max += vec3(small_t);
+        face_bounds[f] = box;
+        bounds = bounds + box;
     }
 
-    bvh = std::make_unique<BVH>(triangleObjects);
+    // leaves are tested a block at a time, so visiting a node costs more than one more triangle in a leaf
+    BVHBuildSettings settings;
+    settings.max_leaf_size = 2 * block_width;
+    settings.intersection_cost = 1.0 / block_width;
+    std::vector<int> leaf_order;
+    bvh = std::make_unique<BVH>(face_bounds, leaf_order, settings);
+
+    // store the faces in leaf order, a leaf then addresses its faces directly
+    this->indices.resize(3 * face_count);
+    for (int f = 0; f < face_count; f++) {
+        for (int k = 0; k < 3; k++) this->indices[3 * f + k] = indices[3 * leaf_order[f] + k];
+    }
+
+    std::cout << "Mesh: " << face_count << " faces, " << positions.size() << " vertices, "
+              << (face_count > 0 ? getMemoryUsage() / face_count : 0) << " bytes per face" << std::endl;
 }
 
+size_t TriangleMesh::getMemoryUsage() const
+{
+    return positions.capacity() * sizeof(vec3) + normals.capacity() * sizeof(vec3) + uvs.capacity() * sizeof(vec2)
+         + indices.capacity() * sizeof(uint32_t) + bvh->getNodes().capacity() * sizeof(BVHNode);
+}
 
 AABB TriangleMesh::getBoundingBox() const
 {
-    AABB box;
-    box.makeEmpty();
+    return bounds;
+}
+
+vec3 TriangleMesh::faceNormal(int face) const
+{
+    const vec3& p0 = positions[indices[3 * face]];
+    const vec3& p1 = positions[indices[3 * face + 1]];
+    const vec3& p2 = positions[indices[3 * face + 2]];
+    return cross(p1 - p0, p2 - p0).normalized();
+}
+
+vec3 TriangleMesh::getNormal(const vec3& point) const
+{
+    int best_face = 0;
+    double best_distance = std::numeric_limits<double>::max();
+    for (int f = 0; f < getFaceCount(); f++) {
+        vec3 center = (positions[indices[3 * f]] + positions[indices[3 * f + 1]] + positions[indices[3 * f + 2]]) / 3.0;
+        double distance = (center - point).magnitude();
+        if (distance < best_distance) {
+            best_distance = distance;
+            best_face = f;
+        }
+    }
+    return getFaceCount() > 0 ? faceNormal(best_face) : vec3();
+}
+
+vec3 TriangleMesh::getNormal(const vec3& point, const Hit& hit) const
+{
+    if (hit.object != this || hit.part < 0) return getNormal(point);
+    if (normals.empty()) return faceNormal(hit.part);
+    const uint32_t* face = &indices[3 * hit.part];
+    return ((1.0 - hit.u - hit.v) * normals[face[0]] + hit.u * normals[face[1]] + hit.v * normals[face[2]]).normalized();
+}
 
-    for(int i=0; i < triangles.size(); i++) {
-        box = box + triangles[i].getBoundingBox();
+vec3 TriangleMesh::getGeometricNormal(const vec3& point, const Hit& hit) const
+{
+    if (hit.object != this || hit.part < 0) return getNormal(point);
+    return faceNormal(hit.part);
+}
+
+vec2 TriangleMesh::getUV(const Hit& hit) const
+{
+    if (uvs.empty() || hit.part < 0) return vec2(hit.u, hit.v);
+    const uint32_t* face = &indices[3 * hit.part];
+    return (1.0 - hit.u - hit.v) * uvs[face[0]] + hit.u * uvs[face[1]] + hit.v * uvs[face[2]];
+}
+
+// copy up to block_width faces from the shared vertex buffer into SoA lanes, the rest stay degenerate
+void TriangleMesh::gatherBlock(int first, int count, TriangleBlock<block_width>& block) const
+{
+    for (int lane = 0; lane < count; lane++) {
+        const uint32_t* face = &indices[3 * (first + lane)];
+        block.set(lane, positions[face[0]], positions[face[1]], positions[face[2]], first + lane);
     }
-    return box;
 }
 
-Hit TriangleMesh::intersect(const Ray& ray) const 
+Hit TriangleMesh::intersect(const Ray& ray) const
 {
-    // Hit closestHit;
-    // closestHit.t = std::numeric_limits<double>::infinity();
+    Hit closest_hit{nullptr, 0, 0};
+    WatertightRay watertight(ray);
+    double t_max = std::numeric_limits<double>::max();
+    bvh->traverse(ray, t_max, [&](int first, int count, double& t_closest) {
+        for (int i = first; i < first + count; i += block_width) {
+            TriangleBlock<block_width> block;
+            gatherBlock(i, std::min(block_width, first + count - i), block);
+            double b1, b2;
+            int lane = kernels().triangle_block(block, watertight, ray.origin, small_t, t_closest, b1, b2);
+            if (lane >= 0) {
+                closest_hit = Hit{this, t_closest, block.primitive[lane]};
+                closest_hit.u = b1;
+                closest_hit.v = b2;
+            }
+        }
+        return false;
+    });
+    return closest_hit;
+}
 
-    // for(int i=0; i < triangles.size(); i++) {
-    //     Hit hit = triangles[i].intersect(ray);
-    //     if (hit.t < closestHit.t) {
-    //         closestHit = hit;
-    //     }
-    // }
-    // return closestHit;
-    return bvh->intersect(ray);
-}
\ No newline at end of file
+bool TriangleMesh::occluded(const Ray& ray, double t_max) const
+{
+    bool blocked = false;
+    WatertightRay watertight(ray);
+    bvh->traverse(ray, t_max, [&](int first, int count, double& t_limit) {
+        for (int i = first; i < first + count; i += block_width) {
+            TriangleBlock<block_width> block;
+            gatherBlock(i, std::min(block_width, first + count - i), block);
+            double t = t_limit, b1, b2;
+            if (kernels().triangle_block(block, watertight, ray.origin, small_t, t, b1, b2) >= 0) {
+                blocked = true;
+                return true;
+            }
+        }
+        return false;
+    });
+    return blocked;
+}
@@ -2,21 +2,47 @@
 #define __TRIANGLE_MESH_H__
 
 #include "Object.h"
-#include "Triangle.h"
 #include "../core/Vec.h"
 #include "BVH.h"
+#include "TriangleKernel.h"
 #include <vector>
+#include <cstdint>
 
+// indexed triangle mesh: one shared vertex buffer and three 32-bit indices per face.
+// the BVH is built over the faces and the index buffer is reordered to match its leaves,
+// so a leaf covers the faces [first, first + count) and a hit reports its face in Hit::part.
 class TriangleMesh : public Object {
     public:
-        TriangleMesh(const std::vector<vec3>& vertices, const std::vector<int>& indices, std::shared_ptr<Material> material);     
+        TriangleMesh(const std::vector<vec3>& positions, const std::vector<uint32_t>& indices, std::shared_ptr<Material> material,
+                     const std::vector<vec3>& normals = std::vector<vec3>(), const std::vector<vec2>& uvs = std::vector<vec2>());
         Hit intersect(const Ray& ray) const override;
+        bool occluded(const Ray& ray, double t_max) const override;
+        // without a hit the face is unknown, this searches for the face closest to the point
+        vec3 getNormal(const vec3& point) const override;
+        // interpolated vertex normal when the mesh has normals, the face normal otherwise
+        vec3 getNormal(const vec3& point, const Hit& hit) const override;
+        // normal of the hit face
+        vec3 getGeometricNormal(const vec3& point, const Hit& hit) const override;
         AABB getBoundingBox() const override;
-        
+        int getNumberOfParts() const override { return getFaceCount(); }
+
+        int getFaceCount() const { return static_cast<int>(indices.size() / 3); }
+        vec2 getUV(const Hit& hit) const;
+        // bytes held by the vertex, index and BVH buffers
+        size_t getMemoryUsage() const;
+
+        // triangles a leaf gathers into one run of the block kernel
+        static constexpr int block_width = 4;
+
     private:
-        std::vector<vec3> vertices;
-        std::vector<Triangle> triangles;
-        std::vector<std::shared_ptr<Object>> triangleObjects;
+        std::vector<vec3> positions;
+        std::vector<vec3> normals; // per vertex, empty if the mesh has none
+        std::vector<vec2> uvs;     // per vertex, empty if the mesh has none
+        std::vector<uint32_t> indices;
+        AABB bounds;
         std::unique_ptr<BVH> bvh;
+
+        vec3 faceNormal(int face) const;
+        void gatherBlock(int first, int count, TriangleBlock<block_width>& block) const;
 };
-#endif
\ No newline at end of file
+#endif
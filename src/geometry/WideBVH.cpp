@@ -0,0 +1,483 @@
+#include "geometry/WideBVH.h"
+#include "utils/FloatRounding.h"
+#include "core/Kernels.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define WIDE_BVH_SSE
+#endif
+
+#ifdef SIMD_DISPATCH
+// the slab test below on eight boxes in one AVX register. it carries its own target attribute, only the
+// traversal built for AVX2 (WideBVH::traverseAvx) calls it and inlines it there
+SIMD_TARGET_AVX2 static int intersectBoxesAvx(const float (&box_min)[3][8], const float (&box_max)[3][8], const FloatRay& ray,
+                                              float t_min, float t_max, float* t_near) {
+    __m256 near_t = _mm256_set1_ps(t_min);
+    __m256 far_t = _mm256_set1_ps(t_max);
+    for (int a = 0; a < 3; ++a) {
+        const float* near_plane = ray.sign[a] ? box_max[a] : box_min[a];
+        const float* far_plane = ray.sign[a] ? box_min[a] : box_max[a];
+        __m256 inv = _mm256_set1_ps(ray.inv_direction[a]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_plane), _mm256_set1_ps(ray.origin_near[a])), inv);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_plane), _mm256_set1_ps(ray.origin_far[a])), inv);
+        near_t = _mm256_max_ps(t0, near_t);
+        far_t = _mm256_min_ps(t1, far_t);
+    }
+    __m256 hit = _mm256_cmp_ps(near_t, _mm256_mul_ps(far_t, _mm256_set1_ps(float_far_padding)), _CMP_LE_OQ);
+    _mm256_storeu_ps(t_near, near_t);
+    return _mm256_movemask_ps(hit);
+}
+#endif
+
+// slab test of Width boxes given per axis in SoA form, returns a bitmask of hit boxes and their entry distances.
+// avx takes the AVX test for eight boxes, only valid inside traverseAvx
+template<bool avx, int Width>
+SIMD_INLINE int intersectBoxes(const float (&box_min)[3][Width], const float (&box_max)[3][Width], const FloatRay& ray,
+                               float t_min, float t_max, float* t_near) {
+#ifdef SIMD_DISPATCH
+    if constexpr (avx && Width == 8) return intersectBoxesAvx(box_min, box_max, ray, t_min, t_max, t_near);
+#endif
+    int mask = 0;
+#ifdef WIDE_BVH_SSE
+    for (int lane = 0; lane < Width; lane += 4) {
+        __m128 near_t = _mm_set1_ps(t_min);
+        __m128 far_t = _mm_set1_ps(t_max);
+        for (int a = 0; a < 3; ++a) {
+            const float* near_plane = (ray.sign[a] ? box_max[a] : box_min[a]) + lane;
+            const float* far_plane = (ray.sign[a] ? box_min[a] : box_max[a]) + lane;
+            __m128 inv = _mm_set1_ps(ray.inv_direction[a]);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_plane), _mm_set1_ps(ray.origin_near[a])), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_plane), _mm_set1_ps(ray.origin_far[a])), inv);
+            // computed value first: maxps/minps return the second operand when the first is NaN
+            near_t = _mm_max_ps(t0, near_t);
+            far_t = _mm_min_ps(t1, far_t);
+        }
+        __m128 hit = _mm_cmple_ps(near_t, _mm_mul_ps(far_t, _mm_set1_ps(float_far_padding)));
+        _mm_storeu_ps(t_near + lane, near_t);
+        mask |= _mm_movemask_ps(hit) << lane;
+    }
+#else
+    for (int lane = 0; lane < Width; ++lane) {
+        float near_t = t_min;
+        float far_t = t_max;
+        for (int a = 0; a < 3; ++a) {
+            float t0 = ((ray.sign[a] ? box_max[a][lane] : box_min[a][lane]) - ray.origin_near[a]) * ray.inv_direction[a];
+            float t1 = ((ray.sign[a] ? box_min[a][lane] : box_max[a][lane]) - ray.origin_far[a]) * ray.inv_direction[a];
+            near_t = t0 > near_t ? t0 : near_t;
+            far_t = t1 < far_t ? t1 : far_t;
+        }
+        t_near[lane] = near_t;
+        if (near_t <= far_t * float_far_padding) mask |= 1 << lane;
+    }
+#endif
+    return mask;
+}
+
+
+template<bool avx, int Width>
+SIMD_INLINE int intersectChildren(const WideBVHNode<Width>& node, const FloatRay& ray, float t_min, float t_max, float* t_near) {
+    return intersectBoxes<avx>(node.min, node.max, ray, t_min, t_max, t_near);
+}
+
+
+// 2^exponent, built from the float bits without a call to ldexp
+static inline float gridStep(int exponent) {
+    uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+    float step;
+    std::memcpy(&step, &bits, sizeof(step));
+    return step;
+}
+
+// the plane of grid coordinate q. q * step is exact, so the add is the only rounding and the SIMD decode
+// below gives the same float as this
+static inline float decodePlane(float origin, int q, float step) {
+    return origin + static_cast<float>(q) * step;
+}
+
+
+// decode the child boxes of a quantized node, then run the float slab test on them. unused slots are masked out
+template<bool avx, int Width>
+SIMD_INLINE int intersectChildren(const QuantizedBVHNode<Width>& node, const FloatRay& ray, float t_min, float t_max, float* t_near) {
+    alignas(32) float box_min[3][Width];
+    alignas(32) float box_max[3][Width];
+    for (int a = 0; a < 3; ++a) {
+        float step = gridStep(node.exponent[a]);
+#ifdef WIDE_BVH_SSE
+        const __m128i zero = _mm_setzero_si128();
+        __m128 origin4 = _mm_set1_ps(node.origin[a]);
+        __m128 step4 = _mm_set1_ps(step);
+        for (int lane = 0; lane < Width; lane += 4) {
+            int32_t q_min, q_max;
+            std::memcpy(&q_min, node.qmin[a] + lane, sizeof(q_min));
+            std::memcpy(&q_max, node.qmax[a] + lane, sizeof(q_max));
+            __m128i min4 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(q_min), zero), zero);
+            __m128i max4 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(q_max), zero), zero);
+            _mm_store_ps(box_min[a] + lane, _mm_add_ps(origin4, _mm_mul_ps(_mm_cvtepi32_ps(min4), step4)));
+            _mm_store_ps(box_max[a] + lane, _mm_add_ps(origin4, _mm_mul_ps(_mm_cvtepi32_ps(max4), step4)));
+        }
+#else
+        for (int lane = 0; lane < Width; ++lane) {
+            box_min[a][lane] = decodePlane(node.origin[a], node.qmin[a][lane], step);
+            box_max[a][lane] = decodePlane(node.origin[a], node.qmax[a][lane], step);
+        }
+#endif
+    }
+    return intersectBoxes<avx>(box_min, box_max, ray, t_min, t_max, t_near) & node.used;
+}
+
+
+// exponent of the grid step for a node whose children span [lo, hi] on one axis: the smallest power of two
+// that covers the span in 253 steps and is no finer than the float spacing there. decoding then rounds by at
+// most half a step, which the two spare steps absorb, so coordinate 255 always lies beyond hi
+static int gridExponent(float lo, float hi) {
+    int exponent = -126; // smallest normal step, gridStep() only builds normal floats
+    double extent = static_cast<double>(hi) - static_cast<double>(lo);
+    if (extent > 0.0) {
+        int e;
+        double m = std::frexp(extent / 253.0, &e); // extent / 253 = m * 2^e, m in [0.5, 1)
+        exponent = std::max(exponent, m > 0.5 ? e : e - 1);
+    }
+    float magnitude = std::max(std::abs(lo), std::abs(hi));
+    if (magnitude > 0.0f) {
+        int e;
+        std::frexp(magnitude, &e);
+        exponent = std::max(exponent, e - std::numeric_limits<float>::digits); // spacing of the floats around magnitude
+    }
+    return std::min(exponent, 127);
+}
+
+
+template<int Width>
+WideBVH<Width>::WideBVH(const BVH& bvh, bool compressed) : compressed(compressed), store(bvh.getPrimitiveStore()) {
+    const std::vector<BVHNode>& binary = bvh.getNodes();
+    if (binary.empty()) return;
+    binary_slot.assign(binary.size(), -1);
+    nodes.reserve(binary.size() / 2 + 1);
+    nodes.emplace_back();
+    collapse(binary, 0, 0);
+    if (compressed) compress(binary);
+}
+
+
+template<int Width>
+size_t WideBVH<Width>::getMemoryUsage() const {
+    return nodes.size() * sizeof(WideBVHNode<Width>) + quantized_nodes.size() * sizeof(QuantizedBVHNode<Width>);
+}
+
+
+template<int Width>
+void WideBVH<Width>::collapse(const std::vector<BVHNode>& binary, int binary_index, int wide_index) {
+    // gather up to Width descendants, opening the largest interior candidate until the node is full
+    int slots[Width];
+    int used = 0;
+    const BVHNode& source = binary[binary_index];
+    if (source.isLeaf()) {
+        slots[used++] = binary_index;
+    } else {
+        slots[used++] = source.first;
+        slots[used++] = source.first + 1;
+    }
+    while (used < Width) {
+        int best = -1;
+        double best_area = -1.0;
+        for (int i = 0; i < used; ++i) {
+            const BVHNode& candidate = binary[slots[i]];
+            if (!candidate.isLeaf() && candidate.bbox.surfaceArea() > best_area) {
+                best_area = candidate.bbox.surfaceArea();
+                best = i;
+            }
+        }
+        if (best < 0) break;
+        int opened = binary[slots[best]].first;
+        slots[best] = opened;
+        slots[used++] = opened + 1;
+    }
+
+    // allocate the interior children first, emplace_back may move the node being filled
+    int child_index[Width];
+    for (int i = 0; i < used; ++i) {
+        child_index[i] = -1;
+        if (!binary[slots[i]].isLeaf()) {
+            child_index[i] = static_cast<int>(nodes.size());
+            nodes.emplace_back();
+        }
+    }
+
+    WideBVHNode<Width>& node = nodes[wide_index];
+    for (int i = 0; i < Width; ++i) {
+        if (i >= used) {
+            // an inverted box can never be entered
+            for (int a = 0; a < 3; ++a) {
+                node.min[a][i] = std::numeric_limits<float>::infinity();
+                node.max[a][i] = -std::numeric_limits<float>::infinity();
+            }
+            node.child[i] = 0;
+            node.count[i] = -1;
+            continue;
+        }
+        const BVHNode& child = binary[slots[i]];
+        setSlotBounds(wide_index, i, child.bbox);
+        binary_slot[slots[i]] = wide_index * Width + i;
+        node.child[i] = child.isLeaf() ? child.first : child_index[i];
+        node.count[i] = child.isLeaf() ? child.count : 0;
+    }
+
+    for (int i = 0; i < used; ++i) {
+        if (child_index[i] >= 0) collapse(binary, slots[i], child_index[i]);
+    }
+}
+
+
+template<int Width>
+void WideBVH<Width>::setSlotBounds(int wide_index, int slot, const AABB& bbox) {
+    WideBVHNode<Width>& node = nodes[wide_index];
+    for (int a = 0; a < 3; ++a) {
+        node.min[a][slot] = roundDown(bbox.min[a]);
+        node.max[a][slot] = roundUp(bbox.max[a]);
+    }
+}
+
+
+// replace the float nodes by quantized ones with the same indices. a leaf too large for a count byte becomes
+// an interior slot whose extra node (appended at the end) spreads the range over its own slots
+template<int Width>
+void WideBVH<Width>::compress(const std::vector<BVHNode>& binary) {
+    int node_count = static_cast<int>(nodes.size());
+    quantized_nodes.resize(node_count);
+    slot_source.assign(node_count * Width, -1);
+    for (int i = 0; i < static_cast<int>(binary.size()); ++i) {
+        if (binary_slot[i] >= 0) slot_source[binary_slot[i]] = i;
+    }
+
+    for (int i = 0; i < node_count; ++i) {
+        const WideBVHNode<Width>& node = nodes[i];
+        quantized_nodes[i].used = 0;
+        for (int slot = 0; slot < Width; ++slot) {
+            quantized_nodes[i].child[slot] = 0;
+            quantized_nodes[i].count[slot] = 0;
+            if (node.count[slot] < 0) continue;
+            quantized_nodes[i].used |= 1 << slot;
+            if (node.count[slot] <= QuantizedBVHNode<Width>::max_leaf_count) {
+                quantized_nodes[i].child[slot] = node.child[slot];
+                quantized_nodes[i].count[slot] = static_cast<uint8_t>(node.count[slot]);
+                continue;
+            }
+            int extra = static_cast<int>(quantized_nodes.size());
+            quantized_nodes.emplace_back();
+            slot_source.resize(slot_source.size() + Width, -1);
+            quantized_nodes[i].child[slot] = extra;
+            splitLeaf(binary, slot_source[i * Width + slot], node.child[slot], node.count[slot], extra);
+        }
+    }
+    std::vector<WideBVHNode<Width>>().swap(nodes);
+
+    for (int i = 0; i < static_cast<int>(quantized_nodes.size()); ++i) quantize(binary, i);
+}
+
+
+// spread the leaf range [first, first + count) over the slots of an extra node, all of them with the leaf's box
+template<int Width>
+void WideBVH<Width>::splitLeaf(const std::vector<BVHNode>& binary, int binary_index, int first, int count, int quantized_index) {
+    int per_slot = (count + Width - 1) / Width;
+    quantized_nodes[quantized_index].used = 0;
+    for (int slot = 0; slot < Width; ++slot) {
+        int part = std::min(per_slot, count);
+        quantized_nodes[quantized_index].child[slot] = 0;
+        quantized_nodes[quantized_index].count[slot] = 0;
+        if (part <= 0) continue;
+        quantized_nodes[quantized_index].used |= 1 << slot;
+        slot_source[quantized_index * Width + slot] = binary_index;
+        if (part <= QuantizedBVHNode<Width>::max_leaf_count) {
+            quantized_nodes[quantized_index].child[slot] = first;
+            quantized_nodes[quantized_index].count[slot] = static_cast<uint8_t>(part);
+        } else {
+            int extra = static_cast<int>(quantized_nodes.size());
+            quantized_nodes.emplace_back();
+            slot_source.resize(slot_source.size() + Width, -1);
+            quantized_nodes[quantized_index].child[slot] = extra;
+            splitLeaf(binary, binary_index, first, part, extra);
+        }
+        first += part;
+        count -= part;
+    }
+}
+
+
+// lay the grid of a quantized node over the boxes of its source nodes and round each box outwards onto it.
+// every coordinate is checked with the decode traversal uses, so the decoded box always contains the float one
+template<int Width>
+void WideBVH<Width>::quantize(const std::vector<BVHNode>& binary, int quantized_index) {
+    QuantizedBVHNode<Width>& node = quantized_nodes[quantized_index];
+    AABB frame;
+    frame.makeEmpty();
+    for (int slot = 0; slot < Width; ++slot) {
+        if (node.used & (1 << slot)) frame = frame + binary[slot_source[quantized_index * Width + slot]].bbox;
+    }
+
+    for (int a = 0; a < 3; ++a) {
+        float lo = roundDown(frame.min[a]);
+        int exponent = gridExponent(lo, roundUp(frame.max[a]));
+        float step = gridStep(exponent);
+        node.origin[a] = lo;
+        node.exponent[a] = static_cast<int8_t>(exponent);
+        for (int slot = 0; slot < Width; ++slot) {
+            node.qmin[a][slot] = 0;
+            node.qmax[a][slot] = 0;
+            if (!(node.used & (1 << slot))) continue;
+            const AABB& bbox = binary[slot_source[quantized_index * Width + slot]].bbox;
+            float box_lo = roundDown(bbox.min[a]);
+            float box_hi = roundUp(bbox.max[a]);
+            int q_min = std::min(255, std::max(0, static_cast<int>(std::floor((box_lo - lo) / step))));
+            while (q_min > 0 && decodePlane(lo, q_min, step) > box_lo) --q_min;
+            int q_max = std::min(255, std::max(0, static_cast<int>(std::ceil((box_hi - lo) / step))));
+            while (q_max < 255 && decodePlane(lo, q_max, step) < box_hi) ++q_max;
+            node.qmin[a][slot] = static_cast<uint8_t>(q_min);
+            node.qmax[a][slot] = static_cast<uint8_t>(q_max);
+        }
+    }
+}
+
+
+template<int Width>
+void WideBVH<Width>::refit(const BVH& bvh, const std::vector<int>& refitted_nodes) {
+    const std::vector<BVHNode>& binary = bvh.getNodes();
+    if (!compressed) {
+        for (int binary_index : refitted_nodes) {
+            int slot = binary_slot[binary_index];
+            if (slot >= 0) setSlotBounds(slot / Width, slot % Width, binary[binary_index].bbox);
+        }
+        return;
+    }
+
+    // a changed box can move the grid of its node, so every node holding one is quantized again,
+    // together with the extra nodes of split leaves that share a changed box
+    std::vector<int> pending;
+    for (int binary_index : refitted_nodes) {
+        int slot = binary_slot[binary_index];
+        if (slot >= 0) pending.push_back(slot / Width);
+    }
+    std::sort(pending.begin(), pending.end());
+    pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+    while (!pending.empty()) {
+        int index = pending.back();
+        pending.pop_back();
+        quantize(binary, index);
+        const QuantizedBVHNode<Width>& node = quantized_nodes[index];
+        for (int slot = 0; slot < Width; ++slot) {
+            if ((node.used & (1 << slot)) && node.count[slot] == 0 && binary[slot_source[index * Width + slot]].isLeaf()) {
+                pending.push_back(node.child[slot]);
+            }
+        }
+    }
+}
+
+
+template<int Width>
+template<class Node, class LeafFunc>
+void WideBVH<Width>::traverse(const std::vector<Node>& tree, const Ray& ray, double& t_max, LeafFunc leaf_func) const {
+#ifdef SIMD_DISPATCH
+    // four boxes fill an SSE register, which every x86-64 CPU has
+    if (Width == 8 && kernels().level >= SimdLevel::AVX2) {
+        traverseAvx(tree, ray, t_max, leaf_func);
+        return;
+    }
+#endif
+    traverseWith<false>(tree, ray, t_max, leaf_func);
+}
+
+
+#ifdef SIMD_DISPATCH
+template<int Width>
+template<class Node, class LeafFunc>
+void WideBVH<Width>::traverseAvx(const std::vector<Node>& tree, const Ray& ray, double& t_max, LeafFunc leaf_func) const {
+    traverseWith<true>(tree, ray, t_max, leaf_func);
+}
+#endif
+
+
+template<int Width>
+template<bool avx, class Node, class LeafFunc>
+void WideBVH<Width>::traverseWith(const std::vector<Node>& tree, const Ray& ray, double& t_max, LeafFunc leaf_func) const {
+    if (tree.empty()) return;
+
+    struct StackEntry {
+        int child;
+        int count; // > 0 for a leaf range, 0 for a node
+        float t_near;
+    };
+    StackEntry stack[(BVH::max_depth + QuantizedBVHNode<Width>::max_split_depth) * (Width - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, 0.0f};
+
+    FloatRay wide_ray(ray);
+    const float t_min = roundDown(small_t);
+    float t_limit = roundUp(t_max);
+    float t_near[Width];
+
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        if (entry.t_near > t_limit) continue; // a closer hit was found after this entry was pushed
+
+        if (entry.count > 0) {
+            if (leaf_func(entry.child, entry.count, t_max)) return;
+            t_limit = roundUp(t_max);
+            continue;
+        }
+
+        const Node& node = tree[entry.child];
+        int mask = intersectChildren<avx>(node, wide_ray, t_min, t_limit, t_near);
+        if (!mask) continue;
+
+        // sorted push: farthest child first so the nearest one is popped next
+        int hit_slots[Width];
+        int hit_count = 0;
+        for (int i = 0; i < Width; ++i) {
+            if (mask & (1 << i)) {
+                int j = hit_count++;
+                while (j > 0 && t_near[hit_slots[j - 1]] < t_near[i]) {
+                    hit_slots[j] = hit_slots[j - 1];
+                    --j;
+                }
+                hit_slots[j] = i;
+            }
+        }
+        for (int i = 0; i < hit_count; ++i) {
+            int slot = hit_slots[i];
+            stack[stack_size++] = {node.child[slot], node.count[slot], t_near[slot]};
+        }
+    }
+}
+
+
+template<int Width>
+Hit WideBVH<Width>::intersect(const Ray& ray) const {
+    Hit closest_hit{nullptr, 0, 0};
+    double t_max = std::numeric_limits<double>::max();
+    auto leaf = [&](int first, int count, double& t_closest) {
+        store->intersect(first, count, ray, t_closest, closest_hit);
+        return false;
+    };
+    if (compressed) traverse(quantized_nodes, ray, t_max, leaf);
+    else traverse(nodes, ray, t_max, leaf);
+    return closest_hit;
+}
+
+
+template<int Width>
+bool WideBVH<Width>::occluded(const Ray& ray, double t_max, const Object** occluder) const {
+    bool blocked = false;
+    auto leaf = [&](int first, int count, double& t_limit) {
+        blocked = store->occluded(first, count, ray, t_limit, occluder);
+        return blocked;
+    };
+    if (compressed) traverse(quantized_nodes, ray, t_max, leaf);
+    else traverse(nodes, ray, t_max, leaf);
+    return blocked;
+}
+
+
+template class WideBVH<4>;
+template class WideBVH<8>;
@@ -0,0 +1,94 @@
+#ifndef __WIDE_BVH_H__
+#define __WIDE_BVH_H__
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "core/Ray.h"
+#include "geometry/Object.h"
+#include "geometry/Hit.h"
+#include "geometry/BVH.h"
+#include "geometry/Accelerator.h"
+#include "utils/CpuFeatures.h"
+
+// one node of a Width-ary BVH. the children's bounds are stored per axis in SoA form, so one
+// SSE (Width = 4) or AVX (Width = 8) instruction sequence slab-tests every child at once.
+// bounds are single precision, rounded outwards so the test stays conservative.
+template<int Width>
+struct alignas(32) WideBVHNode {
+    float min[3][Width];
+    float max[3][Width];
+    int child[Width]; // leaf slot: offset of the first primitive, interior slot: index of the child node
+    int count[Width]; // primitives in a leaf slot, 0 for an interior slot, -1 for an unused slot
+};
+
+// the compressed form of a WideBVHNode, for scenes whose tree would not fit in cache. each node lays a grid
+// over the union of its children (a float corner and a power of two step per axis) and stores the child
+// bounds as 8-bit grid coordinates rounded outwards, decoded during traversal as origin + q * step.
+// a BVH4 node fits one cache line instead of two, a BVH8 node two instead of four
+template<int Width>
+struct alignas(32) QuantizedBVHNode {
+    static constexpr int max_leaf_count = 255; // larger leaves are spread over extra nodes
+    static constexpr int max_split_depth = 12; // levels those extra nodes add at most, 255 * 4^12 exceeds any int count
+
+    float origin[3];
+    int8_t exponent[3]; // the grid step along each axis is 2^exponent
+    uint8_t used;       // bit per slot that holds a child
+    uint8_t qmin[3][Width];
+    uint8_t qmax[3][Width];
+    int child[Width];       // as in WideBVHNode
+    uint8_t count[Width];   // primitives in a leaf slot, 0 for an interior slot
+};
+
+// BVH4 / BVH8 built by collapsing a binary BVH: each wide node pulls up to Width descendants of
+// the binary node, always opening the interior candidate with the largest surface area first.
+// leaves keep referencing primitive ranges of the binary BVH, which is left untouched.
+// packets are traced one ray at a time: each ray already fills the SIMD lanes with its children,
+// and per-packet culling measured slower than that on our scenes.
+template<int Width>
+class WideBVH : public Accelerator {
+public:
+    static_assert(Width == 4 || Width == 8, "WideBVH supports 4 or 8 children per node");
+
+    // compressed stores QuantizedBVHNodes, trading a few instructions per node for half the node memory
+    explicit WideBVH(const BVH& bvh, bool compressed = false);
+
+    Hit intersect(const Ray& ray) const override;
+    bool occluded(const Ray& ray, double t_max, const Object** occluder = nullptr) const override;
+
+    int getNodeCount() const { return static_cast<int>(compressed ? quantized_nodes.size() : nodes.size()); }
+    bool isCompressed() const { return compressed; }
+    // bytes held by the nodes
+    size_t getMemoryUsage() const;
+    // copy the refitted boxes of the source BVH into the slots that mirror them. only valid while the
+    // source kept its topology, i.e. after a BVH::refit() that rebuilt no subtree
+    void refit(const BVH& bvh, const std::vector<int>& refitted_nodes);
+
+private:
+    bool compressed;
+    std::vector<WideBVHNode<Width>> nodes; // nodes[0] is the root, empty once compressed
+    std::vector<QuantizedBVHNode<Width>> quantized_nodes; // same tree and indices as nodes, plus the nodes of split leaves
+    std::vector<int> slot_source; // compressed only: source node of each slot, the leaf for the slots of a split leaf
+    std::shared_ptr<const PrimitiveStore> store; // leaf primitives of the source BVH, shared with it
+    std::vector<int> binary_slot; // slot (wide node * Width + slot) holding each source node, -1 if it was opened
+
+    void collapse(const std::vector<BVHNode>& binary, int binary_index, int wide_index);
+    void setSlotBounds(int wide_index, int slot, const AABB& bbox);
+    void compress(const std::vector<BVHNode>& binary);
+    void splitLeaf(const std::vector<BVHNode>& binary, int binary_index, int first, int count, int quantized_index);
+    void quantize(const std::vector<BVHNode>& binary, int quantized_index);
+
+    // walks the tree with the box test of the active kernel level (kernels().level): traverseAvx for
+    // BVH8 nodes on AVX2 and above, otherwise the SSE test. both share the loop in traverseWith, which
+    // traverseAvx flattens so its box tests are inlined with AVX enabled
+    template<class Node, class LeafFunc>
+    void traverse(const std::vector<Node>& tree, const Ray& ray, double& t_max, LeafFunc leaf_func) const;
+#ifdef SIMD_DISPATCH
+    template<class Node, class LeafFunc>
+    SIMD_TARGET_AVX2 __attribute__((flatten)) void traverseAvx(const std::vector<Node>& tree, const Ray& ray, double& t_max, LeafFunc leaf_func) const;
+#endif
+    template<bool avx, class Node, class LeafFunc>
+    SIMD_INLINE void traverseWith(const std::vector<Node>& tree, const Ray& ray, double& t_max, LeafFunc leaf_func) const;
+};
+
+#endif
@@ -1,6 +1,8 @@
 #define _USE_MATH_DEFINES
 #include "PathTracer.h"
 #include "utils/ImageWriter.h"
+#include "geometry/SurfaceInteraction.h"
+#include "integrators/WavefrontIntegrator.h"
 #include <math.h>
 #include <random>
 #include <thread>
@@ -16,8 +18,8 @@ void PathTracer::render(Scene &scene)
     // Build the photon map if needed
     if (renderMode == PHOTON_MAPPING || renderMode == HYBRID)
     {
-        photonMap.buildPhotonMap(scene, 5000);
-        causticMap.buildPhotonMap(scene, 2000); 
+        photonMap.buildPhotonMap(scene, 5000, seed);
+        causticMap.buildPhotonMap(scene, 2000, seed + 1);
     }
     
 
@@ -58,17 +60,31 @@ vec3 PathTracer::transformToWorld(const vec3 &local, const vec3 &normal)
 }
 
 // sample light source and compute the contribution of that light to the hit point
-vec3 PathTracer::nextEventEstimation(Scene &scene, const vec3 &hit_point, const vec3 &normal, const vec3 &view_dir, const Material &mat)
+vec3 PathTracer::nextEventEstimation(Scene &scene, const vec3 &hit_point, const vec3 &normal, const vec3 &view_dir, const Material &mat, Sampler &sampler)
 {
-    // std::cout << "lights: " << scene.lights.size() << std::endl;
-    // std::cout << "total_light_importance: " << scene.total_light_importance << std::endl;
-    // std::cout << "light_importance[0]: " << scene.light_importance[0] << std::endl;
+    Ray shadow_ray;
+    double light_distance;
+    int selected_light_index = selectLight(scene, sampler, hit_point, shadow_ray, light_distance);
+    if (selected_light_index < 0)
+        return vec3(0);
 
-    if (scene.lights.empty())
+    // shadow ray check
+    if (scene.enable_shadows && scene.occluded(shadow_ray, light_distance, selected_light_index))
+    {
         return vec3(0);
+    }
 
-    double random_value = sampler.getRandomFloat() * scene.total_light_importance;
-    // std::cout << "random_value: " << random_value << std::endl;
+    // if light is not occluded, compute the light contribution
+    return lightContribution(scene, selected_light_index, shadow_ray, hit_point, normal, mat);
+}
+
+// pick a light with probability proportional to its importance, -1 if the scene has none
+int PathTracer::selectLight(Scene &scene, Sampler &light_sampler, const vec3 &hit_point, Ray &shadow_ray, double &light_distance)
+{
+    if (scene.lights.empty())
+        return -1;
+
+    double random_value = light_sampler.getRandomFloat() * scene.total_light_importance;
 
     double cumulative = 0.0;
     int selected_light_index = 0;
@@ -85,22 +101,20 @@ vec3 PathTracer::nextEventEstimation(Scene &scene, const vec3 &hit_point, const
 
     vec3 light_pos = light->position;
     vec3 light_dir = (light_pos - hit_point).normalized();
-    double light_distance = (light_pos - hit_point).magnitude();
-
-    // shadow ray check
-    Ray shadow_ray(hit_point + small_t * light_dir, light_dir);
-    Hit shadow_hit = scene.closestIntersection(shadow_ray);
-    if (scene.enable_shadows && shadow_hit.object && shadow_hit.t < light_distance)
-    {
-        return vec3(0);
-    }
+    light_distance = (light_pos - hit_point).magnitude();
+    shadow_ray = Ray(hit_point + small_t * light_dir, light_dir);
+    return selected_light_index;
+}
 
-    // if light is not occluded, compute the light contribution
-    vec3 emitted = light->emittedLight(light_dir);
-    double cos_theta = std::max(dot(light_dir, normal), 0.0);
+// radiance the selected light sends to the hit point if nothing blocks the shadow ray, divided by its selection pdf
+vec3 PathTracer::lightContribution(Scene &scene, int light_index, const Ray &shadow_ray, const vec3 &hit_point, const vec3 &normal, const Material &mat)
+{
+    const auto &light = scene.lights[light_index];
+    vec3 emitted = light->emittedLight(shadow_ray.direction);
+    double cos_theta = std::max(dot(shadow_ray.direction, normal), 0.0);
 
     vec3 brdf = mat.shade(shadow_ray, hit_point, normal, scene); // lambertian reflectance
-    double pdf_light = scene.light_importance[selected_light_index] / scene.total_light_importance;
+    double pdf_light = scene.light_importance[light_index] / scene.total_light_importance;
 
     return emitted * brdf * cos_theta / pdf_light;
 }
@@ -108,81 +122,53 @@ vec3 PathTracer::nextEventEstimation(Scene &scene, const vec3 &hit_point, const
 void PathTracer::executePathTracingPipeline(Scene &scene)
 {
     initializeHierarchy(scene); // Make sure BVH ready
-
-    int total_pixels = image_width * image_height;
-    int num_threads = std::thread::hardware_concurrency(); // get number of threads supported by the system
-    std::vector<std::thread> workers;
-    std::atomic<int> pixels_rendered(0); // <-- atomic counter for all threads
-
-    auto renderChunk = [&](int start_y, int end_y) {
-        for (int y = start_y; y < end_y; ++y) {
-            for (int x = 0; x < image_width; ++x) {
-                vec3 color(0);
-                for (int s = 0; s < spp; ++s) {
-                    Ray ray = scene.camera->generateRay(ivec2(x, y));
-                    color += renderPathTracer(scene, 0, ray);
-                }
-                setPixel(ivec2(x, y), color / static_cast<double>(spp));
-                ++pixels_rendered; // atomic increment
-            }
-        }
-    };
-
-    // start threads
-    int chunk_size = image_height / num_threads;
-    for (int i = 0; i < num_threads; ++i) {
-        int start_y = i * chunk_size;
-        int end_y = (i == num_threads - 1) ? image_height : (i + 1) * chunk_size;
-        workers.emplace_back(renderChunk, start_y, end_y);
-    }
-
-    // progress monitor loop (run on main thread)
-    while (pixels_rendered < total_pixels) {
-        printProgress(pixels_rendered, total_pixels);
-        std::this_thread::sleep_for(std::chrono::milliseconds(200)); // update every 0.2s
-    }
-
-    // join all workers
-    for (auto& worker : workers) {
-        worker.join();
+    if (wavefront)
+    {
+        WavefrontIntegrator(*this, scene).render();
+        return;
     }
-
-    // final print
-    printProgress(total_pixels, total_pixels);
-    std::cout << std::endl << "Rendering complete!" << std::endl;
+    parallelRender(scene, [this](Scene& s, const Ray& r, const Hit& h, Sampler& sampler) {
+        return renderPathTracer(s, 0, r, h, sampler);
+    });
 }
 
 // Photon mapping render loop
 void PathTracer::executePhotonMappingPipeline(Scene &scene) {
     initializeHierarchy(scene); // if needed
-    parallelRender(scene, [this](Scene& s, Ray r) {
-        return renderWithPhotonMap(s, r);
+    parallelRender(scene, [this](Scene& s, const Ray& r, const Hit& h, Sampler& sampler) {
+        return renderWithPhotonMap(s, r, h, sampler);
     });
 }
 
 void PathTracer::executeHybridRenderingPipeline(Scene &scene) {
     initializeHierarchy(scene); // if needed
-    parallelRender(scene, [this](Scene& s, Ray r) {
-        return renderHybrid(s, 0, r);
+    parallelRender(scene, [this](Scene& s, const Ray& r, const Hit& h, Sampler& sampler) {
+        return renderHybrid(s, 0, r, h, sampler);
     });
 }
 
 // set up initial view ray and call the scene to cast the ray
-vec3 PathTracer::renderPathTracer(Scene &scene, int depth, Ray ray)
+vec3 PathTracer::renderPathTracer(Scene &scene, int depth, Ray ray, Sampler &sampler)
 {
-    Hit hit = scene.closestIntersection(ray);
+    return renderPathTracer(scene, depth, ray, scene.closestIntersection(ray), sampler);
+}
 
-    if (hit.object == nullptr) {
+// shade a path vertex whose hit is already known (primary hits come from packet traversal)
+vec3 PathTracer::renderPathTracer(Scene &scene, int depth, const Ray &ray, const Hit &hit, Sampler &sampler)
+{
+    SurfaceInteraction interaction(ray, hit);
+    if (!interaction.isHit()) {
         if (scene.environment_light) {
             return scene.environment_light->emittedLight(ray.direction);
         }
         return vec3(0);  
     }
 
-    vec3 hit_point = ray.origin + hit.t * ray.direction;
-    vec3 normal = hit.object->getNormal(hit_point);
+    const vec3 &hit_point = interaction.getPosition();
+    const vec3 &normal = interaction.getShadingNormal();
+    const Material &material = *interaction.getMaterial();
 
-    vec3 emitted = hit.object->material_shader->emitted(); // will be 0 unless emissive
+    vec3 emitted = material.emitted(); // will be 0 unless emissive
 
     vec3 local_dir = sampler.getCosineWeightedHemisphereDirection();
     vec3 new_direction = transformToWorld(local_dir, normal);
@@ -204,8 +190,8 @@ vec3 PathTracer::renderPathTracer(Scene &scene, int depth, Ray ray)
     }
     // === End Russian Roulette Termination ===
 
-    vec3 incoming = renderPathTracer(scene, depth + 1, new_ray);
-    vec3 brdf = hit.object->material_shader->shade(ray, hit_point, normal, scene) / M_PI;
+    vec3 incoming = renderPathTracer(scene, depth + 1, new_ray, sampler);
+    vec3 brdf = material.shade(ray, hit_point, normal, scene) / M_PI;
 
     // if we applied Russian Roulette, we need to scale the incoming light by the probability of survival to prevent bias
     if (depth >= 3)
@@ -214,26 +200,31 @@ vec3 PathTracer::renderPathTracer(Scene &scene, int depth, Ray ray)
     }
 
     // compute the contribution of the light source to the hit point
-    vec3 light_contribution = nextEventEstimation(scene, hit_point, normal, new_direction, *hit.object->material_shader);
+    vec3 light_contribution = nextEventEstimation(scene, hit_point, normal, new_direction, material, sampler);
     return emitted + light_contribution + (brdf * incoming * cos_theta / pdf);
 }
 
-vec3 PathTracer::renderWithPhotonMap(Scene &scene, Ray ray)
+vec3 PathTracer::renderWithPhotonMap(Scene &scene, Ray ray, Sampler &sampler)
 {
-    Hit hit = scene.closestIntersection(ray);
-    if (hit.object == nullptr)
+    return renderWithPhotonMap(scene, ray, scene.closestIntersection(ray), sampler);
+}
+
+vec3 PathTracer::renderWithPhotonMap(Scene &scene, const Ray &ray, const Hit &hit, Sampler &sampler)
+{
+    SurfaceInteraction interaction(ray, hit);
+    if (!interaction.isHit())
         return vec3(0);
 
-    vec3 hit_point = ray.origin + hit.t * ray.direction;
-    vec3 normal = hit.object->getNormal(hit_point);
+    const vec3 &hit_point = interaction.getPosition();
+    const vec3 &normal = interaction.getShadingNormal();
+    const Material &shader = *interaction.getMaterial();
 
     // get material emission and shaded color
-    vec3 emitted = hit.object->material_shader->emitted();
-    vec3 material = hit.object->material_shader->shade(ray, hit_point, normal, scene);
+    vec3 emitted = shader.emitted();
+    vec3 material = shader.shade(ray, hit_point, normal, scene);
 
     // direct lighting (from lights)
-    vec3 direct = nextEventEstimation(scene, hit_point, normal, -ray.direction,
-                                      *hit.object->material_shader);
+    vec3 direct = nextEventEstimation(scene, hit_point, normal, interaction.getViewDirection(), shader, sampler);
 
     // indirect lighting (from global photon map)
     vec3 indirect_global = photonMap.estimateRadiance(hit_point, normal, 0.75, 200);
@@ -246,21 +237,26 @@ vec3 PathTracer::renderWithPhotonMap(Scene &scene, Ray ray)
 }
 
 
-vec3 PathTracer::renderHybrid(Scene &scene, int depth, Ray ray)
+vec3 PathTracer::renderHybrid(Scene &scene, int depth, Ray ray, Sampler &sampler)
+{
+    return renderHybrid(scene, depth, ray, scene.closestIntersection(ray), sampler);
+}
+
+vec3 PathTracer::renderHybrid(Scene &scene, int depth, const Ray &ray, const Hit &hit, Sampler &sampler)
 {
-    Hit hit = scene.closestIntersection(ray);
-    if (hit.object == nullptr)
+    SurfaceInteraction interaction(ray, hit);
+    if (!interaction.isHit())
         return vec3(0);
 
-    vec3 hit_point = ray.origin + hit.t * ray.direction;
-    vec3 normal = hit.object->getNormal(hit_point);
+    const vec3 &hit_point = interaction.getPosition();
+    const vec3 &normal = interaction.getShadingNormal();
+    const Material &material = *interaction.getMaterial();
 
     // get emitted light from the material
-    vec3 emitted = hit.object->material_shader->emitted();
+    vec3 emitted = material.emitted();
 
     // get direct light using next event estimation
-    vec3 direct_light = nextEventEstimation(scene, hit_point, normal, -ray.direction,
-                                            *hit.object->material_shader);
+    vec3 direct_light = nextEventEstimation(scene, hit_point, normal, interaction.getViewDirection(), material, sampler);
 
     // initialize indirect lighting
     vec3 indirect_light(0);
@@ -290,8 +286,8 @@ vec3 PathTracer::renderHybrid(Scene &scene, int depth, Ray ray)
             if (depth >= 3 && sampler.getRandomFloat() > rr_prob)
                 return emitted + direct_light;
 
-            vec3 incoming = renderHybrid(scene, depth + 1, new_ray);
-            vec3 brdf = hit.object->material_shader->shade(ray, hit_point, normal, scene) / M_PI;
+            vec3 incoming = renderHybrid(scene, depth + 1, new_ray, sampler);
+            vec3 brdf = material.shade(ray, hit_point, normal, scene) / M_PI;
 
             if (depth >= 3)
                 incoming /= rr_prob;
@@ -8,10 +8,13 @@
 #include "core/Sampler.h"
 #include "photon-core/PhotonMap.h"
 #include "photon-core/CausticMap.h"
+#include "utils/TileScheduler.h"
 #include <thread>
 #include <atomic>
+#include <mutex>
 #include <vector> 
 #include <chrono>
+#include <algorithm>
 
 
 enum RenderMode
@@ -31,21 +34,32 @@ public:
     
     RenderMode renderMode;
     const double small_t = 0.001;
+    int packet_size = 8; // primary rays are traced in packet_size x packet_size pixel packets (4 or 8)
+    bool wavefront = false; // path tracing runs the WavefrontIntegrator instead of one recursive path per sample
+    int wavefront_paths = 1 << 18; // paths the wavefront integrator keeps in flight
+    unsigned int seed = 1337; // every pixel sample draws from its own stream of this seed, see Sampler
+    int tile_size = 0; // edge of the square tiles threads render and steal, 0 picks one from the image size and thread count
 
     std::vector<vec3> framebuffer; // image data, holds the color of each pixel
     PathTracer(int w, int h, int samples, int md)
         : image_width(w), image_height(h), spp(samples), max_depth(md),
-          framebuffer(w * h, vec3(0.0)), sampler(1337) {}
+          framebuffer(w * h, vec3(0.0)) {}
     // Pass world data to this renderer.
     void render(Scene &scene);
-    vec3 renderPathTracer(Scene &scene, int depth, Ray ray);
+    vec3 renderPathTracer(Scene &scene, int depth, Ray ray, Sampler &sampler);
+    vec3 renderPathTracer(Scene &scene, int depth, const Ray &ray, const Hit &hit, Sampler &sampler);
     void initializeHierarchy(Scene& scene);
     void writeImage(const std::string &filename, const std::string &format);
     void printProgress(int pixels_rendered, int total_pixels) const;
     void setPixel(const ivec2& pixel_index, const vec3& color);
-    vec3 renderWithPhotonMap(Scene &scene, Ray ray);
-    vec3 renderHybrid(Scene &scene, int depth, Ray ray);
-    vec3 nextEventEstimation(Scene &scene, const vec3 &hit_point, const vec3 &normal, const vec3 &view_dir, const Material &mat);
+    vec3 renderWithPhotonMap(Scene &scene, Ray ray, Sampler &sampler);
+    vec3 renderWithPhotonMap(Scene &scene, const Ray &ray, const Hit &hit, Sampler &sampler);
+    vec3 renderHybrid(Scene &scene, int depth, Ray ray, Sampler &sampler);
+    vec3 renderHybrid(Scene &scene, int depth, const Ray &ray, const Hit &hit, Sampler &sampler);
+    vec3 nextEventEstimation(Scene &scene, const vec3 &hit_point, const vec3 &normal, const vec3 &view_dir, const Material &mat, Sampler &sampler);
+    // the two halves of nextEventEstimation around its shadow test, for integrators that trace shadow rays in batches
+    int selectLight(Scene &scene, Sampler &light_sampler, const vec3 &hit_point, Ray &shadow_ray, double &light_distance);
+    vec3 lightContribution(Scene &scene, int light_index, const Ray &shadow_ray, const vec3 &hit_point, const vec3 &normal, const Material &mat);
     void setRenderMode(RenderMode mode)
     {
         std::cout << "Render mode set to: " << (mode == PATH_TRACING ? "Path Tracing" : (mode == PHOTON_MAPPING ? "Photon Mapping" : "Hybrid")) << std::endl;
@@ -55,12 +69,14 @@ public:
     void executePathTracingPipeline(Scene &scene);
     void executePhotonMappingPipeline(Scene &scene);
     void executeHybridRenderingPipeline(Scene &scene);
-    // parallel rendering function, to be called from the main thread
+    // parallel rendering function, to be called from the main thread.
+    // renderFunc(scene, primary_ray, primary_hit, sampler) returns the radiance of one sample
     template<typename RenderFunc>
     void parallelRender(Scene &scene, RenderFunc renderFunc);    
 
 private:
-    Sampler sampler; // for sampling
+    friend class WavefrontIntegrator;
+
     vec3 transformToWorld(const vec3 &local, const vec3 &normal);
 };
 
@@ -68,35 +84,47 @@ private:
 template<typename RenderFunc>
 void PathTracer::parallelRender(Scene &scene, RenderFunc renderFunc) {
     int total_pixels = image_width * image_height;
-    int num_threads = std::thread::hardware_concurrency();
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    TileScheduler scheduler(image_width, image_height, tile_size, num_threads);
     std::vector<std::thread> workers;
     std::atomic<int> pixels_rendered(0);
+    std::mutex progress_mutex;
 
-    auto renderChunk = [&](int start_y, int end_y) {
-        for (int y = start_y; y < end_y; ++y) {
-            for (int x = 0; x < image_width; ++x) {
-                vec3 color(0);
-                for (int s = 0; s < spp; ++s) {
-                    Ray ray = scene.camera->generateRay(ivec2(x, y));
-                    color += renderFunc(scene, ray);
+    auto renderTiles = [&](int worker) {
+        const int packet_width = std::max(1, std::min(packet_size, 8)); // 8x8 fills a RayPacket
+        RayPacket packet;
+        Hit hits[RayPacket::max_size];
+        Tile tile;
+        while (scheduler.next(worker, tile)) {
+            ivec2 end = tile.origin + tile.size;
+            for (int y = tile.origin[1]; y < end[1]; y += packet_width) {
+                for (int x = tile.origin[0]; x < end[0]; x += packet_width) {
+                    ivec2 block(std::min(packet_width, end[0] - x), std::min(packet_width, end[1] - y));
+                    scene.camera->generateRayPacket(ivec2(x, y), block, packet);
+                    // the pinhole camera always shoots through the pixel center, so every sample shares the primary hit
+                    scene.intersectPacket(packet, hits);
+                    for (int i = 0; i < packet.size; ++i) {
+                        vec3 color(0);
+                        for (int s = 0; s < spp; ++s) {
+                            Sampler sampler(seed, packet.pixels[i][1] * image_width + packet.pixels[i][0], s);
+                            color += renderFunc(scene, packet.rays[i], hits[i], sampler);
+                        }
+                        setPixel(packet.pixels[i], color / static_cast<double>(spp));
+                    }
                 }
-                setPixel(ivec2(x, y), color / static_cast<double>(spp));
-                ++pixels_rendered;
             }
+            // report after every tile
+            int done = pixels_rendered += tile.size[0] * tile.size[1];
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            printProgress(done, total_pixels);
         }
     };
 
-    int chunk_size = image_height / num_threads;
-    for (int i = 0; i < num_threads; ++i) {
-        int start_y = i * chunk_size;
-        int end_y = (i == num_threads - 1) ? image_height : (i + 1) * chunk_size;
-        workers.emplace_back(renderChunk, start_y, end_y);
-    }
-
-    while (pixels_rendered < total_pixels) {
-        printProgress(pixels_rendered, total_pixels);
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    // the calling thread renders as worker 0
+    for (int i = 1; i < num_threads; ++i) {
+        workers.emplace_back(renderTiles, i);
     }
+    renderTiles(0);
 
     for (auto& worker : workers) {
         worker.join();
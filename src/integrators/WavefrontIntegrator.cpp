@@ -0,0 +1,280 @@
+#define _USE_MATH_DEFINES
+#include "integrators/WavefrontIntegrator.h"
+#include "integrators/PathTracer.h"
+#include "geometry/SurfaceInteraction.h"
+#include "core/Camera.h"
+#include "utils/ThreadPool.h"
+#include <math.h>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <utility>
+
+// spread the lowest 8 bits of v over every third bit
+static uint32_t spreadBits(uint32_t v)
+{
+    v &= 0xff;
+    v = (v | (v << 8)) & 0x0000f00f;
+    v = (v | (v << 4)) & 0x000c30c3;
+    v = (v | (v << 2)) & 0x00249249;
+    return v;
+}
+
+WavefrontIntegrator::WavefrontIntegrator(PathTracer &tracer, Scene &scene)
+    : tracer(tracer), scene(scene)
+{
+    // infinite objects (planes) would stretch every cell over the whole scene, leave them out
+    scene_bounds.makeEmpty();
+    for (const auto &object : scene.objects)
+    {
+        AABB box = object->getBoundingBox();
+        bool finite = true;
+        for (int a = 0; a < 3; a++)
+            finite = finite && std::isfinite(box.min[a]) && std::isfinite(box.max[a]);
+        if (finite && !box.isEmpty())
+            scene_bounds = scene_bounds + box;
+    }
+    if (scene_bounds.isEmpty())
+    {
+        scene_bounds.min = vec3(0);
+        scene_bounds.max = vec3(1);
+    }
+}
+
+uint64_t WavefrontIntegrator::rayKey(const Ray &ray, int index) const
+{
+    uint32_t octant = (ray.sign[0] << 2) | (ray.sign[1] << 1) | ray.sign[2];
+    uint32_t cell[3];
+    for (int a = 0; a < 3; a++)
+    {
+        double extent = std::max(scene_bounds.max[a] - scene_bounds.min[a], 1e-9);
+        double relative = (ray.origin[a] - scene_bounds.min[a]) / extent;
+        cell[a] = static_cast<uint32_t>(std::min(std::max(relative, 0.0), 1.0) * 255.0);
+    }
+    uint32_t morton = (spreadBits(cell[0]) << 2) | (spreadBits(cell[1]) << 1) | spreadBits(cell[2]);
+    return (static_cast<uint64_t>((octant << 24) | morton) << 32) | static_cast<uint32_t>(index);
+}
+
+void WavefrontIntegrator::render()
+{
+    const int width = tracer.image_width, height = tracer.image_height, spp = tracer.spp;
+    const int rows_per_wave = std::max(1, tracer.wavefront_paths / std::max(1, width * spp));
+    std::cout << "Wavefront: " << rows_per_wave * width * spp << " paths per wave" << std::endl;
+
+    for (int first_row = 0; first_row < height; first_row += rows_per_wave)
+    {
+        int rows = std::min(rows_per_wave, height - first_row);
+        generate(first_row, rows);
+        while (!active.empty())
+        {
+            shade();
+            traceShadowRays();
+            extend();
+        }
+        resolve(first_row, rows);
+        tracer.printProgress((first_row + rows) * width, width * height);
+    }
+
+    std::cout << std::endl << "Rendering complete!" << std::endl;
+}
+
+// camera rays of the band, traced in packets like PathTracer::parallelRender. the pinhole camera shoots
+// every sample through the pixel center, so the spp paths of a pixel start from the same hit
+void WavefrontIntegrator::generate(int first_row, int rows)
+{
+    const int width = tracer.image_width, spp = tracer.spp;
+    const int packet_width = std::max(1, std::min(tracer.packet_size, 8));
+    paths.resize(static_cast<size_t>(rows) * width * spp);
+    shadows.resize(paths.size());
+
+    int packet_rows = (rows + packet_width - 1) / packet_width;
+    ThreadPool::global().parallelFor(0, packet_rows, 1, [&](int begin, int end)
+    {
+        RayPacket packet;
+        Hit hits[RayPacket::max_size];
+        for (int r = begin; r < end; r++)
+        {
+            int y = first_row + r * packet_width;
+            for (int x = 0; x < width; x += packet_width)
+            {
+                ivec2 block(std::min(packet_width, width - x), std::min(packet_width, first_row + rows - y));
+                scene.camera->generateRayPacket(ivec2(x, y), block, packet);
+                scene.intersectPacket(packet, hits);
+                for (int i = 0; i < packet.size; ++i)
+                {
+                    const ivec2 &pixel = packet.pixels[i];
+                    int local = (pixel[1] - first_row) * width + pixel[0];
+                    for (int s = 0; s < spp; ++s)
+                    {
+                        PathState &path = paths[static_cast<size_t>(local) * spp + s];
+                        path.ray = packet.rays[i];
+                        path.hit = hits[i];
+                        path.throughput = vec3(1);
+                        path.radiance = vec3(0);
+                        path.pixel = pixel[1] * width + pixel[0];
+                        path.depth = 0;
+                        path.sampler = Sampler(tracer.seed, path.pixel, s);
+                    }
+                }
+            }
+        }
+    });
+
+    active.resize(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+        active[i] = static_cast<int>(i);
+}
+
+// one bounce of every active path: gather emission, queue the light sample, pick the next direction or
+// finish. same estimator as PathTracer::renderPathTracer with the recursion unrolled into throughput
+void WavefrontIntegrator::shade()
+{
+    // group the hits by material so neighbouring threads run the same shading code on the same data.
+    // objects share materials by pointer, misses (null) come first
+    std::vector<std::pair<const Material *, int>> order(active.size());
+    for (size_t k = 0; k < active.size(); k++)
+    {
+        const Hit &hit = paths[active[k]].hit;
+        order[k] = std::make_pair(hit.object ? hit.object->getMaterial(hit) : nullptr, active[k]);
+    }
+    std::sort(order.begin(), order.end(), [](const std::pair<const Material *, int> &a, const std::pair<const Material *, int> &b)
+    {
+        if (a.first != b.first)
+            return std::less<const Material *>()(a.first, b.first);
+        return a.second < b.second;
+    });
+
+    const int chunk_size = 1024;
+    const double rr_prob = 0.8;
+    ThreadPool::global().parallelFor(0, static_cast<int>(order.size()), chunk_size, [&](int begin, int end)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            PathState &path = paths[order[k].second];
+            ShadowRay &shadow = shadows[order[k].second];
+            Sampler &sampler = path.sampler;
+            shadow.light_index = -1;
+
+            SurfaceInteraction interaction(path.ray, path.hit);
+            if (!interaction.isHit())
+            {
+                if (scene.environment_light)
+                    path.radiance += path.throughput * scene.environment_light->emittedLight(path.ray.direction);
+                path.depth = -1;
+                continue;
+            }
+
+            const vec3 &hit_point = interaction.getPosition();
+            const vec3 &normal = interaction.getShadingNormal();
+            const Material &material = *order[k].first;
+
+            path.radiance += path.throughput * material.emitted();
+
+            vec3 local_dir = sampler.getCosineWeightedHemisphereDirection();
+            vec3 new_direction = tracer.transformToWorld(local_dir, normal);
+
+            float cos_theta = std::max(dot(new_direction, normal), 0.0);
+            float pdf = cos_theta / M_PI;
+
+            if (pdf < 1e-6f || (path.depth >= 3 && sampler.getRandomFloat() > rr_prob))
+            {
+                path.depth = -1;
+                continue;
+            }
+
+            // light sample, its shadow ray is traced with the others of this bounce
+            Ray shadow_ray;
+            double light_distance;
+            int light_index = tracer.selectLight(scene, sampler, hit_point, shadow_ray, light_distance);
+            if (light_index >= 0)
+            {
+                vec3 contribution = path.throughput * tracer.lightContribution(scene, light_index, shadow_ray, hit_point, normal, material);
+                if (scene.enable_shadows)
+                {
+                    shadow.ray = shadow_ray;
+                    shadow.t_max = light_distance;
+                    shadow.light_index = light_index;
+                    shadow.contribution = contribution;
+                }
+                else
+                {
+                    path.radiance += contribution;
+                }
+            }
+
+            vec3 brdf = material.shade(path.ray, hit_point, normal, scene) / M_PI;
+            path.throughput = path.throughput * brdf * cos_theta / pdf;
+            if (path.depth >= 3)
+                path.throughput /= rr_prob;
+
+            path.ray = Ray(hit_point + tracer.small_t * new_direction, new_direction);
+            path.depth++;
+        }
+    });
+
+    // keep the paths that go on
+    active.clear();
+    for (const auto &entry : order)
+    {
+        if (paths[entry.second].depth >= 0)
+            active.push_back(entry.second);
+    }
+}
+
+void WavefrontIntegrator::traceShadowRays()
+{
+    std::vector<uint64_t> queue;
+    for (int index : active)
+    {
+        if (shadows[index].light_index >= 0)
+            queue.push_back(rayKey(shadows[index].ray, index));
+    }
+    std::sort(queue.begin(), queue.end());
+
+    ThreadPool::global().parallelFor(0, static_cast<int>(queue.size()), 256, [&](int begin, int end)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            int index = static_cast<int>(queue[k] & 0xffffffffu);
+            const ShadowRay &shadow = shadows[index];
+            if (!scene.occluded(shadow.ray, shadow.t_max, shadow.light_index))
+                paths[index].radiance += shadow.contribution;
+        }
+    });
+}
+
+void WavefrontIntegrator::extend()
+{
+    std::vector<uint64_t> queue(active.size());
+    for (size_t k = 0; k < active.size(); k++)
+        queue[k] = rayKey(paths[active[k]].ray, active[k]);
+    std::sort(queue.begin(), queue.end());
+    for (size_t k = 0; k < queue.size(); k++)
+        active[k] = static_cast<int>(queue[k] & 0xffffffffu);
+
+    ThreadPool::global().parallelFor(0, static_cast<int>(active.size()), 256, [&](int begin, int end)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            PathState &path = paths[active[k]];
+            path.hit = scene.closestIntersection(path.ray);
+        }
+    });
+}
+
+// average the samples of each pixel of the band into the framebuffer
+void WavefrontIntegrator::resolve(int first_row, int rows)
+{
+    const int width = tracer.image_width, spp = tracer.spp;
+    for (int y = first_row; y < first_row + rows; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            size_t first = (static_cast<size_t>(y - first_row) * width + x) * spp;
+            vec3 color(0);
+            for (int s = 0; s < spp; ++s)
+                color += paths[first + s].radiance;
+            tracer.setPixel(ivec2(x, y), color / static_cast<double>(spp));
+        }
+    }
+}
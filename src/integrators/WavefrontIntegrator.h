@@ -0,0 +1,68 @@
+#ifndef __WAVEFRONT_INTEGRATOR_H__
+#define __WAVEFRONT_INTEGRATOR_H__
+
+#include "core/Vec.h"
+#include "core/Ray.h"
+#include "core/Scene.h"
+#include "core/Sampler.h"
+#include "geometry/AABB.h"
+#include "geometry/Hit.h"
+#include <cstdint>
+#include <vector>
+
+class PathTracer;
+
+// path tracing in waves instead of one recursive path per sample. a wave holds the paths of a band of rows
+// and advances all of them one bounce at a time in separate stages: shade the hits (sorted by material),
+// trace the shadow rays they queued, then trace the extension rays of the surviving paths. the rays of
+// each stage are sorted by direction octant and origin cell first, so neighbouring traversals touch the
+// same BVH nodes. shading follows PathTracer::renderPathTracer, the images agree up to noise
+class WavefrontIntegrator
+{
+public:
+    WavefrontIntegrator(PathTracer &tracer, Scene &scene);
+
+    // render the whole image into the tracer's framebuffer
+    void render();
+
+private:
+    struct PathState
+    {
+        Ray ray;         // ray that produced hit
+        Hit hit;         // closest hit of ray, object is null on a miss
+        vec3 throughput; // product of brdf * cos / pdf along the path so far
+        vec3 radiance;   // what the path has gathered so far
+        int pixel;       // framebuffer index
+        int depth;       // bounce of hit, 0 for the camera hit
+        Sampler sampler; // stream of this pixel sample, the image does not depend on the thread count
+    };
+
+    // next event estimation of one path vertex, waiting for its occlusion test
+    struct ShadowRay
+    {
+        Ray ray;
+        double t_max;
+        int light_index; // -1 when nothing was queued
+        vec3 contribution; // added to the path radiance if the light is visible
+    };
+
+    PathTracer &tracer;
+    Scene &scene;
+    AABB scene_bounds; // finite part of the scene, cells of the ray sort key are relative to it
+
+    std::vector<PathState> paths;  // the paths of the current wave, spp consecutive ones per pixel
+    std::vector<int> active;       // paths still bouncing
+    std::vector<ShadowRay> shadows; // one slot per path
+
+    void generate(int first_row, int rows);
+    void shade();
+    void traceShadowRays();
+    void extend();
+    void resolve(int first_row, int rows);
+
+    // sort key of a ray in the upper 32 bits (octant of the direction, then a morton code of the origin),
+    // index in the lower 32
+    uint64_t rayKey(const Ray &ray, int index) const;
+};
+
+#endif
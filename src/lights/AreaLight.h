@@ -4,7 +4,6 @@
 #include "Light.h"
 #include "core/Vec.h"
 #include "core/Ray.h"
-#include <random>
 
 class AreaLight : public Light
 {
@@ -41,19 +40,17 @@ public:
         return color * brightness * cos_theta / area;
     }
 
-    Ray emitPhoton() const
+    Ray emitPhoton(Sampler &sampler) const override
     {
         // Random position on the light surface
-        static thread_local std::mt19937 gen(std::random_device{}());
-        static thread_local std::uniform_real_distribution<double> dist(-0.5, 0.5);
-        double u = dist(gen);
-        double v = dist(gen);
+        double u = sampler.getRandomFloat() - 0.5;
+        double v = sampler.getRandomFloat() - 0.5;
         // Calculate point on light
         vec3 lightPoint = position + u_axis * (u * width) + v_axis * (v * height);
 
         // Sample direction in the hemisphere (cosine-weighted)
-        double r1 = dist(gen);
-        double r2 = dist(gen);
+        double r1 = sampler.getRandomFloat();
+        double r2 = sampler.getRandomFloat();
 
         double phi = 2.0 * M_PI * r1;
         double cos_theta = sqrt(r2); // Cosine-weighted sampling
@@ -23,7 +23,7 @@ public:
         
     }
 
-    virtual Ray emitPhoton() const override {
+    virtual Ray emitPhoton(Sampler &) const override {
         // placeholder implementation
         return Ray(vec3(0), vec3(0, -1, 0)); 
     }
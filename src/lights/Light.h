@@ -2,6 +2,8 @@
 #define __LIGHT_H__
 
 #include "core/Vec.h"
+#include "core/Ray.h"
+#include "core/Sampler.h"
 
 class Light {
 public:
@@ -16,7 +18,8 @@ public:
 
     virtual ~Light() = default;
     virtual vec3 emittedLight(const vec3& direction_to_light) const = 0;
-    virtual Ray emitPhoton() const = 0;
+    // random photon leaving the light, drawing its numbers from sampler
+    virtual Ray emitPhoton(Sampler &sampler) const = 0;
 };
 
 #endif
@@ -19,9 +19,22 @@
 #include "materials/SpecularMaterial.h"
 #include "integrators/PathTracer.h"
 #include "utils/SceneLoader.h"
+#include "core/Kernels.h"
 
-int main()
+int main(int argc, char** argv)
 {
+    // --simd generic|sse4.2|avx2|avx512 runs every kernel at that level instead of the best one, for benchmarking
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) != "--simd") continue;
+        SimdLevel level;
+        if (!parseSimdLevel(argv[i + 1], level)) {
+            std::cerr << "Unknown SIMD level " << argv[i + 1] << ", expected generic, sse4.2, avx2 or avx512" << std::endl;
+            return 1;
+        }
+        if (!selectKernels(level)) return 1;
+    }
+    std::cout << "Kernels: " << simdLevelName(kernels().level) << std::endl;
+
     Scene scene;
     scene.enable_shadows = false;
     SceneLoader(scene, "test.txt");
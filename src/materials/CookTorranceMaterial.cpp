@@ -46,16 +46,16 @@ vec3 CookTorranceMaterial::shade(const Ray &ray, const vec3 &hit_point,
     vec3 view_dir = (ray.origin - hit_point).normalized();
     vec3 color(0.0);
 
-    for (const auto &light : scene.lights) {
+    for (int i = 0; i < static_cast<int>(scene.lights.size()); ++i) {
+        const auto &light = scene.lights[i];
         vec3 light_vec = light->position - hit_point;
         vec3 light_dir = light_vec.normalized();
         vec3 emitted = light->emittedLight(light_vec);
 
         Ray shadow_ray(hit_point + small_t * light_dir, light_dir);
-        Hit shadow_hit = scene.closestIntersection(shadow_ray);
         double light_distance = light_vec.magnitude();
 
-        if (scene.enable_shadows && shadow_hit.object && shadow_hit.t < light_distance)
+        if (scene.enable_shadows && scene.occluded(shadow_ray, light_distance, i))
             continue;
 
         vec3 half_vector = (light_dir + view_dir).normalized();
@@ -13,29 +13,26 @@ public:
         : PhotonMap(num_photons, bounces) {}
 
     // override photon tracing to store only caustic contributions
-    virtual void tracePhoton(const Scene &scene, const Ray &ray, const vec3 &power, int depth) override
+    virtual void tracePhoton(const Scene &scene, const Ray &ray, const vec3 &power, int depth, Sampler &sampler) override
     {
         if (depth >= getMaxBounces()) return;
     
-        Hit hit = scene.closestIntersection(ray);
-        if (!hit.object) {
+        SurfaceInteraction interaction(ray, scene.closestIntersection(ray));
+        if (!interaction.isHit()) {
             return;
         }
     
-        vec3 hit_point = ray.origin + hit.t * ray.direction;
-        vec3 normal = hit.object->getNormal(hit_point);
-        if (dot(normal, -ray.direction) < 0.0)
-            normal = -normal;
-    
-        std::shared_ptr<Material> material = hit.object->material_shader;
+        const Material *material = interaction.getMaterial();
         if (!material) return;
     
-        if (std::dynamic_pointer_cast<EmissiveMaterial>(material)) {
+        if (dynamic_cast<const EmissiveMaterial *>(material)) {
             return;
         }
     
+        const vec3 &hit_point = interaction.getPosition();
+    
         // if we hit diffuse and came from a specular bounce, store the photon
-        if (auto diffuse = std::dynamic_pointer_cast<DiffuseMaterial>(material)) {
+        if (dynamic_cast<const DiffuseMaterial *>(material)) {
             if (depth > 0) {
                 photons.push_back(Photon(hit_point, ray.direction, power));
             }
@@ -44,17 +41,20 @@ public:
     
         // russian roulette
         double continue_prob = 0.9;
-        double rand_val = rand() / static_cast<double>(RAND_MAX);
+        double rand_val = sampler.getRandomFloat();
         if (rand_val > continue_prob) {
             return;
         }
     
         // handle specular bounce
-        if (auto specular = std::dynamic_pointer_cast<SpecularMaterial>(material)) {
+        if (auto specular = dynamic_cast<const SpecularMaterial *>(material)) {
+            vec3 normal = interaction.getShadingNormal();
+            if (dot(normal, interaction.getViewDirection()) < 0.0)
+                normal = -normal;
             vec3 reflect_dir = ray.direction - 2.0 * dot(ray.direction, normal) * normal;
             Ray reflected(hit_point + normal * 0.001, reflect_dir.normalized());
             vec3 new_power = power * specular->color / continue_prob;
-            tracePhoton(scene, reflected, new_power, depth + 1);
+            tracePhoton(scene, reflected, new_power, depth + 1, sampler);
         }
     }
     
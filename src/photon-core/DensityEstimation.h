@@ -2,6 +2,7 @@
 #define __DENSITY_ESTIMATION_H__
 
 #include "PhotonMap.h"
+#include "core/Kernels.h"
 #include <algorithm>
 #include <iostream>
 
@@ -31,24 +32,8 @@ public:
         double searchRadiusSquared = interactions.back().distance;
         if (searchRadiusSquared <= 0.0) return vec3(0);
 
-        vec3 result(0);
-
-        // sum up the contributions of all found photons
-        for (const auto& interaction : interactions) {
-            const Photon* photon = interaction.photon;
-
-            // filter photons based on incident direction (only consider photons coming from the front side)
-            if (dot(normal, -photon->direction) <= 0.0)
-                continue;
-
-            double weight = 1.0;
-            if (kernelType == CONE) {
-                double distRatio = std::sqrt(interaction.distance / searchRadiusSquared);
-                weight = std::max(0.0, 1.0 - distRatio);
-            }
-
-            result += photon->power * weight;
-        }
+        // sum up the contributions of all found photons, only those coming from the front side count
+        vec3 result = kernels().photon_power(interactions.data(), static_cast<int>(interactions.size()), normal, searchRadiusSquared, kernelType == CONE);
 
         // scale by 1/(pi*r²) for density estimation
         double scale = (kernelType == CONE)
@@ -1,101 +1,106 @@
 #include "KdTree.h"
+#include "core/Kernels.h"
 #include <algorithm>
 #include <cmath>
 
-KDTree::KDTree() : root(nullptr) {}
+KDTree::KDTree() {}
 
-KDTree::~KDTree()
+void KDTree::buildTree(std::vector<Photon> &source, int start, int end)
 {
-    deleteTree(root);
-}
+    int node = nodes.size();
+    nodes.push_back(KDNode{0.0, 3, start, end - start});
+    if (end - start <= leaf_size)
+        return;
 
-void KDTree::deleteTree(KDNode *node)
-{
-    if (node)
+    // Split at the median of the axis along which the photons spread the most
+    vec3 lo = source[start].position, hi = source[start].position;
+    for (int i = start + 1; i < end; i++)
     {
-        deleteTree(node->left);
-        deleteTree(node->right);
-        delete node;
+        for (int a = 0; a < 3; a++)
+        {
+            lo[a] = std::min(lo[a], source[i].position[a]);
+            hi[a] = std::max(hi[a], source[i].position[a]);
+        }
     }
-}
+    vec3 extent = hi - lo;
+    int axis = extent[0] > extent[1] && extent[0] > extent[2] ? 0 : (extent[1] > extent[2] ? 1 : 2);
 
-KDTree::KDNode *KDTree::buildTree(std::vector<Photon> &photons, int start, int end, int depth)
-{
-    if (start >= end)
-        return nullptr;
-
-    int axis = depth % 3; // cycle through x, y, z axes
-
-    // Sort photons based on current axis
     int mid = start + (end - start) / 2;
     std::nth_element(
-        photons.begin() + start,
-        photons.begin() + mid,
-        photons.begin() + end,
+        source.begin() + start,
+        source.begin() + mid,
+        source.begin() + end,
         [axis](const Photon &a, const Photon &b)
         {
             return a.position[axis] < b.position[axis];
         });
 
-    // Create node and recursively build subtrees
-    KDNode *node = new KDNode(photons[mid], axis);
-    node->left = buildTree(photons, start, mid, depth + 1);
-    node->right = buildTree(photons, mid + 1, end, depth + 1);
-
-    return node;
+    nodes[node].split = source[mid].position[axis];
+    nodes[node].axis = axis;
+    buildTree(source, start, mid);
+    nodes[node].child = nodes.size();
+    buildTree(source, mid, end);
 }
 
-void KDTree::build(std::vector<Photon> &photons)
+void KDTree::build(std::vector<Photon> &source)
 {
     // Clear any existing tree
-    deleteTree(root);
-    root = nullptr;
+    nodes.clear();
+    photons.clear();
+    for (auto &axis_coordinates : coordinates)
+        axis_coordinates.clear();
 
-    if (photons.empty())
+    if (source.empty())
         return;
 
-    // Build the tree recursively
-    root = buildTree(photons, 0, photons.size(), 0);
+    // Build the tree recursively, the leaves then hold contiguous ranges of the reordered photons
+    buildTree(source, 0, source.size());
+    photons = source;
+    for (int a = 0; a < 3; a++)
+    {
+        coordinates[a].resize(photons.size());
+        for (size_t i = 0; i < photons.size(); i++)
+            coordinates[a][i] = photons[i].position[a];
+    }
 }
 
 void KDTree::findNearestNeighbors(
-    KDNode *node,
+    int node_index,
     const vec3 &position,
-    double maxDistSquared,
+    double &maxDistSquared,
     int maxPhotons,
     std::vector<PhotonInteraction> &result) const
 {
-    if (!node)
-        return;
-
-    // Calculate distance to current photon
-    vec3 diff = position - node->photon.position;
-    double distSquared = dot(diff, diff);
-
-    // If within search radius, add to results
-    if (distSquared < maxDistSquared)
+    const KDNode &node = nodes[node_index];
+    if (node.axis == 3)
     {
-        // Add this photon to our result
-        result.push_back(PhotonInteraction(&node->photon, distSquared));
-
-        // Keep the result sorted by distance (closest first)
-        std::sort(result.begin(), result.end());
-
-        // If we have too many photons, remove the farthest one
-        if (result.size() > maxPhotons)
+        // Distances of the whole leaf at once, then keep the ones that beat the current farthest
+        double distances[leaf_size];
+        kernels().photon_distances(&coordinates[0][node.child], &coordinates[1][node.child], &coordinates[2][node.child],
+                                   node.count, position, distances);
+        for (int i = 0; i < node.count; i++)
         {
-            result.pop_back();
-
-            // Update search radius to the farthest photon in our result set
-            maxDistSquared = result.back().distance;
+            if (!(distances[i] < maxDistSquared))
+                continue;
+            if (static_cast<int>(result.size()) == maxPhotons)
+            {
+                std::pop_heap(result.begin(), result.end());
+                result.pop_back();
+            }
+            result.push_back(PhotonInteraction(&photons[node.child + i], distances[i]));
+            std::push_heap(result.begin(), result.end());
+
+            // Once full, only photons closer than the farthest one found can still get in
+            if (static_cast<int>(result.size()) == maxPhotons)
+                maxDistSquared = result.front().distance;
         }
+        return;
     }
 
-    // Determine which subtree to search first based on the split axis
-    int axis = node->axis;
-    double axisDist = position[axis] - node->photon.position[axis];
-    KDNode *nearNode = (axisDist < 0) ? node->left : node->right;
-    KDNode *farNode = (axisDist < 0) ? node->right : node->left;
+    // Determine which subtree to search first based on the split plane
+    double axisDist = position[node.axis] - node.split;
+    int nearNode = (axisDist < 0) ? node_index + 1 : node.child;
+    int farNode = (axisDist < 0) ? node.child : node_index + 1;
 
     // Search the near subtree first
     findNearestNeighbors(nearNode, position, maxDistSquared, maxPhotons, result);
@@ -113,14 +118,18 @@ std::vector<PhotonInteraction> KDTree::findNearest(
     int maxPhotons) const
 {
     std::vector<PhotonInteraction> result;
+    if (nodes.empty() || maxPhotons <= 0)
+        return result;
     result.reserve(maxPhotons);
 
-    findNearestNeighbors(root, position, maxDistSquared, maxPhotons, result);
+    findNearestNeighbors(0, position, maxDistSquared, maxPhotons, result);
 
+    // Sorted by distance (closest first)
+    std::sort_heap(result.begin(), result.end());
     return result;
 }
 
 bool KDTree::isEmpty() const
 {
-    return root == nullptr;
-}
\ No newline at end of file
+    return nodes.empty();
+}
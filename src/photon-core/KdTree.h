@@ -4,43 +4,19 @@
 #include <vector>
 #include "Photon.h"
 
+// Photon kd-tree with buckets of up to leaf_size photons per leaf. The photons are copied in leaf order and
+// their positions are also kept per axis, so a leaf is scanned by one distance kernel over contiguous memory.
 class KDTree
 {
-private:
-    struct KDNode
-    {
-        Photon photon;
-        KDNode *left;
-        KDNode *right;
-        int axis; // Split axis (0=x, 1=y, 2=z)
-
-        KDNode(const Photon &p, int ax) : photon(p), left(nullptr), right(nullptr), axis(ax) {}
-    };
-
-    KDNode *root;
-
-    // Recursive function to build the KD-tree
-    KDNode *buildTree(std::vector<Photon> &photons, int start, int end, int depth);
-
-    // Delete the tree recursively
-    void deleteTree(KDNode *node);
-
-    // Recursive nearest neighbors search
-    void findNearestNeighbors(
-        KDNode *node,
-        const vec3 &position,
-        double maxDistSquared,
-        int maxPhotons,
-        std::vector<PhotonInteraction> &result) const;
-
 public:
+    static constexpr int leaf_size = 8;
+
     KDTree();
-    ~KDTree();
 
-    // Build the KD-tree from a vector of photons
-    void build(std::vector<Photon> &photons);
+    // Build the KD-tree from a vector of photons (reordered in place while building)
+    void build(std::vector<Photon> &source);
 
-    // Find nearest neighbors within a given radius
+    // Find the maxPhotons nearest photons within the given squared radius, closest first
     std::vector<PhotonInteraction> findNearest(
         const vec3 &position,
         double maxDistSquared,
@@ -48,6 +24,30 @@ public:
 
     // Check if the KD-tree is empty
     bool isEmpty() const;
+
+private:
+    struct KDNode
+    {
+        double split; // Split plane position
+        int axis;     // Split axis (0=x, 1=y, 2=z), 3 for a leaf
+        int child;    // Interior: index of the child above the plane (the one below is the next node), leaf: first photon
+        int count;    // Leaf: number of photons
+    };
+
+    std::vector<KDNode> nodes;          // nodes[0] is the root
+    std::vector<Photon> photons;        // leaf order
+    std::vector<double> coordinates[3]; // photon positions per axis, leaf order
+
+    // Recursive function to build the KD-tree over photons [start, end)
+    void buildTree(std::vector<Photon> &source, int start, int end);
+
+    // Recursive nearest neighbors search, result is a max-heap on distance while searching
+    void findNearestNeighbors(
+        int node_index,
+        const vec3 &position,
+        double &maxDistSquared,
+        int maxPhotons,
+        std::vector<PhotonInteraction> &result) const;
 };
 
-#endif // KDTREE_H
\ No newline at end of file
+#endif // KDTREE_H
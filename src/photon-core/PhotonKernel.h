@@ -0,0 +1,37 @@
+#ifndef __PHOTON_KERNEL_H__
+#define __PHOTON_KERNEL_H__
+
+#include <algorithm>
+#include <cmath>
+#include "core/Vec.h"
+#include "utils/CpuFeatures.h"
+#include "Photon.h"
+
+// photon map kernels, compiled per instruction set level through core/Kernels.h
+
+// squared distances of a kd-tree leaf's photons, given per axis, to the query point
+SIMD_INLINE void photonDistances(const double* x, const double* y, const double* z, int count, const vec3& point, double* distance_squared)
+{
+    const double px = point[0], py = point[1], pz = point[2];
+    for (int i = 0; i < count; i++) {
+        double dx = x[i] - px, dy = y[i] - py, dz = z[i] - pz;
+        distance_squared[i] = dx * dx + dy * dy + dz * dz;
+    }
+}
+
+// summed power of the gathered photons that arrive at the front of normal, each weighted by the cone
+// filter 1 - r / radius when cone is set
+SIMD_INLINE vec3 photonPower(const PhotonInteraction* interactions, int count, const vec3& normal, double radius_squared, bool cone)
+{
+    double sum[3] = {0.0, 0.0, 0.0};
+    for (int i = 0; i < count; i++) {
+        const Photon& photon = *interactions[i].photon;
+        double facing = -(normal[0] * photon.direction[0] + normal[1] * photon.direction[1] + normal[2] * photon.direction[2]);
+        double weight = cone ? std::max(0.0, 1.0 - std::sqrt(interactions[i].distance / radius_squared)) : 1.0;
+        weight = facing > 0.0 ? weight : 0.0;
+        for (int c = 0; c < 3; c++) sum[c] += photon.power[c] * weight;
+    }
+    return vec3(sum[0], sum[1], sum[2]);
+}
+
+#endif
@@ -2,10 +2,11 @@
 #define __PHOTON_MAP_H__
 #define _USE_MATH_DEFINES
 #include <vector>
-#include <random>
 #include "core/Vec.h"
 #include "core/Ray.h"
 #include "core/Scene.h"
+#include "core/Sampler.h"
+#include "geometry/SurfaceInteraction.h"
 #include "Photon.h"
 #include <cmath>
 #include "materials/DiffuseMaterial.h"
@@ -21,19 +22,17 @@ protected:
     std::vector<Photon> photons;
     int max_photons;
     int max_bounces;
-    std::mt19937 rng;
-    std::uniform_real_distribution<double> dist;
     KDTree kdtree;
 
 public:
     PhotonMap(int num_photons = 5000, int bounces = 5)
-        : max_photons(num_photons), max_bounces(bounces),
-          rng(std::random_device{}()), dist(0.0, 1.0)
+        : max_photons(num_photons), max_bounces(bounces)
     {
         photons.reserve(max_photons);
     }
 
-    void buildPhotonMap(const Scene &scene, int numPhotons)
+    // photon i of light l draws from the photon stream (seed, l, i), so the map only depends on the seed
+    void buildPhotonMap(const Scene &scene, int numPhotons, unsigned int seed = 0)
     {
         photons.clear();
         photons.reserve(numPhotons);
@@ -50,19 +49,22 @@ public:
         std::cout << "Emitting " << photonsPerLight << " photons per light..." << std::endl;
 
         // For each light in the scene
-        for (const auto &light : scene.lights)
+        for (int light_index = 0; light_index < static_cast<int>(scene.lights.size()); light_index++)
         {
+            const auto &light = scene.lights[light_index];
             // Calculate initial power for each photon from this light
             vec3 photonPower = light->color * light->brightness * 10.0 / photonsPerLight; // Increase power scale
 
             // THIS IS WHERE emitPhoton() IS CALLED
             for (int i = 0; i < photonsPerLight; i++)
             {
+                Sampler sampler(seed, light_index, i, SampleDomain::Photon);
+
                 // Get ray from light - this calls the emitPhoton() method
-                Ray photonRay = light->emitPhoton();
+                Ray photonRay = light->emitPhoton(sampler);
 
                 // For each hit, create a Photon object and store it
-                tracePhoton(scene, photonRay, photonPower, 0);
+                tracePhoton(scene, photonRay, photonPower, 0, sampler);
             }
         }
 
@@ -74,7 +76,7 @@ public:
         std::cout << "KD-tree built successfully." << std::endl;
     }
 
-    virtual void tracePhoton(const Scene &scene, const Ray &ray, const vec3 &power, int depth)
+    virtual void tracePhoton(const Scene &scene, const Ray &ray, const vec3 &power, int depth, Sampler &sampler)
     {
         if (depth > 10)
         {
@@ -86,15 +88,15 @@ public:
             return;
         }
 
-        Hit hit = scene.closestIntersection(ray);
-        if (!hit.object)
+        SurfaceInteraction interaction(ray, scene.closestIntersection(ray));
+        if (!interaction.isHit())
         {
             return;
         }
 
         // Calculate hit point and normal
-        vec3 hit_point = ray.origin + hit.t * ray.direction;
-        vec3 normal = hit.object->getNormal(hit_point);
+        const vec3 &hit_point = interaction.getPosition();
+        vec3 normal = interaction.getShadingNormal();
 
         // Ensure normal faces the right way (toward incoming direction)
         if (dot(normal, -ray.direction) < 0.0)
@@ -103,18 +105,18 @@ public:
         }
 
         // Get the material
-        auto *material = hit.object->material_shader.get();
+        const Material *material = interaction.getMaterial();
 
         // Check if it's a DiffuseMaterial (we'll store photons at diffuse surfaces)
-        DiffuseMaterial *diffuse_material = dynamic_cast<DiffuseMaterial *>(material);
-        SpecularMaterial *specular_material = dynamic_cast<SpecularMaterial *>(material);
-        EmissiveMaterial *emissive_material = dynamic_cast<EmissiveMaterial *>(material);
+        const DiffuseMaterial *diffuse_material = dynamic_cast<const DiffuseMaterial *>(material);
+        const SpecularMaterial *specular_material = dynamic_cast<const SpecularMaterial *>(material);
+        const EmissiveMaterial *emissive_material = dynamic_cast<const EmissiveMaterial *>(material);
 
         // Russian roulette for path termination - prevents bias
 
         double continue_prob = std::max(0.75 * std::pow(0.5, depth), 0.1);
 
-        double random_value = static_cast<double>(rand()) / RAND_MAX;
+        double random_value = sampler.getRandomFloat();
         if (diffuse_material)
         {
             vec3 albedo = diffuse_material->diffuse.color_diffuse;
@@ -151,8 +153,8 @@ public:
             vec3 material_color = diffuse_material->diffuse.color_diffuse;
 
             // Generate new direction in hemisphere (cosine-weighted)
-            double r1 = static_cast<double>(rand()) / RAND_MAX;
-            double r2 = static_cast<double>(rand()) / RAND_MAX;
+            double r1 = sampler.getRandomFloat();
+            double r2 = sampler.getRandomFloat();
 
             double phi = 2.0 * M_PI * r1;
             double cos_theta = sqrt(r2); // Cosine-weighted sampling
@@ -184,7 +186,7 @@ public:
             vec3 new_power = power * material_color / continue_prob;
 
             // Trace next bounce
-            tracePhoton(scene, new_ray, new_power, depth + 1);
+            tracePhoton(scene, new_ray, new_power, depth + 1, sampler);
         }
         else if (specular_material)
         {
@@ -197,14 +199,14 @@ public:
             vec3 specular_color = specular_material->color;
 
             vec3 new_power = power * specular_color / continue_prob;
-            tracePhoton(scene, new_ray, new_power, depth + 1);
+            tracePhoton(scene, new_ray, new_power, depth + 1, sampler);
         }
         else
         {
             // For non-diffuse materials, we can still have bounces but might not store photonss
             // We use a default bounce with reduced energy
-            double r1 = static_cast<double>(rand()) / RAND_MAX;
-            double r2 = static_cast<double>(rand()) / RAND_MAX;
+            double r1 = sampler.getRandomFloat();
+            double r2 = sampler.getRandomFloat();
 
             double phi = 2.0 * M_PI * r1;
             double cos_theta = sqrt(r2);
@@ -223,7 +225,7 @@ public:
             Ray new_ray(hit_point + normal * 0.001, new_dir);
             vec3 new_power = power * 0.5 / continue_prob; // Default attenuation
 
-            tracePhoton(scene, new_ray, new_power, depth + 1);
+            tracePhoton(scene, new_ray, new_power, depth + 1, sampler);
         }
     }
 
@@ -0,0 +1,41 @@
+#include "utils/CpuFeatures.h"
+
+
+SimdLevel detectSimdLevel() {
+#ifdef SIMD_DISPATCH
+    // __builtin_cpu_supports also checks that the OS saves the wider registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx512bw")) {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return SimdLevel::SSE42;
+#endif
+    return SimdLevel::Generic;
+}
+
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::SSE42:
+        return "sse4.2";
+    case SimdLevel::AVX2:
+        return "avx2";
+    case SimdLevel::AVX512:
+        return "avx512";
+    default:
+        return "generic";
+    }
+}
+
+
+bool parseSimdLevel(const std::string& name, SimdLevel& level) {
+    for (SimdLevel candidate : {SimdLevel::Generic, SimdLevel::SSE42, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (name == simdLevelName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,34 @@
+#ifndef __CPU_FEATURES_H__
+#define __CPU_FEATURES_H__
+
+#include <string>
+
+// instruction set levels the hot kernels are compiled for, each one includes the ones before it
+enum class SimdLevel {
+    Generic, // whatever the target was compiled for, SSE2 on x86-64
+    SSE42,
+    AVX2,
+    AVX512
+};
+
+// with GCC or Clang on x86 the variants are compiled into one binary through target attributes and picked at
+// run time, see core/Kernels.h. elsewhere only the generic variant exists
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_DISPATCH
+#define SIMD_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx512f,avx512vl,avx512dq,avx512bw")))
+// kernels are inlined into each variant's entry point so they pick up its instruction set
+#define SIMD_INLINE __attribute__((always_inline)) inline
+#else
+#define SIMD_INLINE inline
+#endif
+
+// the highest level this CPU and operating system support
+SimdLevel detectSimdLevel();
+
+const char* simdLevelName(SimdLevel level);
+// accepts the names simdLevelName gives, false for anything else
+bool parseSimdLevel(const std::string& name, SimdLevel& level);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __FLOAT_ROUNDING_H__
+#define __FLOAT_ROUNDING_H__
+
+#include <cmath>
+#include <limits>
+#include "core/Ray.h"
+
+// helpers for running box tests in single precision without ever missing a box the double test would hit.
+// bounds are rounded outwards when converted, and slab distances are padded by the rounding error bound.
+
+// largest float that is <= value
+inline float roundDown(double value) {
+    float f = static_cast<float>(value);
+    return static_cast<double>(f) > value ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+// smallest float that is >= value
+inline float roundUp(double value) {
+    float f = static_cast<float>(value);
+    return static_cast<double>(f) < value ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+// bound on the relative error of n chained float operations (pbrt's gamma_n)
+inline constexpr float floatErrorBound(int n) {
+    return (n * 0.5f * std::numeric_limits<float>::epsilon()) / (1 - n * 0.5f * std::numeric_limits<float>::epsilon());
+}
+
+// per-query constants of the single precision slab test. the origin is bounded by the two nearest
+// floats so that both slab distances err on the side of reporting a hit.
+struct FloatRay {
+    float origin_near[3]; // origin used against the near planes
+    float origin_far[3];  // origin used against the far planes
+    float inv_direction[3];
+    int sign[3];
+
+    explicit FloatRay(const Ray& ray) {
+        for (int a = 0; a < 3; ++a) {
+            sign[a] = ray.sign[a];
+            inv_direction[a] = static_cast<float>(ray.inv_direction[a]);
+            origin_near[a] = sign[a] ? roundDown(ray.origin[a]) : roundUp(ray.origin[a]);
+            origin_far[a] = sign[a] ? roundUp(ray.origin[a]) : roundDown(ray.origin[a]);
+        }
+    }
+};
+
+// factor on the far slab distance that covers the rounding of the subtraction, the multiply and the float reciprocal
+inline constexpr float float_far_padding = 1.0f + 2.0f * floatErrorBound(4);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_MMAP
+#endif
+
+// read-only view of a whole file. with mmap the operating system pages the contents in on first touch and
+// residency can be steered per byte range, elsewhere the file is simply read into memory
+class MappedFile {
+public:
+    static constexpr size_t page_size = 4096; // ranges handed to willNeed / dontNeed should start on this
+
+    explicit MappedFile(const std::string& path)
+    {
+#ifdef MAPPED_FILE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || ::fstat(fd, &info) != 0 || info.st_size == 0) {
+            std::cerr << "Error: Could not map " << path << std::endl;
+            if (fd >= 0) ::close(fd);
+            return;
+        }
+        void* mapping = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping keeps the file alive
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Error: Could not map " << path << std::endl;
+            return;
+        }
+        bytes = static_cast<const uint8_t*>(mapping);
+        length = static_cast<size_t>(info.st_size);
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "Error: Could not open " << path << std::endl;
+            return;
+        }
+        contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        bytes = contents.data();
+        length = contents.size();
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef MAPPED_FILE_MMAP
+        if (bytes) ::munmap(const_cast<uint8_t*>(bytes), length);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const { return bytes != nullptr; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    // start reading the range in ahead of its first use
+    void willNeed(size_t offset, size_t count) const
+    {
+#ifdef MAPPED_FILE_MMAP
+        ::madvise(const_cast<uint8_t*>(bytes) + offset, count, MADV_WILLNEED);
+#endif
+    }
+
+    // drop the pages of the range. they are read from the file again if touched later, so this only costs time
+    void dontNeed(size_t offset, size_t count) const
+    {
+#ifdef MAPPED_FILE_MMAP
+        ::madvise(const_cast<uint8_t*>(bytes) + offset, count, MADV_DONTNEED);
+#endif
+    }
+
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#ifndef MAPPED_FILE_MMAP
+    std::vector<uint8_t> contents;
+#endif
+};
+
+#endif
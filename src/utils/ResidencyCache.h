@@ -0,0 +1,116 @@
+#ifndef __RESIDENCY_CACHE_H__
+#define __RESIDENCY_CACHE_H__
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// which items of a large set (e.g. geometry chunks) are kept in memory, under a byte budget. touching an item
+// that is not resident loads it, evicting the least recently used items until it fits. an item larger than the
+// whole budget is still loaded, alone. load and evict run under the lock and should not take long.
+// touching a resident item takes no lock and writes nothing shared: it only reads the item's flag and, when the
+// clock moved since, stores the new stamp. the clock advances once per miss, so the LRU order is approximate,
+// items used between the same two misses tie. evict must leave the item readable (e.g. only drop the page
+// cache), a thread that saw it resident just before may still be using it
+class ResidencyCache {
+public:
+    struct Stats {
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t resident_bytes = 0;
+        size_t budget_bytes = 0;
+    };
+
+    ResidencyCache(size_t budget_bytes, std::function<void(int)> load, std::function<void(int)> evict)
+        : budget(budget_bytes), load(std::move(load)), evict(std::move(evict)) {}
+
+    // items are 0 .. item_count - 1, call once before the first touch
+    void setItemCount(int item_count)
+    {
+        slots.reset(new Slot[item_count]);
+    }
+
+    // mark item as just used, loading it first if needed. true if it was already resident
+    bool touch(int item, size_t bytes)
+    {
+        Slot& slot = slots[item];
+        if (slot.resident.load(std::memory_order_acquire)) {
+            stamp(slot);
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (slot.resident.load(std::memory_order_relaxed)) { // another thread loaded it meanwhile
+            stamp(slot);
+            return true;
+        }
+        ++stats.misses;
+        uint64_t now = clock.load(std::memory_order_relaxed) + 1;
+        clock.store(now, std::memory_order_relaxed);
+        while (!resident_items.empty() && stats.resident_bytes + bytes > budget) {
+            // oldest stamp, a scan is fine for the few thousand chunks a mesh has
+            size_t oldest = 0;
+            for (size_t i = 1; i < resident_items.size(); i++) {
+                if (slots[resident_items[i]].last_use.load(std::memory_order_relaxed) <
+                    slots[resident_items[oldest]].last_use.load(std::memory_order_relaxed)) {
+                    oldest = i;
+                }
+            }
+            int victim = resident_items[oldest];
+            resident_items[oldest] = resident_items.back();
+            resident_items.pop_back();
+            slots[victim].resident.store(false, std::memory_order_relaxed);
+            stats.resident_bytes -= slots[victim].bytes;
+            evict(victim);
+            ++stats.evictions;
+        }
+        load(item);
+        slot.bytes = bytes;
+        slot.last_use.store(now, std::memory_order_relaxed);
+        slot.resident.store(true, std::memory_order_release);
+        resident_items.push_back(item);
+        stats.resident_bytes += bytes;
+        return false;
+    }
+
+    bool isResident(int item) const
+    {
+        return slots[item].resident.load(std::memory_order_acquire);
+    }
+
+    Stats getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats copy = stats;
+        copy.budget_bytes = budget;
+        return copy;
+    }
+
+private:
+    struct Slot {
+        std::atomic<bool> resident{false};
+        std::atomic<uint64_t> last_use{0}; // clock when last touched
+        size_t bytes = 0;                  // written under the lock
+    };
+
+    // skip the store when the stamp is current, so threads sharing a hot item do not bounce its cache line
+    void stamp(Slot& slot) const
+    {
+        uint64_t now = clock.load(std::memory_order_relaxed);
+        if (slot.last_use.load(std::memory_order_relaxed) != now) slot.last_use.store(now, std::memory_order_relaxed);
+    }
+
+    size_t budget;
+    std::function<void(int)> load, evict;
+    mutable std::mutex mutex;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> clock{0}; // advanced under the lock by every miss
+    std::vector<int> resident_items; // under the lock
+    Stats stats;                     // under the lock
+};
+
+#endif
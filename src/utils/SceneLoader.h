@@ -1,6 +1,7 @@
 #include <map>
 #include <sstream>
 #include <string>
+#include <tuple>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -11,6 +12,8 @@
 #include "geometry/Sphere.h"
 #include "geometry/Triangle.h"
 #include "geometry/TriangleMesh.h"
+#include "geometry/ChunkedMesh.h"
+#include "geometry/SphereCloud.h"
 #include "materials/DiffuseMaterial.h"
 #include "materials/CookTorranceMaterial.h"
 #include "materials/EmissiveMaterial.h"
@@ -38,6 +41,27 @@ void SceneLoader(Scene& scene, const char* test_file)
     double f0;
     char buff[1000];
 
+    // particle lines are gathered into one SphereCloud, spheres of one color share a material
+    std::vector<vec3> particle_centers;
+    std::vector<double> particle_radii;
+    std::vector<uint32_t> particle_material_ids;
+    std::vector<std::shared_ptr<Material>> particle_materials;
+    std::map<std::tuple<double, double, double>, uint32_t> particle_material_of;
+    auto addParticles = [&]() {
+        if (particle_centers.empty()) return;
+        scene.addObject(std::make_shared<SphereCloud>(particle_centers, particle_radii, particle_materials, particle_material_ids));
+        particle_centers.clear();
+        particle_radii.clear();
+        particle_material_ids.clear();
+        particle_materials.clear();
+        particle_material_of.clear();
+    };
+
+    // set by the wavefront directive, 0 keeps the tracer on photon mapping
+    int wavefront_paths = 0;
+    // set by the tilesize directive, 0 lets the tracer pick
+    int tile_size = 0;
+
     
     while (std::getline(file, line)) 
     {
@@ -65,6 +89,18 @@ void SceneLoader(Scene& scene, const char* test_file)
             sphere->material_shader = std::make_shared<DiffuseMaterial>(vec3(std::stod(result[5]), std::stod(result[6]), std::stod(result[7])));
             scene.addObject(sphere);
         }
+        else if(result[0]=="particle")
+        {
+            particle_centers.push_back(vec3(std::stod(result[1]), std::stod(result[2]), std::stod(result[3])));
+            particle_radii.push_back(std::stod(result[4]));
+            auto color = std::make_tuple(std::stod(result[5]), std::stod(result[6]), std::stod(result[7]));
+            auto found = particle_material_of.find(color);
+            if (found == particle_material_of.end()) {
+                found = particle_material_of.emplace(color, static_cast<uint32_t>(particle_materials.size())).first;
+                particle_materials.push_back(std::make_shared<DiffuseMaterial>(vec3(std::get<0>(color), std::get<1>(color), std::get<2>(color))));
+            }
+            particle_material_ids.push_back(found->second);
+        }
         else if(result[0]=="spherecook")
         {
             auto sphere = std::make_shared<Sphere>(vec3(std::stod(result[1]), std::stod(result[2]), std::stod(result[3])), std::stod(result[4]));
@@ -91,6 +127,15 @@ void SceneLoader(Scene& scene, const char* test_file)
                 std::make_shared<DiffuseMaterial>(vec3(std::stod(result[10]), std::stod(result[11]), std::stod(result[12]))));
             scene.addObject(triangle);
         }        
+        else if(result[0]=="chunkedmesh")
+        {
+            // a file written by ChunkedMesh::writeFile, paged in on demand within a cache of the given MB (default 256)
+            size_t cache_mb = result.size() > 5 ? std::stoul(result[5]) : 256;
+            auto mesh = std::make_shared<ChunkedMesh>(result[1],
+                std::make_shared<DiffuseMaterial>(vec3(std::stod(result[2]), std::stod(result[3]), std::stod(result[4]))),
+                cache_mb << 20);
+            if (mesh->isLoaded()) scene.addObject(mesh);
+        }
         else if(result[0]=="ambientcolor")
         {
             scene.ambient_color = vec3(std::stod(result[1]), std::stod(result[2]), std::stod(result[3]));
@@ -99,6 +144,53 @@ void SceneLoader(Scene& scene, const char* test_file)
         {
             scene.ambient_intensity = std::stod(result[1]);
         }
+        else if(result[0] == "accelerator")
+        {
+            // bvh (the default) or kdtree, the structure answering the ray queries
+            scene.accelerator_type = result[1] == "kdtree" ? AcceleratorType::KdTree : AcceleratorType::BVH;
+        }
+        else if(result[0] == "bvhwidth")
+        {
+            // 2 traverses the binary BVH, 4 or 8 collapse it into a wide BVH with SIMD box tests
+            scene.bvh_width = std::stoi(result[1]);
+        }
+        else if(result[0] == "bvhnodes")
+        {
+            // compressed stores the wide nodes with 8-bit child bounds relative to their parent, for bvhwidth 4 and 8
+            scene.bvh_compressed = result[1] == "compressed";
+        }
+        else if(result[0] == "bvhquality")
+        {
+            // fast and medium use the Morton code builder, high (the default) the binned SAH builder
+            if (result[1] == "fast") scene.bvh_settings.quality = BVHBuildQuality::Fast;
+            else if (result[1] == "medium") scene.bvh_settings.quality = BVHBuildQuality::Medium;
+            else scene.bvh_settings.quality = BVHBuildQuality::High;
+        }
+        else if(result[0] == "bvhspatialsplits")
+        {
+            // SBVH: large triangles may be split across nodes, adding up to this fraction of extra references
+            scene.bvh_settings.spatial_split_budget = std::stod(result[1]);
+        }
+        else if(result[0] == "bvhlazy")
+        {
+            // subtrees of at most this many objects are built when a ray first enters them, with bvhquality high
+            scene.bvh_settings.lazy_subtree_size = std::stoi(result[1]);
+        }
+        else if(result[0] == "bvhprecision")
+        {
+            // single traverses float nodes and float primitive copies, re-intersecting the closest hit in double
+            scene.bvh_settings.single_precision = result[1] == "single";
+        }
+        else if(result[0] == "wavefront")
+        {
+            // path trace in waves of this many paths (optional), sorting rays and hits between the stages
+            wavefront_paths = result.size() > 1 ? std::stoi(result[1]) : 1 << 18;
+        }
+        else if(result[0] == "tilesize")
+        {
+            // edge in pixels of the tiles the render threads share out
+            tile_size = std::stoi(result[1]);
+        }
         else if(result[0] =="shadow")
         {
             scene.enable_shadows = true;
@@ -133,11 +225,23 @@ void SceneLoader(Scene& scene, const char* test_file)
             );
             scene.addLight(areaLight);
             scene.prepareLights();
+            addParticles();
             PathTracer tracer(std::stoi(result[1]), std::stoi(result[2]), std::stod(result[3]), std::stod(result[4]));
-            tracer.setRenderMode(PHOTON_MAPPING);
+            tracer.tile_size = tile_size;
+            if (wavefront_paths > 0)
+            {
+                tracer.wavefront = true;
+                tracer.wavefront_paths = wavefront_paths;
+                tracer.setRenderMode(PATH_TRACING);
+            }
+            else
+            {
+                tracer.setRenderMode(PHOTON_MAPPING);
+            }
             tracer.render(scene);
         }
     }
+    addParticles();
 }
 
 
@@ -0,0 +1,124 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <thread>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+// tasks of one fork-join region that have not finished yet
+struct TaskGroup {
+    std::atomic<int> pending{0};
+};
+
+// fixed set of worker threads for fork-join work such as the BVH build. a thread waiting on a group runs
+// queued tasks itself instead of blocking, so tasks may submit and wait on nested groups without deadlock.
+// with a single hardware thread there are no workers and submitted tasks simply run inline.
+class ThreadPool {
+public:
+    explicit ThreadPool(int thread_count)
+    {
+        for (int i = 1; i < thread_count; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // shared pool sized to the machine
+    static ThreadPool& global()
+    {
+        static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+    // workers plus the calling thread, which helps while it waits
+    int getThreadCount() const { return static_cast<int>(workers.size()) + 1; }
+
+    void submit(TaskGroup& group, std::function<void()> task)
+    {
+        if (workers.empty()) {
+            task();
+            return;
+        }
+        group.pending++;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back([&group, task = std::move(task)] {
+                task();
+                group.pending--;
+            });
+        }
+        wake.notify_one();
+    }
+
+    void wait(TaskGroup& group)
+    {
+        while (group.pending > 0) {
+            std::function<void()> task;
+            if (tryPop(task)) task();
+            else std::this_thread::yield();
+        }
+    }
+
+    // body(chunk_begin, chunk_end) over [begin, end) split into chunks of chunk_size, returns when all are done
+    template<class Body>
+    void parallelFor(int begin, int end, int chunk_size, const Body& body)
+    {
+        TaskGroup group;
+        for (int chunk = begin; chunk < end; chunk += chunk_size) {
+            int chunk_end = std::min(end, chunk + chunk_size);
+            submit(group, [&body, chunk, chunk_end] { body(chunk, chunk_end); });
+        }
+        wait(group);
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    // waiting threads take the newest task, which is the one their own group most likely just pushed
+    bool tryPop(std::function<void()>& task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty()) return false;
+        task = std::move(tasks.back());
+        tasks.pop_back();
+        return true;
+    }
+
+    void workerLoop()
+    {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+#endif
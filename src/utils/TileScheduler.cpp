@@ -0,0 +1,109 @@
+#include "utils/TileScheduler.h"
+#include <algorithm>
+#include <cstdint>
+
+
+// position of (x, y) along the Hilbert curve filling a grid of n x n cells, n a power of two
+static uint64_t hilbertIndex(uint32_t n, uint32_t x, uint32_t y) {
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+        // rotate the quadrant so the curve stays continuous
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+
+int TileScheduler::autoTileSize(int image_width, int image_height, int worker_count) {
+    const int tiles_per_worker = 16;
+    int size = 64;
+    while (size > 8) {
+        int tiles = ((image_width + size - 1) / size) * ((image_height + size - 1) / size);
+        if (tiles >= tiles_per_worker * worker_count) break;
+        size -= 8;
+    }
+    return size;
+}
+
+
+TileScheduler::TileScheduler(int image_width, int image_height, int tile_size, int worker_count)
+    : tile_size(tile_size > 0 ? tile_size : autoTileSize(image_width, image_height, worker_count)) {
+    int tiles_x = (image_width + this->tile_size - 1) / this->tile_size;
+    int tiles_y = (image_height + this->tile_size - 1) / this->tile_size;
+    uint32_t grid = 1;
+    while (grid < static_cast<uint32_t>(std::max(tiles_x, tiles_y))) grid *= 2;
+
+    std::vector<std::pair<uint64_t, Tile>> order;
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            Tile tile;
+            tile.origin = ivec2(tx * this->tile_size, ty * this->tile_size);
+            tile.size = ivec2(std::min(this->tile_size, image_width - tile.origin[0]),
+                              std::min(this->tile_size, image_height - tile.origin[1]));
+            order.push_back(std::make_pair(hilbertIndex(grid, tx, ty), tile));
+        }
+    }
+    std::sort(order.begin(), order.end(), [](const std::pair<uint64_t, Tile>& a, const std::pair<uint64_t, Tile>& b) {
+        return a.first < b.first;
+    });
+    tile_count = static_cast<int>(order.size());
+
+    // deal contiguous runs of the curve, the first tile_count % workers workers get one extra
+    worker_count = std::max(1, worker_count);
+    for (int w = 0; w < worker_count; w++) queues.push_back(std::make_unique<WorkerQueue>());
+    int first = 0;
+    for (int w = 0; w < worker_count; w++) {
+        int count = tile_count / worker_count + (w < tile_count % worker_count ? 1 : 0);
+        for (int i = first; i < first + count; i++) queues[w]->tiles.push_back(order[i].second);
+        first += count;
+    }
+}
+
+
+bool TileScheduler::next(int worker, Tile& tile) {
+    WorkerQueue& own = *queues[worker];
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tiles.empty()) {
+            tile = own.tiles.front();
+            own.tiles.pop_front();
+            return true;
+        }
+    }
+    return steal(worker, tile);
+}
+
+
+// take the last tile of the worker with the most left, the far end of its run, away from where it works
+bool TileScheduler::steal(int thief, Tile& tile) {
+    while (true) {
+        int victim = -1;
+        size_t most = 0;
+        for (int w = 0; w < static_cast<int>(queues.size()); w++) {
+            if (w == thief) continue;
+            std::lock_guard<std::mutex> lock(queues[w]->mutex);
+            if (queues[w]->tiles.size() > most) {
+                most = queues[w]->tiles.size();
+                victim = w;
+            }
+        }
+        if (victim < 0) return false;
+
+        // the victim may have emptied its deque since, look again then
+        std::lock_guard<std::mutex> lock(queues[victim]->mutex);
+        if (!queues[victim]->tiles.empty()) {
+            tile = queues[victim]->tiles.back();
+            queues[victim]->tiles.pop_back();
+            return true;
+        }
+    }
+}
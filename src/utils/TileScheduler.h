@@ -0,0 +1,48 @@
+#ifndef __TILE_SCHEDULER_H__
+#define __TILE_SCHEDULER_H__
+
+#include "core/Vec.h"
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// a rectangle of pixels rendered as one unit of work, clipped to the image
+struct Tile {
+    ivec2 origin;
+    ivec2 size;
+};
+
+// hands out the tiles of an image to render workers. the tiles are ordered along a Hilbert curve and each
+// worker starts with one contiguous run of that order, so it works on a compact region and the tiles it
+// renders one after the other lie next to each other. a worker whose own deque runs dry steals from the
+// back of the fullest other deque, so the threads that drew the sky help out where the expensive pixels are
+class TileScheduler {
+public:
+    // tile_size 0 picks one with autoTileSize
+    TileScheduler(int image_width, int image_height, int tile_size, int worker_count);
+
+    // the next tile for the worker, false once every tile has been handed out
+    bool next(int worker, Tile& tile);
+
+    int getTileSize() const { return tile_size; }
+    int getTileCount() const { return tile_count; }
+
+    // square tiles in multiples of 8 pixels (one primary ray packet), as large as possible while every
+    // worker still gets about 16 tiles to balance with, between 8 and 64 pixels
+    static int autoTileSize(int image_width, int image_height, int worker_count);
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Tile> tiles;
+    };
+
+    int tile_size;
+    int tile_count;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+
+    bool steal(int thief, Tile& tile);
+};
+
+#endif